@@ -0,0 +1,730 @@
+#include "ExecutionProfile.h"
+#include "IncrementalCompiler.h"
+#include "Instruction.h"
+#include "LexicalAnalyzer.h"
+#include "Optimizer.h"
+#include "ParserAndCodeGenerator.h"
+#include "PerfCounters.h"
+#include "Program.h"
+#include "Scheduler.h"
+#include "Verifier.h"
+#include "VirtualMachine.h"
+
+#include <benchmark/benchmark.h>
+
+#include <cstdint>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/** Loop iterations fed to corpus programs through their read statement. */
+const int CORPUS_ITERATIONS = 1000;
+
+/** Iterations of the loop around each op code family benchmark. */
+const int OP_CODE_LOOP_ITERATIONS = 10000;
+
+/** Number of times the op code under test is repeated inside the loop. */
+const int OP_CODE_LOOP_BODY = 16;
+
+/**
+ * Run the benchmark loop of state over vm, counting L1 data cache misses and
+ * branch misses per run where the machine can count them.
+ */
+template <typename BeforeRun>
+void runMachine(benchmark::State& state, VirtualMachine& vm, BeforeRun beforeRun)
+{
+    PerfCounters counters;
+    PerfSample before = counters.read();
+    for (auto _ : state)
+    {
+        beforeRun();
+        vm.run();
+    }
+    PerfSample events = counters.read() - before;
+    for (PerfEvent event : {PerfEvent::L1DataReadMisses, PerfEvent::BranchMisses})
+    {
+        if (counters.available(event))
+        {
+            state.counters[PerfEventNames[static_cast<int>(event)]] = benchmark::Counter(
+                static_cast<double>(events[event]), benchmark::Counter::kAvgIterations);
+        }
+    }
+}
+
+/**
+ * Optimize code with a profile of one run of it reading CORPUS_ITERATIONS.
+ * Without PMACHINE_PROFILING the profile is all zeros.
+ */
+void optimizeWithProfile(std::vector<Instruction>& code, std::vector<int>& codeLines)
+{
+    ExecutionProfile profile;
+    {
+        VectorSink sink;
+        VectorInput input({CORPUS_ITERATIONS});
+        VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+        Profiler profiler(static_cast<int>(code.size()));
+        vm.setProfiler(&profiler);
+        vm.run();
+        profile = ExecutionProfile(code.data(), static_cast<int>(code.size()), profiler);
+    }
+    optimizeCode(code, codeLines, &profile);
+}
+
+/** Corpus programs, smallest first. */
+const char* CORPUS[] =
+{
+    "loop_001.pl0",
+    "loop_004.pl0",
+    "loop_016.pl0",
+    "loop_040.pl0"
+};
+
+std::string readCorpusFile(const char* name)
+{
+    std::ifstream file(std::string(PMACHINE_BENCH_CORPUS_DIR) + "/" + name);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+std::vector<Lexeme> lexCorpusFile(const char* name)
+{
+    std::stringstream input(readCorpusFile(name));
+    std::stringstream output;
+    std::vector<Lexeme> lexemes;
+    analyzeCode(input, output, lexemes);
+    return lexemes;
+}
+
+/**
+ * Build a program that executes body OP_CODE_LOOP_BODY times per iteration
+ * of a loop running OP_CODE_LOOP_ITERATIONS times. Register 0 is the loop
+ * counter and register 1 holds 1. Registers 2 and up are free for the body.
+ * @param prologue Instructions run once before the loop
+ * @param code Receives the program
+ * @return Number of instructions executed by the program
+ */
+long long buildLoop(const std::vector<Instruction>& prologue, const std::vector<Instruction>& body,
+    std::vector<Instruction>& code)
+{
+    code = {
+        {INC, 0, 0, 8},
+        {LIT, 0, 0, OP_CODE_LOOP_ITERATIONS},
+        {LIT, 1, 0, 1}
+    };
+    code.insert(code.end(), prologue.begin(), prologue.end());
+
+    int loop = static_cast<int>(code.size());
+    int bodyLength = static_cast<int>(body.size()) * OP_CODE_LOOP_BODY;
+    int exit = loop + 1 + bodyLength + 2;
+
+    code.push_back({JPC, 0, 0, exit});
+    for (int i = 0; i < OP_CODE_LOOP_BODY; ++i)
+    {
+        for (Instruction instruction : body)
+        {
+            // Keep jumps inside the body pointing at the next instruction
+            if (instruction.mOpCode == JMP || instruction.mOpCode == JPC)
+            {
+                instruction.mMOperand = static_cast<int>(code.size()) + 1;
+            }
+            code.push_back(instruction);
+        }
+    }
+    code.push_back({SUB, 0, 0, 1});
+    code.push_back({JMP, 0, 0, loop});
+    code.push_back({SIO3, 0, 0, 3});
+
+    return loop + 1LL + static_cast<long long>(OP_CODE_LOOP_ITERATIONS) * (3 + bodyLength);
+}
+
+void runLoop(benchmark::State& state, const std::vector<Instruction>& prologue, const std::vector<Instruction>& body)
+{
+    std::vector<Instruction> code;
+    long long executed = buildLoop(prologue, body, code);
+
+    VectorSink sink;
+    VectorInput input(std::vector<int>(OP_CODE_LOOP_ITERATIONS * OP_CODE_LOOP_BODY, 1));
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    runMachine(state, vm, [&sink, &input]()
+    {
+        sink.clear();
+        input.rewind();
+    });
+    state.SetItemsProcessed(state.iterations() * executed);
+}
+
+/****************************************************************************************
+    Compiler micro benchmarks
+*****************************************************************************************/
+
+void BM_AnalyzeCode(benchmark::State& state)
+{
+    // Lexing does not care whether the program makes sense,
+    // so scale the source by repeating the largest program.
+    std::string program = readCorpusFile(CORPUS[3]);
+    std::string source;
+    for (int64_t i = 0; i < state.range(0); ++i)
+    {
+        source += program;
+    }
+
+    size_t lexemeCount = 0;
+    for (auto _ : state)
+    {
+        std::stringstream input(source);
+        std::stringstream output;
+        std::vector<Lexeme> lexemes;
+        analyzeCode(input, output, lexemes);
+        lexemeCount = lexemes.size();
+        benchmark::DoNotOptimize(lexemes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+    state.SetItemsProcessed(state.iterations() * lexemeCount);
+}
+BENCHMARK(BM_AnalyzeCode)->RangeMultiplier(4)->Range(1, 256);
+
+void BM_LexSourceParallel(benchmark::State& state)
+{
+    // A large generated source, lexed with an increasing number of threads
+    std::string program = readCorpusFile(CORPUS[3]);
+    std::string source;
+    while (source.size() < 16 * 1024 * 1024)
+    {
+        source += program;
+    }
+
+    unsigned threadCount = static_cast<unsigned>(state.range(0));
+    for (auto _ : state)
+    {
+        std::stringstream errors;
+        std::vector<Lexeme> lexemes;
+        lexSource(source, errors, lexemes, threadCount);
+        benchmark::DoNotOptimize(lexemes.data());
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_LexSourceParallel)->RangeMultiplier(2)->Range(1, 8)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_ParseAndGenerate(benchmark::State& state)
+{
+    std::vector<Lexeme> lexemes = lexCorpusFile(CORPUS[state.range(0)]);
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    for (auto _ : state)
+    {
+        std::stringstream output;
+        bool correct = parseAndGenerage(lexemes, output, code, codeLines);
+        benchmark::DoNotOptimize(correct);
+    }
+    state.SetItemsProcessed(state.iterations() * lexemes.size());
+    state.counters["instructions"] = static_cast<double>(code.size());
+}
+BENCHMARK(BM_ParseAndGenerate)->DenseRange(0, 3);
+
+/** The largest corpus program padded with empty statements to about 4 MiB of source. */
+std::string paddedCorpusProgram()
+{
+    std::string program = readCorpusFile(CORPUS[3]);
+    std::size_t body = program.find("begin") + 5;
+    std::string padding;
+    while (padding.size() < 4 * 1024 * 1024)
+    {
+        padding += "\n  ; ; ; /* padding */ ;";
+    }
+    return program.insert(body, padding);
+}
+
+void BM_CompileLexemeTable(benchmark::State& state)
+{
+    std::string source = paddedCorpusProgram();
+    for (auto _ : state)
+    {
+        std::stringstream output;
+        std::vector<Lexeme> lexemes;
+        std::vector<Instruction> code;
+        std::vector<int> codeLines;
+        bool correct = lexSource(source, output, lexemes, 1) && parseAndGenerage(lexemes, output, code, codeLines);
+        benchmark::DoNotOptimize(correct);
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_CompileLexemeTable)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+/** Argument is whether the lexer runs on a thread of its own. */
+void BM_CompileStreaming(benchmark::State& state)
+{
+    std::string source = paddedCorpusProgram();
+    for (auto _ : state)
+    {
+        std::stringstream output;
+        std::vector<Instruction> code;
+        std::vector<int> codeLines;
+        bool correct = parseAndGenerateStreaming(source, output, code, codeLines, state.range(0) != 0);
+        benchmark::DoNotOptimize(correct);
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_CompileStreaming)->DenseRange(0, 1)->UseRealTime()->Unit(benchmark::kMillisecond);
+
+void BM_Codegen(benchmark::State& state)
+{
+    std::vector<Lexeme> lexemes;
+    std::stringstream output;
+    for (auto _ : state)
+    {
+        ParserAndCodeGenerator generator(lexemes, output);
+        for (int i = 0; i < MAX_CODE_LENGTH; ++i)
+        {
+            generator.codegen(ADD, 1, 2, 3);
+        }
+        benchmark::DoNotOptimize(generator.code().data());
+    }
+    state.SetItemsProcessed(state.iterations() * MAX_CODE_LENGTH);
+}
+BENCHMARK(BM_Codegen);
+
+void BM_IncrementalEdit(benchmark::State& state)
+{
+    // Flip one literal in the last assignment before the loop back and forth,
+    // against BM_ParseAndGenerate plus BM_AnalyzeCode for a full compile.
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+    IncrementalCompiler compiler(readCorpusFile(name));
+    std::size_t literal = compiler.source().find(":= ", compiler.source().find("while") - 12) + 3;
+
+    char digit = '1';
+    for (auto _ : state)
+    {
+        digit = digit == '1' ? '2' : '1';
+        compiler.edit(literal, 1, std::string(1, digit));
+        benchmark::DoNotOptimize(compiler.code().data());
+    }
+    state.counters["generated"] = static_cast<double>(compiler.stats().statementsGenerated);
+    state.counters["reused"] = static_cast<double>(compiler.stats().statementsReused);
+}
+BENCHMARK(BM_IncrementalEdit)->DenseRange(0, 3);
+
+void BM_FullRecompile(benchmark::State& state)
+{
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+    std::string source = readCorpusFile(name);
+    for (auto _ : state)
+    {
+        IncrementalCompiler compiler(source);
+        benchmark::DoNotOptimize(compiler.code().data());
+    }
+}
+BENCHMARK(BM_FullRecompile)->DenseRange(0, 3);
+
+/****************************************************************************************
+    Virtual machine micro benchmarks, one per op code family
+*****************************************************************************************/
+
+void BM_VmLiteral(benchmark::State& state)
+{
+    runLoop(state, {}, {{LIT, 2, 0, 42}});
+}
+BENCHMARK(BM_VmLiteral);
+
+void BM_VmArithmetic(benchmark::State& state)
+{
+    runLoop(state, {{LIT, 2, 0, 3}, {LIT, 3, 0, 7}}, {
+        {ADD, 4, 2, 3},
+        {SUB, 4, 4, 2},
+        {MUL, 4, 4, 3},
+        {DIV, 4, 4, 3},
+        {MOD, 5, 4, 3},
+        {NEG, 5, 5, 0},
+        {ODD, 4, 0, 0}
+    });
+}
+BENCHMARK(BM_VmArithmetic);
+
+void BM_VmComparison(benchmark::State& state)
+{
+    runLoop(state, {{LIT, 2, 0, 3}, {LIT, 3, 0, 7}}, {
+        {EQL, 4, 2, 3},
+        {NEQ, 4, 2, 3},
+        {LSS, 4, 2, 3},
+        {LEQ, 4, 2, 3},
+        {GTR, 4, 2, 3},
+        {GEQ, 4, 2, 3}
+    });
+}
+BENCHMARK(BM_VmComparison);
+
+void BM_VmMemory(benchmark::State& state)
+{
+    runLoop(state, {}, {
+        {STO, 0, 0, 4},
+        {LOD, 2, 0, 4},
+        {STO, 2, 0, 5},
+        {LOD, 3, 0, 5}
+    });
+}
+BENCHMARK(BM_VmMemory);
+
+void BM_VmJump(benchmark::State& state)
+{
+    runLoop(state, {{LIT, 2, 0, 0}}, {
+        {JMP, 0, 0, 0},
+        {JPC, 2, 0, 0}
+    });
+}
+BENCHMARK(BM_VmJump);
+
+void BM_VmCall(benchmark::State& state)
+{
+    // The body calls a procedure placed after the halt instruction that
+    // loads a variable one lexicographical level down and returns.
+    std::vector<Instruction> code;
+    long long executed = buildLoop({}, {{CAL, 0, 0, 0}}, code);
+    int procedure = static_cast<int>(code.size());
+    for (Instruction& instruction : code)
+    {
+        if (instruction.mOpCode == CAL)
+        {
+            instruction.mMOperand = procedure;
+        }
+    }
+    code.push_back({INC, 0, 0, 4});
+    code.push_back({LOD, 2, 1, 4});
+    code.push_back({RTN, 0, 0, 0});
+    executed += 3LL * OP_CODE_LOOP_ITERATIONS * OP_CODE_LOOP_BODY;
+
+    VectorSink sink;
+    VectorInput input;
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    runMachine(state, vm, []() {});
+    state.SetItemsProcessed(state.iterations() * executed);
+}
+BENCHMARK(BM_VmCall);
+
+void BM_VmInputOutput(benchmark::State& state)
+{
+    runLoop(state, {}, {
+        {SIO2, 2, 0, 2},
+        {SIO1, 2, 0, 1}
+    });
+}
+BENCHMARK(BM_VmInputOutput);
+
+/****************************************************************************************
+    Macro benchmarks over the corpus of generated programs
+*****************************************************************************************/
+
+void BM_CorpusRun(benchmark::State& state)
+{
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    runMachine(state, vm, [&sink, &input]()
+    {
+        sink.clear();
+        input.rewind();
+    });
+    state.counters["instructions"] = static_cast<double>(vm.instructionsExecuted());
+}
+BENCHMARK(BM_CorpusRun)->DenseRange(0, 3);
+
+void BM_CorpusRunChecked(benchmark::State& state)
+{
+    // Same as BM_CorpusRun, but checking every instruction as unverified code would be
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    vm.setAlwaysChecked(true);
+    for (auto _ : state)
+    {
+        sink.clear();
+        input.rewind();
+        vm.run();
+    }
+}
+BENCHMARK(BM_CorpusRunChecked)->DenseRange(0, 3);
+
+void BM_CorpusRunOptimized(benchmark::State& state)
+{
+    // Same as BM_CorpusRun, on the code after optimizeCode()
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+    optimizeCode(code, codeLines);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    for (auto _ : state)
+    {
+        sink.clear();
+        input.rewind();
+        vm.run();
+    }
+    state.counters["instructions"] = static_cast<double>(vm.instructionsExecuted());
+}
+BENCHMARK(BM_CorpusRunOptimized)->DenseRange(0, 3);
+
+void BM_CorpusRunProfiled(benchmark::State& state)
+{
+    // Same as BM_CorpusRunOptimized, laid out and fused by a profile of the same run
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+    optimizeWithProfile(code, codeLines);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    for (auto _ : state)
+    {
+        sink.clear();
+        input.rewind();
+        vm.run();
+    }
+    state.counters["instructions"] = static_cast<double>(vm.instructionsExecuted());
+}
+BENCHMARK(BM_CorpusRunProfiled)->DenseRange(0, 3);
+
+void BM_NumericRun(benchmark::State& state)
+{
+    // Nested loops of multiplications by constants, unoptimized (0), with
+    // invariants moved out of the loops and multiplications reduced (1), and
+    // also laid out and fused by a profile (2)
+    const char* labels[] = {"unoptimized", "optimized", "profiled"};
+    state.SetLabel(labels[state.range(0)]);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile("numeric.pl0");
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+    if (state.range(0) == 1)
+    {
+        optimizeCode(code, codeLines);
+    }
+    else if (state.range(0) == 2)
+    {
+        optimizeWithProfile(code, codeLines);
+    }
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    for (auto _ : state)
+    {
+        sink.clear();
+        input.rewind();
+        vm.run();
+    }
+    state.counters["instructions"] = static_cast<double>(vm.instructionsExecuted());
+}
+BENCHMARK(BM_NumericRun)->DenseRange(0, 2);
+
+void BM_VerifyCode(benchmark::State& state)
+{
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+
+    for (auto _ : state)
+    {
+        Verification verification = verifyCode(code.data(), static_cast<int>(code.size()));
+        benchmark::DoNotOptimize(verification.verified);
+    }
+}
+BENCHMARK(BM_VerifyCode)->DenseRange(0, 3);
+
+void BM_CorpusRunSliced(benchmark::State& state)
+{
+    // Cost of suspending and resuming every state.range(0) instructions
+    const char* name = CORPUS[2];
+    state.SetLabel(name);
+
+    std::vector<Lexeme> lexemes = lexCorpusFile(name);
+    std::stringstream output;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    parseAndGenerage(lexemes, output, code, codeLines);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+    for (auto _ : state)
+    {
+        sink.clear();
+        input.rewind();
+        vm.reset();
+        while (vm.resume(state.range(0)) != ExecutionStatus::Halted)
+        {
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * vm.instructionsExecuted());
+}
+BENCHMARK(BM_CorpusRunSliced)->RangeMultiplier(16)->Range(64, 65536);
+
+void BM_CorpusCompileAndRun(benchmark::State& state)
+{
+    const char* name = CORPUS[state.range(0)];
+    state.SetLabel(name);
+    std::string source = readCorpusFile(name);
+
+    VectorSink sink;
+    VectorInput input({CORPUS_ITERATIONS});
+
+    for (auto _ : state)
+    {
+        std::stringstream buffer(source);
+        std::stringstream output;
+        std::vector<Lexeme> lexemes;
+        std::vector<Instruction> code;
+        std::vector<int> codeLines;
+        analyzeCode(buffer, output, lexemes);
+        parseAndGenerage(lexemes, output, code, codeLines);
+
+        sink.clear();
+        input.rewind();
+        VirtualMachine vm(code.data(), static_cast<int>(code.size()), sink, input);
+        vm.run();
+    }
+    state.SetBytesProcessed(state.iterations() * source.size());
+}
+BENCHMARK(BM_CorpusCompileAndRun)->DenseRange(0, 3);
+
+void BM_ProgramRunShared(benchmark::State& state)
+{
+    // Every thread runs the same compiled program
+    static Program program = compile(readCorpusFile(CORPUS[2]));
+    state.SetLabel(CORPUS[2]);
+
+    for (auto _ : state)
+    {
+        Result result = program.run({CORPUS_ITERATIONS});
+        benchmark::DoNotOptimize(result.output.data());
+    }
+}
+BENCHMARK(BM_ProgramRunShared)->ThreadRange(1, 8)->UseRealTime();
+
+void BM_ProgramRunAll(benchmark::State& state)
+{
+    // 64 runs one at a time with run() (0) or in lanes with runAll() (1). The
+    // runs loop the same number of times (0) or each a different number (1).
+    static Program program = compile(readCorpusFile(CORPUS[2]));
+    const char* labels[] = {"run same", "run different", "runAll same", "runAll different"};
+    state.SetLabel(labels[state.range(0) * 2 + state.range(1)]);
+
+    std::vector<std::vector<int>> inputSets;
+    for (int index = 0; index < 64; ++index)
+    {
+        inputSets.push_back({state.range(1) == 0 ? CORPUS_ITERATIONS : CORPUS_ITERATIONS / 2 + index * 16});
+    }
+
+    std::uint64_t executed = 0;
+    for (auto _ : state)
+    {
+        executed = 0;
+        if (state.range(0) == 0)
+        {
+            for (const std::vector<int>& inputs : inputSets)
+            {
+                executed += program.run(inputs).instructionsExecuted;
+            }
+        }
+        else
+        {
+            for (const Result& result : program.runAll(inputSets))
+            {
+                executed += result.instructionsExecuted;
+            }
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * executed);
+}
+BENCHMARK(BM_ProgramRunAll)->ArgsProduct({{0, 1}, {0, 1}});
+
+void BM_SnapshotFork(benchmark::State& state)
+{
+    // Restore a run checkpointed halfway and finish it, against BM_ProgramRunShared
+    // which starts from scratch every time.
+    Program program = compile(readCorpusFile(CORPUS[2]));
+    state.SetLabel(CORPUS[2]);
+
+    Execution warm = program.start({CORPUS_ITERATIONS});
+    warm.resume(program.run({CORPUS_ITERATIONS}).instructionsExecuted / 2);
+    std::stringstream blob;
+    warm.snapshot().save(blob);
+    Snapshot snapshot;
+    Snapshot::load(blob, snapshot);
+
+    Execution fork = program.start({});
+    for (auto _ : state)
+    {
+        fork.restore(snapshot);
+        fork.resume();
+        benchmark::DoNotOptimize(fork.output().data());
+    }
+    state.counters["snapshotBytes"] = static_cast<double>(blob.str().size());
+}
+BENCHMARK(BM_SnapshotFork);
+
+void BM_SchedulerThroughput(benchmark::State& state)
+{
+    // Many small instances time sliced on one worker per hardware thread
+    const int instanceCount = static_cast<int>(state.range(0));
+    Program program = compile(readCorpusFile(CORPUS[1]));
+    state.SetLabel(CORPUS[1]);
+
+    Scheduler scheduler;
+    std::vector<Scheduler::InstanceId> instances(instanceCount);
+    for (auto _ : state)
+    {
+        for (int i = 0; i < instanceCount; ++i)
+        {
+            instances[i] = scheduler.submit(program, {CORPUS_ITERATIONS / 10});
+        }
+        scheduler.wait();
+        for (Scheduler::InstanceId id : instances)
+        {
+            scheduler.release(id);
+        }
+    }
+    state.SetItemsProcessed(state.iterations() * instanceCount);
+}
+BENCHMARK(BM_SchedulerThroughput)->RangeMultiplier(10)->Range(10, 10000)->UseRealTime();
+
+BENCHMARK_MAIN();
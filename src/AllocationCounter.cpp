@@ -0,0 +1,37 @@
+#include "AllocationCounter.h"
+
+#include <atomic>
+
+// Plain globals rather than function statics, since operator new can be
+// called before main() and from any thread. Relaxed increments are enough to
+// keep totals, and cheaper than ordering them with everything else.
+static std::atomic<bool> sCounted(false);
+static std::atomic<std::uint64_t> sAllocations(0);
+static std::atomic<std::uint64_t> sBytes(0);
+static std::atomic<std::uint64_t> sDeallocations(0);
+
+bool allocationsCounted()
+{
+    return sCounted.load(std::memory_order_relaxed);
+}
+
+AllocationTotals allocationTotals()
+{
+    AllocationTotals totals;
+    totals.allocations = sAllocations.load(std::memory_order_relaxed);
+    totals.bytes = sBytes.load(std::memory_order_relaxed);
+    totals.deallocations = sDeallocations.load(std::memory_order_relaxed);
+    return totals;
+}
+
+void countAllocation(std::size_t bytes)
+{
+    sCounted.store(true, std::memory_order_relaxed);
+    sAllocations.fetch_add(1, std::memory_order_relaxed);
+    sBytes.fetch_add(bytes, std::memory_order_relaxed);
+}
+
+void countDeallocation()
+{
+    sDeallocations.fetch_add(1, std::memory_order_relaxed);
+}
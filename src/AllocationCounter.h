@@ -0,0 +1,30 @@
+#ifndef ALLOCATIONCOUNTER_H
+#define ALLOCATIONCOUNTER_H
+
+#include <cstddef>
+#include <cstdint>
+
+/** Memory allocated through the global operator new since the program started. */
+struct AllocationTotals
+{
+    std::uint64_t allocations = 0;
+    std::uint64_t bytes = 0;
+    std::uint64_t deallocations = 0;
+};
+
+/**
+ * Returns if the program counts its allocations. Only programs linking
+ * AllocationHooks.cpp, which replaces the global operator new and delete, do.
+ */
+bool allocationsCounted();
+
+/** Totals counted so far. All zeros unless allocationsCounted(). */
+AllocationTotals allocationTotals();
+
+/** Count an allocation of bytes. Called by the replaced operator new. */
+void countAllocation(std::size_t bytes);
+
+/** Count a deallocation. Called by the replaced operator delete. */
+void countDeallocation();
+
+#endif // ALLOCATIONCOUNTER_H
@@ -0,0 +1,124 @@
+// Replaces the global operator new and delete with ones that count for
+// AllocationCounter.h. Only linked into programs that report allocations, so
+// the library and everything else built on it keep the standard allocator.
+
+#include "AllocationCounter.h"
+
+#include <cstdlib> // malloc(), aligned_alloc(), free()
+#include <new>
+
+static void* allocate(std::size_t size)
+{
+    countAllocation(size);
+    void* memory = std::malloc(size == 0 ? 1 : size);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+static void* allocateAligned(std::size_t size, std::align_val_t alignment)
+{
+    countAllocation(size);
+    // aligned_alloc() takes sizes that are a multiple of the alignment
+    std::size_t bytes = static_cast<std::size_t>(alignment);
+    std::size_t rounded = (size + bytes - 1) / bytes * bytes;
+    void* memory = std::aligned_alloc(bytes, rounded == 0 ? bytes : rounded);
+    if (memory == nullptr)
+    {
+        throw std::bad_alloc();
+    }
+    return memory;
+}
+
+static void deallocate(void* memory)
+{
+    if (memory != nullptr)
+    {
+        countDeallocation();
+        std::free(memory);
+    }
+}
+
+void* operator new(std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new[](std::size_t size)
+{
+    return allocate(size);
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept
+{
+    countAllocation(size);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new[](std::size_t size, const std::nothrow_t&) noexcept
+{
+    countAllocation(size);
+    return std::malloc(size == 0 ? 1 : size);
+}
+
+void* operator new(std::size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+
+void* operator new[](std::size_t size, std::align_val_t alignment)
+{
+    return allocateAligned(size, alignment);
+}
+
+void operator delete(void* memory) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete[](void* memory) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete(void* memory, std::size_t) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, std::size_t) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete(void* memory, const std::nothrow_t&) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, const std::nothrow_t&) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete(void* memory, std::align_val_t) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, std::align_val_t) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete(void* memory, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(memory);
+}
+
+void operator delete[](void* memory, std::size_t, std::align_val_t) noexcept
+{
+    deallocate(memory);
+}
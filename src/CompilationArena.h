@@ -0,0 +1,45 @@
+#ifndef COMPILATIONARENA_H
+#define COMPILATIONARENA_H
+
+#include <cstddef>
+#include <memory_resource>
+
+/** Size of the first block of a compilation arena. Later blocks grow geometrically. */
+const std::size_t ARENA_BLOCK_SIZE = 4096;
+
+/**
+ * Memory for the data that only lives while one program is compiled, such as
+ * the symbol table of the parser. Allocations are carved out of a few
+ * large blocks and never freed one by one. The blocks are all released at once
+ * by release() or when the arena is destroyed.
+ *
+ * Containers use the arena through resource(), as std::pmr containers. It is
+ * not thread safe, so each thread compiling needs an arena of its own.
+ */
+class CompilationArena
+{
+public:
+    CompilationArena()
+        : mMemory(ARENA_BLOCK_SIZE)
+    {
+    }
+
+    CompilationArena(const CompilationArena&) = delete;
+    CompilationArena& operator=(const CompilationArena&) = delete;
+
+    std::pmr::memory_resource* resource()
+    {
+        return &mMemory;
+    }
+
+    /** Free everything allocated from the arena. Nothing allocated from it may be used afterwards. */
+    void release()
+    {
+        mMemory.release();
+    }
+
+private:
+    std::pmr::monotonic_buffer_resource mMemory;
+};
+
+#endif // COMPILATIONARENA_H
@@ -0,0 +1,428 @@
+#include "ControlFlowGraph.h"
+
+#include <algorithm> // min()
+#include <utility>
+
+/** Returns if instruction ends a basic block. */
+static bool endsBlock(const Instruction& instruction)
+{
+    return instruction.mOpCode == JMP || instruction.mOpCode == JPC
+        || instruction.mOpCode == RTN || instruction.mOpCode == SIO3;
+}
+
+ControlFlowGraph::ControlFlowGraph(const std::vector<Instruction>& code, const std::vector<int>& codeLines,
+    const ExecutionProfile* profile)
+{
+    const int codeLength = static_cast<int>(code.size());
+    if (codeLength == 0 || codeLines.size() != code.size())
+    {
+        return;
+    }
+
+    // Blocks start at the start of the code, at every jump and call target and
+    // after every instruction that ends a block
+    std::vector<int> blockAt(codeLength, -1);
+    blockAt[0] = 0;
+    for (int i = 0; i < codeLength; ++i)
+    {
+        const Instruction& instruction = code[i];
+        if (instruction.mOpCode < LIT || instruction.mOpCode > GEQ)
+        {
+            return;
+        }
+        if (instruction.mOpCode == JMP || instruction.mOpCode == JPC || instruction.mOpCode == CAL)
+        {
+            if (instruction.mMOperand < 0 || instruction.mMOperand >= codeLength)
+            {
+                return;
+            }
+            blockAt[instruction.mMOperand] = 0;
+        }
+        if (endsBlock(instruction) && i + 1 < codeLength)
+        {
+            blockAt[i + 1] = 0;
+        }
+    }
+    // Nothing may run past the end of the code
+    if (!endsBlock(code.back()) || code.back().mOpCode == JPC)
+    {
+        return;
+    }
+
+    int blockCount = 0;
+    for (int& block : blockAt)
+    {
+        if (block == 0)
+        {
+            block = blockCount++;
+        }
+    }
+    mBlocks.resize(blockCount);
+
+    int current = 0;
+    for (int i = 0; i < codeLength; ++i)
+    {
+        if (blockAt[i] != -1)
+        {
+            current = blockAt[i];
+            if (profile != nullptr)
+            {
+                mBlocks[current].count = profile->executions(i);
+            }
+        }
+        BasicBlock& block = mBlocks[current];
+        Instruction instruction = code[i];
+        block.exitLine = codeLines[i];
+
+        switch (instruction.mOpCode)
+        {
+            case JMP:
+                block.exit = BlockExit::Jump;
+                block.next = blockAt[instruction.mMOperand];
+                break;
+            case JPC:
+                block.exit = BlockExit::Branch;
+                block.next = blockAt[i + 1];
+                block.taken = blockAt[instruction.mMOperand];
+                block.condition = instruction.mRegister;
+                if (profile != nullptr)
+                {
+                    block.takenCount = profile->taken(i);
+                }
+                break;
+            case RTN:
+                block.exit = BlockExit::Return;
+                break;
+            case SIO3:
+                block.exit = BlockExit::Halt;
+                break;
+            default:
+                if (instruction.mOpCode == CAL)
+                {
+                    instruction.mMOperand = blockAt[instruction.mMOperand];
+                }
+                block.code.push_back(instruction);
+                block.lines.push_back(codeLines[i]);
+                // Falls through into the next block
+                block.exit = BlockExit::Jump;
+                block.next = i + 1 < codeLength ? blockAt[i + 1] : -1;
+                break;
+        }
+    }
+
+    mValid = true;
+    mProfiled = profile != nullptr;
+}
+
+std::uint64_t ControlFlowGraph::edgeCount(int block, int successor) const
+{
+    const BasicBlock& current = mBlocks[block];
+    std::uint64_t count = 0;
+    if (current.exit == BlockExit::Branch)
+    {
+        if (current.taken == successor)
+        {
+            count += current.takenCount;
+        }
+        if (current.next == successor)
+        {
+            count += current.count - std::min(current.takenCount, current.count);
+        }
+    }
+    else if (current.exit == BlockExit::Jump && current.next == successor)
+    {
+        count = current.count;
+    }
+    return count;
+}
+
+std::vector<int> ControlFlowGraph::roots() const
+{
+    std::vector<int> roots{0};
+    std::vector<char> isRoot(mBlocks.size(), 0);
+    isRoot[0] = 1;
+    for (const BasicBlock& block : mBlocks)
+    {
+        for (const Instruction& instruction : block.code)
+        {
+            if (instruction.mOpCode == CAL && !isRoot[instruction.mMOperand])
+            {
+                isRoot[instruction.mMOperand] = 1;
+                roots.push_back(instruction.mMOperand);
+            }
+        }
+    }
+    return roots;
+}
+
+std::vector<int> ControlFlowGraph::successors(int block) const
+{
+    const BasicBlock& current = mBlocks[block];
+    switch (current.exit)
+    {
+        case BlockExit::Jump:
+            return {current.next};
+        case BlockExit::Branch:
+            if (current.next == current.taken)
+            {
+                return {current.next};
+            }
+            return {current.next, current.taken};
+        default:
+            return {};
+    }
+}
+
+std::vector<std::vector<int>> ControlFlowGraph::predecessors() const
+{
+    std::vector<std::vector<int>> predecessors(mBlocks.size());
+    for (int block = 0; block < static_cast<int>(mBlocks.size()); ++block)
+    {
+        for (int successor : successors(block))
+        {
+            predecessors[successor].push_back(block);
+        }
+    }
+    return predecessors;
+}
+
+int ControlFlowGraph::removeUnreachable()
+{
+    // Calls are followed too, so only calls from reachable code keep a procedure
+    std::vector<int> renumbered(mBlocks.size(), -1);
+    std::vector<int> pending{0};
+    renumbered[0] = 0;
+    while (!pending.empty())
+    {
+        int block = pending.back();
+        pending.pop_back();
+
+        std::vector<int> reached = successors(block);
+        for (const Instruction& instruction : mBlocks[block].code)
+        {
+            if (instruction.mOpCode == CAL)
+            {
+                reached.push_back(instruction.mMOperand);
+            }
+        }
+        for (int successor : reached)
+        {
+            if (renumbered[successor] == -1)
+            {
+                renumbered[successor] = 0;
+                pending.push_back(successor);
+            }
+        }
+    }
+
+    int kept = 0;
+    for (int& number : renumbered)
+    {
+        if (number == 0)
+        {
+            number = kept++;
+        }
+    }
+    int removed = static_cast<int>(mBlocks.size()) - kept;
+    if (removed == 0)
+    {
+        return 0;
+    }
+
+    std::vector<BasicBlock> blocks;
+    blocks.reserve(kept);
+    for (std::size_t block = 0; block < mBlocks.size(); ++block)
+    {
+        if (renumbered[block] == -1)
+        {
+            continue;
+        }
+        BasicBlock& moved = mBlocks[block];
+        for (Instruction& instruction : moved.code)
+        {
+            if (instruction.mOpCode == CAL)
+            {
+                instruction.mMOperand = renumbered[instruction.mMOperand];
+            }
+        }
+        if (moved.exit == BlockExit::Jump || moved.exit == BlockExit::Branch)
+        {
+            moved.next = renumbered[moved.next];
+        }
+        if (moved.exit == BlockExit::Branch)
+        {
+            moved.taken = renumbered[moved.taken];
+        }
+        blocks.push_back(std::move(moved));
+    }
+    mBlocks = std::move(blocks);
+    return removed;
+}
+
+std::vector<Loop> ControlFlowGraph::loops() const
+{
+    const int blockCount = static_cast<int>(mBlocks.size());
+
+    // Depth first search for back edges: edges to a block still on the path
+    std::vector<char> state(blockCount, 0); // 0 unvisited, 1 on the path, 2 done
+    std::vector<std::vector<int>> latches(blockCount);
+    for (int root : roots())
+    {
+        if (state[root] != 0)
+        {
+            continue;
+        }
+        std::vector<std::pair<int, std::size_t>> path{{root, 0}};
+        state[root] = 1;
+        while (!path.empty())
+        {
+            int block = path.back().first;
+            std::vector<int> next = successors(block);
+            if (path.back().second < next.size())
+            {
+                int successor = next[path.back().second++];
+                if (state[successor] == 1)
+                {
+                    latches[successor].push_back(block);
+                }
+                else if (state[successor] == 0)
+                {
+                    state[successor] = 1;
+                    path.emplace_back(successor, 0);
+                }
+                continue;
+            }
+            state[block] = 2;
+            path.pop_back();
+        }
+    }
+
+    // The loop of a header is every block that reaches one of its latches
+    // without passing the header
+    std::vector<std::vector<int>> predecessorLists = predecessors();
+    std::vector<int> inLoop(blockCount, -1);
+    std::vector<Loop> loops;
+    for (int header = 0; header < blockCount; ++header)
+    {
+        if (latches[header].empty())
+        {
+            continue;
+        }
+        Loop loop;
+        loop.header = header;
+        loop.blocks.push_back(header);
+        inLoop[header] = header;
+        std::vector<int> pending = latches[header];
+        while (!pending.empty())
+        {
+            int block = pending.back();
+            pending.pop_back();
+            if (inLoop[block] == header)
+            {
+                continue;
+            }
+            inLoop[block] = header;
+            loop.blocks.push_back(block);
+            for (int predecessor : predecessorLists[block])
+            {
+                pending.push_back(predecessor);
+            }
+        }
+        loops.push_back(std::move(loop));
+    }
+    return loops;
+}
+
+std::vector<int> ControlFlowGraph::loopDepths() const
+{
+    std::vector<int> depths(mBlocks.size(), 0);
+    for (const Loop& loop : loops())
+    {
+        for (int block : loop.blocks)
+        {
+            ++depths[block];
+        }
+    }
+    return depths;
+}
+
+void ControlFlowGraph::emit(const std::vector<int>& order, std::vector<Instruction>& code,
+    std::vector<int>& codeLines, std::vector<int>* blockStarts) const
+{
+    // Number of instructions ending each block, which depends on the block following it
+    auto exitLength = [this, &order](std::size_t position)
+    {
+        const BasicBlock& block = mBlocks[order[position]];
+        int following = position + 1 < order.size() ? order[position + 1] : -1;
+        switch (block.exit)
+        {
+            case BlockExit::Jump:
+                return block.next == following ? 0 : 1;
+            case BlockExit::Branch:
+                return block.next == following ? 1 : 2;
+            default:
+                return 1;
+        }
+    };
+
+    std::vector<int> start(mBlocks.size(), 0);
+    int length = 0;
+    for (std::size_t position = 0; position < order.size(); ++position)
+    {
+        start[order[position]] = length;
+        length += static_cast<int>(mBlocks[order[position]].code.size()) + exitLength(position);
+    }
+
+    code.clear();
+    codeLines.clear();
+    code.reserve(length);
+    codeLines.reserve(length);
+    for (std::size_t position = 0; position < order.size(); ++position)
+    {
+        const BasicBlock& block = mBlocks[order[position]];
+        for (std::size_t i = 0; i < block.code.size(); ++i)
+        {
+            Instruction instruction = block.code[i];
+            if (instruction.mOpCode == CAL)
+            {
+                instruction.mMOperand = start[instruction.mMOperand];
+            }
+            code.push_back(instruction);
+            codeLines.push_back(block.lines[i]);
+        }
+
+        int exits = exitLength(position);
+        switch (block.exit)
+        {
+            case BlockExit::Jump:
+                if (exits == 1)
+                {
+                    code.push_back({JMP, 0, 0, start[block.next]});
+                }
+                break;
+            case BlockExit::Branch:
+                code.push_back({JPC, block.condition, 0, start[block.taken]});
+                if (exits == 2)
+                {
+                    codeLines.push_back(block.exitLine);
+                    code.push_back({JMP, 0, 0, start[block.next]});
+                }
+                break;
+            case BlockExit::Return:
+                code.push_back({RTN, 0, 0, 0});
+                break;
+            case BlockExit::Halt:
+                code.push_back({SIO3, 0, 0, 3});
+                break;
+        }
+        if (exits > 0)
+        {
+            codeLines.push_back(block.exitLine);
+        }
+    }
+
+    if (blockStarts != nullptr)
+    {
+        *blockStarts = std::move(start);
+    }
+}
@@ -0,0 +1,147 @@
+#ifndef CONTROLFLOWGRAPH_H
+#define CONTROLFLOWGRAPH_H
+
+#include "ExecutionProfile.h"
+#include "Instruction.h"
+
+#include <cstdint>
+#include <vector>
+
+/** How control leaves a basic block. */
+enum class BlockExit : int
+{
+    Jump,       // Continue at the next block, by falling through or with a JMP
+    Branch,     // JPC. Continue at the taken block if the condition register is 0, else at the next block
+    Return,     // RTN
+    Halt        // SIO 0, 0, 3
+};
+
+/**
+ * Straight line code with a single entry at the top. The instruction ending
+ * the block is not stored with it but described by exit, so blocks can be put
+ * in any order and jumps are added back when the code is laid out.
+ */
+struct BasicBlock
+{
+    /** Instructions in the block. The M operand of a CAL holds the index of the called block. */
+    std::vector<Instruction> code;
+
+    /** Source line of each instruction in code. */
+    std::vector<int> lines;
+
+    BlockExit exit = BlockExit::Jump;
+
+    /** Block control continues at. For a branch, where it goes when the condition is not 0. */
+    int next = -1;
+
+    /** For a branch, block control continues at when the condition is 0. */
+    int taken = -1;
+
+    /** For a branch, the register tested. */
+    int condition = 0;
+
+    /** Source line of the instruction ending the block. */
+    int exitLine = 0;
+
+    /** Times the block ran in the profile the graph was built with, 0 without one. */
+    std::uint64_t count = 0;
+
+    /** For a branch, times it went on to taken in the profile. */
+    std::uint64_t takenCount = 0;
+};
+
+/** A natural loop: the blocks that can reach a back edge to the header without passing it. */
+struct Loop
+{
+    int header = 0;
+
+    /** Blocks in the loop, the header first. */
+    std::vector<int> blocks;
+};
+
+/**
+ * The code of a program split into basic blocks. Block 0 is where execution
+ * starts. Jumps, branches and calls refer to blocks rather than to code
+ * indices, and are relinked when the blocks are laid out again with emit().
+ */
+class ControlFlowGraph
+{
+public:
+    /**
+     * Split code into basic blocks. Code that jumps or calls outside of itself,
+     * runs past its end or has unknown op codes or superinstructions cannot be
+     * split. Check valid().
+     * @param codeLines Source line of each instruction
+     * @param profile Counts the blocks are given, recorded for code. nullptr for none.
+     */
+    ControlFlowGraph(const std::vector<Instruction>& code, const std::vector<int>& codeLines,
+        const ExecutionProfile* profile = nullptr);
+
+    /** Returns if the code could be split into basic blocks. */
+    bool valid() const
+    {
+        return mValid;
+    }
+
+    std::vector<BasicBlock>& blocks()
+    {
+        return mBlocks;
+    }
+
+    const std::vector<BasicBlock>& blocks() const
+    {
+        return mBlocks;
+    }
+
+    /** Returns if the blocks were given the counts of a profile. */
+    bool profiled() const
+    {
+        return mProfiled;
+    }
+
+    /** Times control went from block to successor in the profile. */
+    std::uint64_t edgeCount(int block, int successor) const;
+
+    /** Blocks execution can start at: block 0 and every block that is called. */
+    std::vector<int> roots() const;
+
+    /** Blocks control can continue at after block, next first. */
+    std::vector<int> successors(int block) const;
+
+    /** Blocks control can reach each block from. */
+    std::vector<std::vector<int>> predecessors() const;
+
+    /**
+     * Remove the blocks that cannot be reached from the roots, renumbering the rest.
+     * @return Number of blocks removed
+     */
+    int removeUnreachable();
+
+    /**
+     * Loops of the program, one per header. Loops are found from the back edges
+     * of a depth first search from the roots, so a loop that can be entered
+     * other than through its header may be missing blocks.
+     */
+    std::vector<Loop> loops() const;
+
+    /** Number of loops each block is part of. */
+    std::vector<int> loopDepths() const;
+
+    /**
+     * Lay the blocks out in order and relink jumps, branches and calls.
+     * Jumps to the block that follows are left out.
+     * @param order Every block once, starting with block 0
+     * @param code Receives the code
+     * @param codeLines Receives the source line of each instruction
+     * @param blockStarts Receives the code index each block starts at, unless nullptr
+     */
+    void emit(const std::vector<int>& order, std::vector<Instruction>& code, std::vector<int>& codeLines,
+        std::vector<int>* blockStarts = nullptr) const;
+
+private:
+    std::vector<BasicBlock> mBlocks;
+    bool mValid = false;
+    bool mProfiled = false;
+};
+
+#endif // CONTROLFLOWGRAPH_H
@@ -0,0 +1,74 @@
+#include "ExecutionProfile.h"
+
+#include "Snapshot.h" // codeFingerprint()
+#include "VirtualMachine.h" // MAX_CODE_LENGTH
+
+#include <string>
+#include <utility>
+
+ExecutionProfile::ExecutionProfile(const Instruction* code, int codeLength, const Profiler& profiler)
+    : mCodeFingerprint(codeFingerprint(code, codeLength))
+    , mExecutions(codeLength, 0)
+    , mTaken(codeLength, 0)
+{
+    for (int pc = 0; pc < codeLength && pc < profiler.codeLength(); ++pc)
+    {
+        mExecutions[pc] = profiler.executions(pc);
+        mTaken[pc] = profiler.taken(pc);
+    }
+}
+
+bool ExecutionProfile::matches(const Instruction* code, int codeLength) const
+{
+    return !empty() && mExecutions.size() == static_cast<std::size_t>(codeLength)
+        && mCodeFingerprint == codeFingerprint(code, codeLength);
+}
+
+bool ExecutionProfile::merge(const ExecutionProfile& other)
+{
+    if (other.mCodeFingerprint != mCodeFingerprint || other.mExecutions.size() != mExecutions.size())
+    {
+        return false;
+    }
+
+    for (std::size_t pc = 0; pc < mExecutions.size(); ++pc)
+    {
+        mExecutions[pc] += other.mExecutions[pc];
+        mTaken[pc] += other.mTaken[pc];
+    }
+    return true;
+}
+
+void ExecutionProfile::save(std::ostream& output) const
+{
+    output << EXECUTION_PROFILE_MAGIC << " " << mExecutions.size() << " " << mCodeFingerprint << "\n";
+    for (std::size_t pc = 0; pc < mExecutions.size(); ++pc)
+    {
+        output << mExecutions[pc] << " " << mTaken[pc] << "\n";
+    }
+}
+
+bool ExecutionProfile::load(std::istream& input, ExecutionProfile& profile)
+{
+    std::string magic;
+    long long codeLength = 0;
+    ExecutionProfile loaded;
+    if (!(input >> magic >> codeLength >> loaded.mCodeFingerprint) || magic != EXECUTION_PROFILE_MAGIC
+        || codeLength <= 0 || codeLength > MAX_CODE_LENGTH)
+    {
+        return false;
+    }
+
+    loaded.mExecutions.resize(codeLength);
+    loaded.mTaken.resize(codeLength);
+    for (long long pc = 0; pc < codeLength; ++pc)
+    {
+        if (!(input >> loaded.mExecutions[pc] >> loaded.mTaken[pc]) || loaded.mTaken[pc] > loaded.mExecutions[pc])
+        {
+            return false;
+        }
+    }
+
+    profile = std::move(loaded);
+    return true;
+}
@@ -0,0 +1,77 @@
+#ifndef EXECUTIONPROFILE_H
+#define EXECUTIONPROFILE_H
+
+#include "Instruction.h"
+#include "Profiler.h"
+
+#include <cstdint>
+#include <istream>
+#include <ostream>
+#include <vector>
+
+/** First word of every saved profile. */
+const char EXECUTION_PROFILE_MAGIC[] = "PMP1";
+
+/**
+ * How often each instruction of a program executed and each branch jumped,
+ * collected from runs of the program and fed back to optimizeCode().
+ *
+ * A profile remembers a fingerprint of the code it was recorded for and only
+ * applies to that code. Profiles are saved as text: a header line with the
+ * magic, the code length and the fingerprint, then one line per instruction
+ * with its executions and jumps taken.
+ */
+class ExecutionProfile
+{
+public:
+    /** An empty profile that matches no code. */
+    ExecutionProfile() = default;
+
+    /** Take the counts of profiler, which profiled runs of code. */
+    ExecutionProfile(const Instruction* code, int codeLength, const Profiler& profiler);
+
+    bool empty() const
+    {
+        return mExecutions.empty();
+    }
+
+    /** Returns if the profile was recorded for code. */
+    bool matches(const Instruction* code, int codeLength) const;
+
+    /**
+     * Add the counts of another profile of the same code, so that a profile
+     * can cover many runs.
+     * @return false if other was recorded for other code
+     */
+    bool merge(const ExecutionProfile& other);
+
+    /** Number of times the instruction at index pc executed. */
+    std::uint64_t executions(int pc) const
+    {
+        return mExecutions[pc];
+    }
+
+    /** Number of times the branch at index pc jumped rather than falling through. */
+    std::uint64_t taken(int pc) const
+    {
+        return mTaken[pc];
+    }
+
+    /** Write the profile in its text form. */
+    void save(std::ostream& output) const;
+
+    /**
+     * Read a profile written by save().
+     * @return false if the input is not a valid profile
+     */
+    static bool load(std::istream& input, ExecutionProfile& profile);
+
+private:
+    std::uint64_t mCodeFingerprint = 0;
+    /** Executions per code index. */
+    std::vector<std::uint64_t> mExecutions;
+    /** Jumps taken per code index. */
+    std::vector<std::uint64_t> mTaken;
+};
+
+#endif // EXECUTIONPROFILE_H
@@ -0,0 +1,417 @@
+#include "IncrementalCompiler.h"
+
+#include "LexicalAnalyzer.h"
+#include "ParserAndCodeGenerator.h"
+#include "VirtualMachine.h" // MAX_CODE_LENGTH
+
+#include <algorithm>
+#include <sstream>
+#include <utility>
+
+/** Offset just past the last character of lexeme. */
+static std::size_t lexemeEnd(const Lexeme& lexeme)
+{
+    return lexeme.offset + lexeme.lexeme.size();
+}
+
+IncrementalCompiler::IncrementalCompiler(std::string source)
+    : mSource(std::move(source))
+{
+    compileAll();
+}
+
+bool IncrementalCompiler::edit(std::size_t offset, std::size_t length, const std::string& text)
+{
+    offset = std::min(offset, mSource.size());
+    length = std::min(length, mSource.size() - offset);
+    mSource.replace(offset, length, text);
+
+    if (!mCached)
+    {
+        compileAll();
+        return mValid;
+    }
+
+    mStats = Stats();
+    int first;
+    int removed;
+    int inserted;
+    if (!relex(offset, length, text.size(), first, removed, inserted) || !update(first, removed, inserted))
+    {
+        compileAll();
+    }
+    return mValid;
+}
+
+void IncrementalCompiler::compileAll()
+{
+    mStats = Stats();
+    mStats.fullCompile = true;
+    mStats.bytesLexed = mSource.size();
+
+    std::stringstream errors;
+    Lexer lexer(mSource, errors);
+    Lexeme lexeme;
+    mLexemes.clear();
+    while (lexer.next(lexeme))
+    {
+        mLexemes.push_back(std::move(lexeme));
+    }
+    bool lexicallyCorrect = !lexer.errorFound();
+
+    mCached = lexicallyCorrect && compileSegments();
+    if (mCached)
+    {
+        mValid = true;
+        return;
+    }
+
+    // Not made of cacheable statements or has errors. Leave it to the one pass parser.
+    mSegments.clear();
+    mCode.clear();
+    mCodeLines.clear();
+    std::stringstream output;
+    mValid = parseAndGenerage(mLexemes, output, mCode, mCodeLines) && lexicallyCorrect;
+}
+
+bool IncrementalCompiler::compileSegments()
+{
+    if (mLexemes.empty())
+    {
+        return false;
+    }
+
+    std::stringstream errors;
+    ParserAndCodeGenerator parser(mLexemes, errors);
+    int body = parser.parseDeclarations();
+    int lexemeCount = static_cast<int>(mLexemes.size());
+    if (!parser.syntaxCorrect() || body >= lexemeCount || mLexemes[body].type != token_type::beginSym)
+    {
+        return false;
+    }
+    mPrologue = parser.code();
+    mPrologueLines = parser.codeLines();
+    mBodyFirst = body + 1;
+
+    // Find the end matching the main begin. It has to be followed by the period.
+    int depth = 0;
+    mBodyEnd = -1;
+    for (int i = body; i < lexemeCount && mBodyEnd < 0; ++i)
+    {
+        if (mLexemes[i].type == token_type::beginSym)
+        {
+            ++depth;
+        }
+        else if (mLexemes[i].type == token_type::endSym && --depth == 0)
+        {
+            mBodyEnd = i;
+        }
+    }
+    if (mBodyEnd < 0 || mBodyEnd + 1 >= lexemeCount || mLexemes[mBodyEnd + 1].type != token_type::periodSym)
+    {
+        return false;
+    }
+
+    mSegments.clear();
+    if (!split(mBodyFirst, mBodyEnd, true, mSegments))
+    {
+        return false;
+    }
+
+    int rx = parser.registerIndex();
+    for (Segment& segment : mSegments)
+    {
+        if (!generate(parser, segment, rx))
+        {
+            return false;
+        }
+        rx = segment.rxOut;
+        ++mStats.statementsGenerated;
+    }
+    return assemble();
+}
+
+bool IncrementalCompiler::relex(std::size_t offset, std::size_t length, std::size_t textLength,
+    int& first, int& removed, int& inserted)
+{
+    long long delta = static_cast<long long>(textLength) - static_cast<long long>(length);
+    std::size_t removedEnd = offset + length;
+    std::size_t insertedEnd = offset + textLength;
+    int lexemeCount = static_cast<int>(mLexemes.size());
+
+    // The first lexeme that can change is the first one reaching the edit, since
+    // characters added right after a lexeme may become part of it.
+    auto reaching = std::lower_bound(mLexemes.begin(), mLexemes.end(), offset,
+        [](const Lexeme& lexeme, std::size_t position)
+        {
+            return lexemeEnd(lexeme) < position;
+        });
+    int a = static_cast<int>(reaching - mLexemes.begin());
+
+    // Lexing restarts right after the previous lexeme, which is never inside a comment
+    std::size_t start = a > 0 ? lexemeEnd(mLexemes[a - 1]) : 0;
+    int line = a > 0 ? mLexemes[a - 1].line : 1;
+
+    std::stringstream errors;
+    Lexer lexer(mSource, errors);
+    lexer.seek(start, line);
+
+    // Lex until a lexeme past the edit lines up with an old lexeme. Everything
+    // from there on is unchanged apart from its position.
+    std::vector<Lexeme> fresh;
+    int b = a;
+    bool linedUp = false;
+    int lineDelta = 0;
+    int columnDelta = 0;
+    int linedUpLine = 0;
+    Lexeme lexeme;
+    while (!linedUp && lexer.next(lexeme))
+    {
+        if (lexeme.offset >= insertedEnd)
+        {
+            long long position = static_cast<long long>(lexeme.offset);
+            while (b < lexemeCount && static_cast<long long>(mLexemes[b].offset) + delta < position)
+            {
+                ++b;
+            }
+            linedUp = b < lexemeCount && mLexemes[b].offset >= removedEnd
+                && static_cast<long long>(mLexemes[b].offset) + delta == position
+                && mLexemes[b].lexeme == lexeme.lexeme;
+        }
+
+        if (linedUp)
+        {
+            lineDelta = lexeme.line - mLexemes[b].line;
+            columnDelta = lexeme.column - mLexemes[b].column;
+            linedUpLine = mLexemes[b].line;
+        }
+        else
+        {
+            fresh.push_back(std::move(lexeme));
+        }
+    }
+    if (!linedUp)
+    {
+        // Reached the end of the source. Every old lexeme from a on is replaced.
+        b = lexemeCount;
+    }
+    mStats.bytesLexed = lexer.offset() - start;
+    if (lexer.errorFound())
+    {
+        return false;
+    }
+
+    first = a;
+    removed = b - a;
+    inserted = static_cast<int>(fresh.size());
+
+    mLexemes.erase(mLexemes.begin() + a, mLexemes.begin() + b);
+    mLexemes.insert(mLexemes.begin() + a, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    for (auto itr = mLexemes.begin() + a + inserted; itr != mLexemes.end(); ++itr)
+    {
+        itr->offset = static_cast<std::size_t>(static_cast<long long>(itr->offset) + delta);
+        // Only lexemes sharing a line with the end of the edit move sideways
+        if (itr->line == linedUpLine)
+        {
+            itr->column += columnDelta;
+        }
+        itr->line += lineDelta;
+    }
+    return true;
+}
+
+bool IncrementalCompiler::update(int first, int removed, int inserted)
+{
+    // Edits changing lexemes outside the main begin ... end need the whole
+    // program compiled. Edits that only move lexemes, like editing a comment,
+    // leave the code alone apart from the source lines.
+    bool changed = removed != 0 || inserted != 0;
+    if (changed && (first < mBodyFirst || first + removed > mBodyEnd))
+    {
+        return false;
+    }
+    int shift = inserted - removed;
+    int segmentCount = static_cast<int>(mSegments.size());
+
+    // Segments [k1, k2) hold the replaced lexemes. An insertion between
+    // lexemes goes into the segment holding the lexeme after it.
+    int k1 = 0;
+    int k2 = 0;
+    std::vector<Segment> fresh;
+    if (changed || (first >= mBodyFirst && first <= mBodyEnd))
+    {
+        while (k1 < segmentCount && mSegments[k1].first + mSegments[k1].count <= first)
+        {
+            ++k1;
+        }
+        k1 = std::max(0, std::min(k1, segmentCount - 1));
+        k2 = k1 + 1;
+        while (k2 < segmentCount && mSegments[k2].first < first + removed)
+        {
+            ++k2;
+        }
+        k2 = std::min(k2, segmentCount);
+
+        int regionFirst = segmentCount > 0 ? mSegments[k1].first : mBodyFirst;
+        int regionEnd = (segmentCount > 0 ? mSegments[k2 - 1].first + mSegments[k2 - 1].count : mBodyFirst) + shift;
+        if (!split(regionFirst, regionEnd, k2 == segmentCount, fresh))
+        {
+            return false;
+        }
+    }
+
+    // Declarations are short. Parsing them again also moves their code to new source lines.
+    std::stringstream errors;
+    ParserAndCodeGenerator parser(mLexemes, errors);
+    parser.parseDeclarations();
+    mPrologue = parser.code();
+    mPrologueLines = parser.codeLines();
+    int rx = k1 > 0 ? mSegments[k1 - 1].rxOut : parser.registerIndex();
+    mStats.statementsReused = k1;
+
+    for (Segment& segment : fresh)
+    {
+        if (!generate(parser, segment, rx))
+        {
+            return false;
+        }
+        rx = segment.rxOut;
+        ++mStats.statementsGenerated;
+    }
+
+    // Statements after the edit only move, unless they now start with another register
+    for (int k = k2; k < segmentCount; ++k)
+    {
+        Segment& segment = mSegments[k];
+        segment.first += shift;
+        if (segment.rxIn != rx)
+        {
+            if (!generate(parser, segment, rx))
+            {
+                return false;
+            }
+            ++mStats.statementsGenerated;
+        }
+        else
+        {
+            ++mStats.statementsReused;
+        }
+        rx = segment.rxOut;
+    }
+
+    mSegments.erase(mSegments.begin() + k1, mSegments.begin() + k2);
+    mSegments.insert(mSegments.begin() + k1, std::make_move_iterator(fresh.begin()), std::make_move_iterator(fresh.end()));
+    mBodyEnd += shift;
+    mValid = assemble();
+    return mValid;
+}
+
+bool IncrementalCompiler::split(int first, int end, bool last, std::vector<Segment>& segments) const
+{
+    int lexemeCount = static_cast<int>(mLexemes.size());
+    int depth = 0;
+    int start = first;
+    for (int i = first; i < end; ++i)
+    {
+        token_type type = mLexemes[i].type;
+        if (type == token_type::beginSym)
+        {
+            ++depth;
+        }
+        else if (type == token_type::endSym && --depth < 0)
+        {
+            return false;
+        }
+        // A semicolon followed by else belongs to the if statement before it
+        else if (type == token_type::semicolonSym && depth == 0
+            && !(i + 1 < lexemeCount && mLexemes[i + 1].type == token_type::elseSym))
+        {
+            Segment segment;
+            segment.first = start;
+            segment.count = i + 1 - start;
+            segments.push_back(std::move(segment));
+            start = i + 1;
+        }
+    }
+    if (depth != 0)
+    {
+        return false;
+    }
+
+    if (start < end)
+    {
+        // Only the last statement of the body goes without a semicolon
+        if (!last)
+        {
+            return false;
+        }
+        Segment segment;
+        segment.first = start;
+        segment.count = end - start;
+        segments.push_back(std::move(segment));
+    }
+    return true;
+}
+
+bool IncrementalCompiler::generate(ParserAndCodeGenerator& parser, Segment& segment, int rx) const
+{
+    int next = parser.parseStatement(segment.first, rx);
+
+    // The statement has to end right before its semicolon, or at the end of the body
+    int end = segment.first + segment.count;
+    if (mLexemes[end - 1].type == token_type::semicolonSym)
+    {
+        --end;
+    }
+    if (!parser.syntaxCorrect() || next != end)
+    {
+        return false;
+    }
+
+    segment.rxIn = rx;
+    segment.rxOut = parser.registerIndex();
+    segment.code = parser.code();
+    segment.lines = parser.codeLines();
+    int line = mLexemes[segment.first].line;
+    for (int& codeLine : segment.lines)
+    {
+        codeLine -= line;
+    }
+    return true;
+}
+
+bool IncrementalCompiler::assemble()
+{
+    std::size_t codeLength = mPrologue.size() + 1;
+    for (const Segment& segment : mSegments)
+    {
+        codeLength += segment.code.size();
+    }
+    if (codeLength > static_cast<std::size_t>(MAX_CODE_LENGTH))
+    {
+        return false;
+    }
+
+    mCode = mPrologue;
+    mCodeLines = mPrologueLines;
+    for (const Segment& segment : mSegments)
+    {
+        int base = static_cast<int>(mCode.size());
+        int line = mLexemes[segment.first].line;
+        for (std::size_t i = 0; i < segment.code.size(); ++i)
+        {
+            Instruction instruction = segment.code[i];
+            if (instruction.mOpCode == JMP || instruction.mOpCode == JPC)
+            {
+                instruction.mMOperand += base;
+            }
+            mCode.push_back(instruction);
+            mCodeLines.push_back(segment.lines[i] + line);
+        }
+    }
+
+    // The halt instruction belongs to the line of the period
+    mCode.push_back({SIO3, 0, 0, 3});
+    mCodeLines.push_back(mLexemes[mBodyEnd + 1].line);
+    return true;
+}
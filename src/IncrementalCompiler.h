@@ -0,0 +1,163 @@
+#ifndef INCREMENTALCOMPILER_H
+#define INCREMENTALCOMPILER_H
+
+#include "Instruction.h"
+#include "Tokens.h"
+
+#include <cstddef>
+#include <string>
+#include <vector>
+
+class ParserAndCodeGenerator;
+
+/**
+ * Keeps the code of a source program up to date while it is edited.
+ *
+ * An edit only re-lexes the lexemes around the changed bytes and splices them
+ * into the lexeme table. Code is cached per top-level statement of the main
+ * begin ... end block, with jump targets relative to the start of the
+ * statement. Only the statements touched by an edit, and those after them whose
+ * starting register changed, are generated again. The program is then put
+ * together by relocating the jumps of every statement to its new position.
+ *
+ * Edits to the declarations, the main begin or end, or anything that does not
+ * compile fall back to compiling the whole program. The code is always the
+ * same as parseAndGenerage() produces for the edited source.
+ */
+class IncrementalCompiler
+{
+public:
+    /** What the last compile or edit did. */
+    struct Stats
+    {
+        /** The whole program was compiled. */
+        bool fullCompile = false;
+        /** Source bytes lexed. */
+        std::size_t bytesLexed = 0;
+        std::size_t statementsGenerated = 0;
+        std::size_t statementsReused = 0;
+    };
+
+    /** Compile source from scratch. */
+    explicit IncrementalCompiler(std::string source);
+
+    /**
+     * Replace length bytes at offset of the source with text and bring the
+     * code up to date.
+     * @return If the edited program compiles without errors
+     */
+    bool edit(std::size_t offset, std::size_t length, const std::string& text);
+
+    /** Returns if the program compiles without errors. */
+    bool valid() const
+    {
+        return mValid;
+    }
+
+    const std::string& source() const
+    {
+        return mSource;
+    }
+
+    const std::vector<Lexeme>& lexemes() const
+    {
+        return mLexemes;
+    }
+
+    /** The generated code. */
+    const std::vector<Instruction>& code() const
+    {
+        return mCode;
+    }
+
+    /** Source line each instruction was generated for, starting at 1. */
+    const std::vector<int>& codeLines() const
+    {
+        return mCodeLines;
+    }
+
+    const Stats& stats() const
+    {
+        return mStats;
+    }
+
+private:
+    /** Code cached for one top-level statement and the semicolon ending it. */
+    struct Segment
+    {
+        /** Lexeme index of the first lexeme. */
+        int first = 0;
+        /** Number of lexemes, including the semicolon. */
+        int count = 0;
+        /** Register index the statement starts and ends with. */
+        int rxIn = 0;
+        int rxOut = 0;
+        /** Code with jump targets relative to its first instruction. */
+        std::vector<Instruction> code;
+        /** Source lines relative to the line of the first lexeme. */
+        std::vector<int> lines;
+    };
+
+    /** Lex and compile the whole source. */
+    void compileAll();
+
+    /**
+     * Compile the whole program one statement at a time, filling the cache.
+     * @return false if the program is not made of cacheable statements or has errors
+     */
+    bool compileSegments();
+
+    /**
+     * Re-lex the lexemes around an edit of the source.
+     * @param first Set to the index of the first replaced lexeme
+     * @param removed Set to the number of lexemes replaced
+     * @param inserted Set to the number of lexemes inserted in their place
+     * @return false if a lexical error was found
+     */
+    bool relex(std::size_t offset, std::size_t length, std::size_t textLength,
+        int& first, int& removed, int& inserted);
+
+    /**
+     * Split the lexemes from first up to end into top-level statements.
+     * @param last If end is the main end. Otherwise the last statement has to
+     *     end with a semicolon.
+     * @return false if the lexemes are not a sequence of whole statements
+     */
+    bool split(int first, int end, bool last, std::vector<Segment>& segments) const;
+
+    /**
+     * Bring the statement cache up to date after lexemes were replaced.
+     * @return false if the edit needs the whole program compiled
+     */
+    bool update(int first, int removed, int inserted);
+
+    /**
+     * Generate the code of segment starting with register rx.
+     * @param parser Parser that parsed the declarations of the program
+     * @return false if the statement has errors or does not end where expected
+     */
+    bool generate(ParserAndCodeGenerator& parser, Segment& segment, int rx) const;
+
+    /** Put the program together from the declarations and the cached statements. */
+    bool assemble();
+
+    std::string mSource;
+    std::vector<Lexeme> mLexemes;
+    std::vector<Instruction> mCode;
+    std::vector<int> mCodeLines;
+    bool mValid = false;
+    Stats mStats;
+
+    /** Set when the statement cache below matches the source. */
+    bool mCached = false;
+    /** Code generated for the declarations. */
+    std::vector<Instruction> mPrologue;
+    std::vector<int> mPrologueLines;
+    /** Lexeme index of the first statement inside the main begin. */
+    int mBodyFirst = 0;
+    /** Lexeme index of the main end. */
+    int mBodyEnd = 0;
+    std::vector<Segment> mSegments;
+};
+
+#endif // INCREMENTALCOMPILER_H
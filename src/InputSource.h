@@ -0,0 +1,211 @@
+#ifndef INPUTSOURCE_H
+#define INPUTSOURCE_H
+
+#include <cctype>
+#include <charconv> // from_chars()
+#include <cstddef>
+#include <iostream>
+#include <string>
+#include <utility>
+#include <vector>
+
+#include <fcntl.h>    // open()
+#include <sys/mman.h> // mmap()
+#include <sys/stat.h> // fstat()
+#include <unistd.h>   // close()
+
+/**
+ * Source of the values read by the SIO2 instruction.
+ */
+class InputSource
+{
+public:
+    virtual ~InputSource() = default;
+
+    /**
+     * Read the next value.
+     * @param value Set to the value read
+     * @return false if no more values are available
+     */
+    virtual bool read(int& value) = 0;
+
+    /**
+     * Returns if read() would return right away. Sources that would have to
+     * wait for a value return false, and the virtual machine stops with
+     * ExecutionStatus::WaitingForInput instead of blocking the thread.
+     */
+    virtual bool ready()
+    {
+        return true;
+    }
+};
+
+/**
+ * Input source reading from a stream such as std::cin or a pipe.
+ * Prompts the user before every read unless prompting is turned off.
+ */
+class StreamInput : public InputSource
+{
+public:
+    explicit StreamInput(std::istream& stream, bool prompt = true)
+        : mStream(stream)
+        , mPrompt(prompt)
+    {
+    }
+
+    bool read(int& value) override
+    {
+        if (mPrompt)
+        {
+            std::cout << "Input a value followed by enter: ";
+        }
+        return static_cast<bool>(mStream >> value);
+    }
+
+    /** Turn prompting before each read on or off. */
+    void setPrompt(bool prompt)
+    {
+        mPrompt = prompt;
+    }
+
+private:
+    std::istream& mStream;
+    bool mPrompt;
+};
+
+/** Input source handing out values that were loaded up front. */
+class VectorInput : public InputSource
+{
+public:
+    VectorInput() = default;
+
+    explicit VectorInput(std::vector<int> values)
+        : mValues(std::move(values))
+    {
+    }
+
+    bool read(int& value) override
+    {
+        if (mNext >= mValues.size())
+        {
+            return false;
+        }
+        value = mValues[mNext++];
+        return true;
+    }
+
+    /** Start handing out values from the first one again. */
+    void rewind()
+    {
+        mNext = 0;
+    }
+
+    /** Values not handed out yet. */
+    std::vector<int> remaining() const
+    {
+        return std::vector<int>(mValues.begin() + mNext, mValues.end());
+    }
+
+    /** Replace the values and start reading from the first one again. */
+    void reset(std::vector<int> values)
+    {
+        mValues = std::move(values);
+        mNext = 0;
+    }
+
+private:
+    std::vector<int> mValues;
+    /** Index of the next value to hand out. */
+    std::size_t mNext = 0;
+};
+
+/**
+ * Input source reading whitespace separated numbers from a memory mapped file.
+ * Numbers are parsed in place with from_chars() as they are read.
+ */
+class MappedFileInput : public InputSource
+{
+public:
+    explicit MappedFileInput(const std::string& fileName)
+    {
+        int fd = open(fileName.c_str(), O_RDONLY);
+        if (fd < 0)
+        {
+            return;
+        }
+
+        struct stat fileInfo;
+        if (fstat(fd, &fileInfo) == 0)
+        {
+            if (fileInfo.st_size == 0)
+            {
+                // Nothing to map
+                mOpen = true;
+            }
+            else
+            {
+                void* mapped = mmap(nullptr, fileInfo.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+                if (mapped != MAP_FAILED)
+                {
+                    mData = static_cast<const char*>(mapped);
+                    mSize = fileInfo.st_size;
+                    mNext = mData;
+                    madvise(mapped, mSize, MADV_SEQUENTIAL);
+                    mOpen = true;
+                }
+            }
+        }
+        close(fd);
+    }
+
+    ~MappedFileInput() override
+    {
+        if (mData != nullptr)
+        {
+            munmap(const_cast<char*>(mData), mSize);
+        }
+    }
+
+    MappedFileInput(const MappedFileInput&) = delete;
+    MappedFileInput& operator=(const MappedFileInput&) = delete;
+
+    /** Returns if the file could be opened and mapped. An empty file is open but holds no values. */
+    bool isOpen() const
+    {
+        return mOpen;
+    }
+
+    bool read(int& value) override
+    {
+        const char* end = mData + mSize;
+
+        // Skip separators between numbers
+        while (mNext != end && (isspace(static_cast<unsigned char>(*mNext)) || *mNext == '+'))
+        {
+            ++mNext;
+        }
+        if (mNext == end)
+        {
+            return false;
+        }
+
+        auto result = std::from_chars(mNext, end, value);
+        if (result.ec != std::errc())
+        {
+            // Not a number. Stop handing out values.
+            mNext = end;
+            return false;
+        }
+        mNext = result.ptr;
+        return true;
+    }
+
+private:
+    const char* mData = nullptr;
+    std::size_t mSize = 0;
+    /** Position of the next character to parse. */
+    const char* mNext = nullptr;
+    bool mOpen = false;
+};
+
+#endif // INPUTSOURCE_H
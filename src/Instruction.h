@@ -29,9 +29,28 @@ enum InstructionType : int
     LSS,
     LEQ,
     GTR,
-    GEQ // = 24
+    GEQ, // = 24
+
+    // Superinstructions. Only emitted by optimizeCode() when it is given a profile.
+    JEQL, // JEQL   R, L, M    R[i] <- R[i] = R[j]; jump to instruction M if R[i] = 0. EQL and JPC in one
+    JNEQ, // JNEQ   R, L, M    Same with R[i] != R[j]
+    JLSS, // JLSS   R, L, M    Same with R[i] < R[j]
+    JLEQ, // JLEQ   R, L, M    Same with R[i] <= R[j]
+    JGTR, // JGTR   R, L, M    Same with R[i] > R[j]
+    JGEQ, // JGEQ   R, L, M    Same with R[i] >= R[j] (= 30)
+    ADDM, // ADDM   R, L, M    R[i] <- stack[bp + M] + R[j]; stack[bp + M] <- R[i]. LOD, ADD and STO of the current frame in one
+
+    // Decoded forms of LOD and STO. The virtual machine decodes verified code into
+    // them when it is loaded. They are never part of the code it is given.
+    LOD0, // LOD0   R, 0, M    R[i] <- stack[bp + M]. LOD from the current frame
+    STO0, // STO0   R, 0, M    stack[bp + M] <- R[i]. STO to the current frame
+    LODL1, // LODL1 R, 1, M    R[i] <- stack[stack[bp + 1] + M]. LOD through the static link of the current frame
+    STOL1 // STOL1  R, 1, M    stack[stack[bp + 1] + M] <- R[i]. STO through the static link of the current frame
 };
 
+/** The last op code the virtual machine may be given. Only decoded forms follow it. */
+const InstructionType LAST_OP_CODE = ADDM;
+
 const std::string InstructionTypeLookupTable[] =
 {
     "invalid", // 0
@@ -58,7 +77,18 @@ const std::string InstructionTypeLookupTable[] =
     "lss", // 21
     "leq", // 22
     "gtr", // 23
-    "geq"  // 24
+    "geq", // 24
+    "jeql", // 25
+    "jneq", // 26
+    "jlss", // 27
+    "jleq", // 28
+    "jgtr", // 29
+    "jgeq", // 30
+    "addm", // 31
+    "lod0", // 32
+    "sto0", // 33
+    "lodl1", // 34
+    "stol1" // 35
 };
 
 /** Struct representing one instruction to execute. */
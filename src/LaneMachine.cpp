@@ -0,0 +1,670 @@
+#include "LaneMachine.h"
+
+#include <algorithm> // fill()
+#include <climits>
+#include <iterator> // begin(), end()
+
+/** value in every lane. */
+static LaneValues broadcast(int value)
+{
+    LaneValues values;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        values.lane[lane] = value;
+    }
+    return values;
+}
+
+/** All bits set in the lanes of lanes, none in the others. */
+static LaneValues laneMask(unsigned lanes)
+{
+    LaneValues mask;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        mask.lane[lane] = (lanes >> lane & 1) != 0 ? -1 : 0;
+    }
+    return mask;
+}
+
+/** target <- value in the lanes of mask. The other lanes keep their value. */
+static void blend(LaneValues& target, const LaneValues& value, const LaneValues& mask)
+{
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        target.lane[lane] = (value.lane[lane] & mask.lane[lane]) | (target.lane[lane] & ~mask.lane[lane]);
+    }
+}
+
+/** R[target] <- operation(R[left], R[right]) in the lanes of mask. */
+template <typename Operation>
+static void combine(LaneValues* registers, int target, int left, int right, const LaneValues& mask,
+    Operation operation)
+{
+    LaneValues result;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        result.lane[lane] = operation(registers[left].lane[lane], registers[right].lane[lane]);
+    }
+    blend(registers[target], result, mask);
+}
+
+/**
+ * Arithmetic is applied to lanes outside of the group too, which hold values
+ * the program never computes with here. It wraps around instead of overflowing.
+ */
+static int wrap(unsigned value)
+{
+    return static_cast<int>(value);
+}
+
+/** Bit per lane holding 0. */
+static unsigned zeroLanes(const LaneValues& values)
+{
+    unsigned lanes = 0;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        lanes |= static_cast<unsigned>(values.lane[lane] == 0) << lane;
+    }
+    return lanes;
+}
+
+static int firstLane(unsigned lanes)
+{
+    int lane = 0;
+    while (lane < LANE_COUNT && (lanes >> lane & 1) == 0)
+    {
+        ++lane;
+    }
+    return lane;
+}
+
+static int countLanes(unsigned lanes)
+{
+    int count = 0;
+    for (; lanes != 0; lanes &= lanes - 1)
+    {
+        ++count;
+    }
+    return count;
+}
+
+/** Follow static links levels frames up from bp. Links are the same in every lane of a group. */
+static int frameBase(const LaneValues* stack, int levels, int bp, int lane)
+{
+    while (levels > 0)
+    {
+        bp = stack[bp + 1].lane[lane];
+        --levels;
+    }
+    return bp;
+}
+
+LaneMachine::LaneMachine(const Instruction* code, int codeLength, const Verification& verification)
+    : mCode(code)
+    , mCodeLength(codeLength)
+    , mVerification(&verification)
+    , mStack(MAX_STACK_HEIGHT)
+    , mWaitingAt(codeLength + 1)
+{
+}
+
+void LaneMachine::run(int laneCount, OutputSink* const outputs[], InputSource* const inputs[], std::uint64_t budget)
+{
+    // Every run starts from clean lanes
+    std::fill(std::begin(mRegisters), std::end(mRegisters), LaneValues());
+    std::fill(mStack.begin(), mStack.end(), LaneValues());
+    mWaiting.clear();
+    std::fill(mWaitingAt.begin(), mWaitingAt.end(), 0);
+    mBudget = budget == 0 ? UINT64_MAX : budget;
+    mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+    mDeadlinePassed = false;
+    mDispatched = 0;
+    mScalarLanes = 0;
+
+    LaneGroup group;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        bool used = lane < laneCount;
+        mOutputs[lane] = used ? outputs[lane] : nullptr;
+        mInputs[lane] = used ? inputs[lane] : nullptr;
+        mStatus[lane] = used ? ExecutionStatus::Running : ExecutionStatus::Halted;
+        mExecuted[lane] = 0;
+        if (used)
+        {
+            group.lanes |= 1u << lane;
+        }
+    }
+
+    while (group.lanes != 0 || !mWaiting.empty())
+    {
+        if (group.lanes == 0)
+        {
+            int behind = 0;
+            for (int index = 1; index < static_cast<int>(mWaiting.size()); ++index)
+            {
+                if (mWaiting[index].pc < mWaiting[behind].pc)
+                {
+                    behind = index;
+                }
+            }
+            group = takeWaiting(behind);
+        }
+
+        if (countLanes(group.lanes) < MIN_LOCKSTEP_LANES)
+        {
+            finishAlone(group);
+            group.lanes = 0;
+            continue;
+        }
+
+        execute(group);
+        if (group.lanes != 0)
+        {
+            reschedule(group);
+        }
+    }
+}
+
+void LaneMachine::execute(LaneGroup& group)
+{
+    // Lanes of the group share pc, bp and sp, which are kept in locals like
+    // VirtualMachine::execute() does. Instructions are counted once for the
+    // group and added to its lanes whenever lanes leave it.
+    int pc = group.pc;
+    int bp = group.bp;
+    int sp = group.sp;
+    int depth = group.depth;
+    unsigned lanes = group.lanes;
+    LaneValues mask = laneMask(lanes);
+    int first = firstLane(lanes);
+    std::uint64_t steps = 0;
+    LaneValues* const registers = mRegisters;
+    LaneValues* const stack = mStack.data();
+
+    bool running = true;
+    while (running)
+    {
+        const Instruction* ir = &(mCode[pc]);
+        int executed = pc;
+        unsigned before = lanes;
+        ++steps;
+        pc += 1;
+
+        // Register of a branch, lanes faulting on a division and what to check once the instruction ran
+        const LaneValues* tested = nullptr;
+        unsigned faulted = 0;
+        bool halted = false;
+        bool jumped = false;
+        bool checkLimits = false;
+
+        switch (ir->mOpCode)
+        {
+            case LIT:
+                blend(registers[ir->mRegister], broadcast(ir->mMOperand), mask);
+                break;
+            case RTN:
+                // The frames and the links in them are the same in every lane of a group
+                sp = bp - 1;
+                bp = stack[sp + 3].lane[first];
+                pc = stack[sp + 4].lane[first];
+                --depth;
+                jumped = true;
+                break;
+            case LOD:
+                blend(registers[ir->mRegister],
+                    stack[frameBase(stack, ir->mLexLevelOrReg, bp, first) + ir->mMOperand], mask);
+                break;
+            case STO:
+                blend(stack[frameBase(stack, ir->mLexLevelOrReg, bp, first) + ir->mMOperand],
+                    registers[ir->mRegister], mask);
+                break;
+            case CAL:
+            {
+                int staticLink = frameBase(stack, ir->mLexLevelOrReg, bp, first);
+                blend(stack[sp + 1], broadcast(0), mask);          // Return value
+                blend(stack[sp + 2], broadcast(staticLink), mask); // Static Link (SL)
+                blend(stack[sp + 3], broadcast(bp), mask);         // Dynamic Link (DL)
+                blend(stack[sp + 4], broadcast(pc), mask);         // Return Address (RA)
+                bp = sp + 1;
+                pc = ir->mMOperand;
+                ++depth;
+                jumped = true;
+                checkLimits = true;
+                break;
+            }
+            case INC:
+                sp = sp + ir->mMOperand;
+                break;
+            case JMP:
+                pc = ir->mMOperand;
+                jumped = true;
+                checkLimits = pc <= executed;
+                break;
+            case JPC:
+                tested = &(registers[ir->mRegister]);
+                break;
+            case SIO1:
+                for (int lane = first; lane < LANE_COUNT; ++lane)
+                {
+                    if ((lanes >> lane & 1) != 0)
+                    {
+                        mOutputs[lane]->write(registers[ir->mRegister].lane[lane]);
+                    }
+                }
+                break;
+            case SIO2:
+                for (int lane = first; lane < LANE_COUNT; ++lane)
+                {
+                    if ((lanes >> lane & 1) != 0)
+                    {
+                        mOutputs[lane]->flush();
+                        int value = 0;
+                        if (!mInputs[lane]->read(value))
+                        {
+                            value = 0;
+                        }
+                        registers[ir->mRegister].lane[lane] = value;
+                    }
+                }
+                break;
+            case SIO3:
+                for (int lane = first; lane < LANE_COUNT; ++lane)
+                {
+                    if ((lanes >> lane & 1) != 0)
+                    {
+                        mOutputs[lane]->flush();
+                    }
+                }
+                halted = true;
+                break;
+            case NEG:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mLexLevelOrReg, mask,
+                    [](int value, int) { return wrap(0u - static_cast<unsigned>(value)); });
+                break;
+            case ADD:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return wrap(static_cast<unsigned>(left) + static_cast<unsigned>(right)); });
+                break;
+            case SUB:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return wrap(static_cast<unsigned>(left) - static_cast<unsigned>(right)); });
+                break;
+            case MUL:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return wrap(static_cast<unsigned>(left) * static_cast<unsigned>(right)); });
+                break;
+            case DIV:
+            case MOD:
+            {
+                // There is no vector division. Lanes that would fault stop on the
+                // instruction, the others divide one by one.
+                const LaneValues& dividend = registers[ir->mLexLevelOrReg];
+                const LaneValues& divisor = registers[ir->mMOperand];
+                LaneValues result = registers[ir->mRegister];
+                for (int lane = first; lane < LANE_COUNT; ++lane)
+                {
+                    if ((lanes >> lane & 1) == 0)
+                    {
+                        continue;
+                    }
+                    if (divisor.lane[lane] == 0 || (dividend.lane[lane] == INT_MIN && divisor.lane[lane] == -1))
+                    {
+                        faulted |= 1u << lane;
+                        continue;
+                    }
+                    result.lane[lane] = ir->mOpCode == DIV ? dividend.lane[lane] / divisor.lane[lane]
+                        : dividend.lane[lane] % divisor.lane[lane];
+                }
+                registers[ir->mRegister] = result;
+                break;
+            }
+            case ODD:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mRegister, mask,
+                    [](int value, int) { return value % 2; });
+                break;
+            case EQL:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left == right); });
+                break;
+            case NEQ:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left != right); });
+                break;
+            case LSS:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left < right); });
+                break;
+            case LEQ:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left <= right); });
+                break;
+            case GTR:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left > right); });
+                break;
+            case GEQ:
+                combine(registers, ir->mRegister, ir->mLexLevelOrReg, ir->mMOperand, mask,
+                    [](int left, int right) { return static_cast<int>(left >= right); });
+                break;
+            case JEQL:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left == right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case JNEQ:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left != right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case JLSS:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left < right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case JLEQ:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left <= right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case JGTR:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left > right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case JGEQ:
+                combine(registers, ir->mRegister, ir->mRegister, ir->mLexLevelOrReg, mask,
+                    [](int left, int right) { return static_cast<int>(left >= right); });
+                tested = &(registers[ir->mRegister]);
+                break;
+            case ADDM:
+            {
+                LaneValues& variable = stack[bp + ir->mMOperand];
+                const LaneValues& addend = registers[ir->mLexLevelOrReg];
+                LaneValues sum;
+                for (int lane = 0; lane < LANE_COUNT; ++lane)
+                {
+                    sum.lane[lane] = wrap(static_cast<unsigned>(variable.lane[lane])
+                        + static_cast<unsigned>(addend.lane[lane]));
+                }
+                blend(registers[ir->mRegister], sum, mask);
+                blend(variable, sum, mask);
+                break;
+            }
+            default:
+                // Verified code has no other op codes
+                break;
+        }
+
+        if (halted || faulted != 0)
+        {
+            account(lanes, steps);
+            steps = 0;
+            for (int lane = first; lane < LANE_COUNT; ++lane)
+            {
+                if ((faulted >> lane & 1) != 0)
+                {
+                    // Like a VirtualMachine, the faulting instruction is not counted
+                    --mExecuted[lane];
+                    mStatus[lane] = ExecutionStatus::Fault;
+                }
+                else if (halted && (lanes >> lane & 1) != 0)
+                {
+                    mStatus[lane] = ExecutionStatus::Halted;
+                }
+            }
+            lanes = halted ? 0 : lanes & ~faulted;
+        }
+
+        if (tested != nullptr)
+        {
+            unsigned taken = zeroLanes(*tested) & lanes;
+            if (taken == lanes)
+            {
+                pc = ir->mMOperand;
+                jumped = true;
+                checkLimits = pc <= executed;
+            }
+            else if (taken != 0)
+            {
+                // The lanes that jump wait at the target for their turn
+                account(lanes, steps);
+                steps = 0;
+                lanes &= ~taken;
+
+                LaneGroup jumping;
+                jumping.lanes = taken;
+                jumping.pc = ir->mMOperand;
+                jumping.bp = bp;
+                jumping.sp = sp;
+                jumping.depth = depth;
+                if (jumping.pc <= executed)
+                {
+                    jumping.lanes = withinBudget(jumping.lanes);
+                    if (deadlinePassed())
+                    {
+                        // Only the lanes that jumped back reached a check
+                        expire(jumping.lanes);
+                        jumping.lanes = 0;
+                    }
+                }
+                if (jumping.lanes != 0)
+                {
+                    addWaiting(jumping);
+                }
+                running = false;
+            }
+        }
+
+        if (checkLimits)
+        {
+            account(lanes, steps);
+            steps = 0;
+            lanes = withinBudget(lanes);
+            if (deadlinePassed())
+            {
+                expire(lanes);
+                lanes = 0;
+            }
+        }
+
+        if (lanes != before)
+        {
+            if (countLanes(lanes) < MIN_LOCKSTEP_LANES)
+            {
+                running = false;
+            }
+            mask = laneMask(lanes);
+            first = firstLane(lanes);
+        }
+
+        // Give groups behind this one their turn, and join groups waiting here
+        if ((jumped && !mWaiting.empty()) || mWaitingAt[pc] != 0)
+        {
+            running = false;
+        }
+    }
+
+    account(lanes, steps);
+    group.lanes = lanes;
+    group.pc = pc;
+    group.bp = bp;
+    group.sp = sp;
+    group.depth = depth;
+}
+
+void LaneMachine::finishAlone(const LaneGroup& group)
+{
+    int lane = firstLane(group.lanes);
+
+    MachineState state;
+    state.pc = group.pc;
+    state.bp = group.bp;
+    state.sp = group.sp;
+    state.instructionsExecuted = mExecuted[lane];
+    for (int index = 0; index < REGISTER_COUNT; ++index)
+    {
+        state.registers[index] = mRegisters[index].lane[lane];
+    }
+    int height = MAX_STACK_HEIGHT;
+    while (height > 0 && mStack[height - 1].lane[lane] == 0)
+    {
+        --height;
+    }
+    state.stack.resize(height);
+    for (int index = 0; index < height; ++index)
+    {
+        state.stack[index] = mStack[index].lane[lane];
+    }
+
+    VirtualMachine vm(mCode, mCodeLength, *mOutputs[lane], *mInputs[lane], *mVerification);
+    vm.loadState(state);
+    // loadState() checks states of code with calls. This one is sound, and
+    // checked runs look at the limits more often than the lane would have.
+    vm.mChecked = false;
+    if (mHasDeadline)
+    {
+        vm.setDeadline(mDeadline);
+    }
+
+    // Leave the lane the rest of its budget. A lane already past it stops at
+    // the next check, as it would have here.
+    std::uint64_t budget = 0;
+    if (mBudget != UINT64_MAX)
+    {
+        budget = mExecuted[lane] < mBudget ? mBudget - mExecuted[lane] : 1;
+    }
+    mStatus[lane] = vm.resume(budget);
+    mExecuted[lane] = vm.instructionsExecuted();
+    ++mScalarLanes;
+}
+
+void LaneMachine::reschedule(LaneGroup& group)
+{
+    int index = 0;
+    while (index < static_cast<int>(mWaiting.size()))
+    {
+        if (samePlace(mWaiting[index], group))
+        {
+            group.lanes |= takeWaiting(index).lanes;
+        }
+        else
+        {
+            ++index;
+        }
+    }
+
+    int behind = -1;
+    for (index = 0; index < static_cast<int>(mWaiting.size()); ++index)
+    {
+        if (mWaiting[index].pc < group.pc && (behind == -1 || mWaiting[index].pc < mWaiting[behind].pc))
+        {
+            behind = index;
+        }
+    }
+    if (behind != -1)
+    {
+        LaneGroup next = takeWaiting(behind);
+        addWaiting(group);
+        group = next;
+    }
+}
+
+void LaneMachine::addWaiting(const LaneGroup& group)
+{
+    for (LaneGroup& waiting : mWaiting)
+    {
+        if (samePlace(waiting, group))
+        {
+            waiting.lanes |= group.lanes;
+            return;
+        }
+    }
+    mWaiting.push_back(group);
+    ++mWaitingAt[group.pc];
+}
+
+LaneMachine::LaneGroup LaneMachine::takeWaiting(int index)
+{
+    LaneGroup group = mWaiting[index];
+    --mWaitingAt[group.pc];
+    mWaiting[index] = mWaiting.back();
+    mWaiting.pop_back();
+    return group;
+}
+
+bool LaneMachine::samePlace(const LaneGroup& first, const LaneGroup& second) const
+{
+    if (first.pc != second.pc || first.bp != second.bp || first.sp != second.sp || first.depth != second.depth)
+    {
+        return false;
+    }
+
+    // Lanes that got here through different calls have different links
+    int firstLaneIndex = firstLane(first.lanes);
+    int secondLaneIndex = firstLane(second.lanes);
+    int frame = first.bp;
+    for (int level = 0; level < first.depth; ++level)
+    {
+        for (int link = 1; link <= 3; ++link)
+        {
+            if (mStack[frame + link].lane[firstLaneIndex] != mStack[frame + link].lane[secondLaneIndex])
+            {
+                return false;
+            }
+        }
+        frame = mStack[frame + 2].lane[firstLaneIndex];
+    }
+    return true;
+}
+
+void LaneMachine::account(unsigned lanes, std::uint64_t steps)
+{
+    mDispatched += steps;
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        if ((lanes >> lane & 1) != 0)
+        {
+            mExecuted[lane] += steps;
+        }
+    }
+}
+
+unsigned LaneMachine::withinBudget(unsigned lanes)
+{
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        if ((lanes >> lane & 1) != 0 && mExecuted[lane] >= mBudget)
+        {
+            mStatus[lane] = ExecutionStatus::BudgetExhausted;
+            lanes &= ~(1u << lane);
+        }
+    }
+    return lanes;
+}
+
+bool LaneMachine::deadlinePassed()
+{
+    // Like VirtualMachine::checkLimits(), only look at the clock now and then
+    if (mDeadlinePassed)
+    {
+        return true;
+    }
+    if (!mHasDeadline || --mDeadlineCountdown != 0)
+    {
+        return false;
+    }
+    mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+    mDeadlinePassed = std::chrono::steady_clock::now() >= mDeadline;
+    return mDeadlinePassed;
+}
+
+void LaneMachine::expire(unsigned lanes)
+{
+    for (int lane = 0; lane < LANE_COUNT; ++lane)
+    {
+        if ((lanes >> lane & 1) != 0)
+        {
+            mStatus[lane] = ExecutionStatus::DeadlineExpired;
+        }
+    }
+}
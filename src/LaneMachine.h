@@ -0,0 +1,182 @@
+#ifndef LANEMACHINE_H
+#define LANEMACHINE_H
+
+#include "InputSource.h"
+#include "Instruction.h"
+#include "OutputSink.h"
+#include "Verifier.h"
+#include "VirtualMachine.h"
+
+#include <chrono>
+#include <cstdint>
+#include <vector>
+
+/** Number of runs a LaneMachine executes at once. Eight ints fill a 256 bit vector register. */
+const int LANE_COUNT = 8;
+
+/** Groups with fewer lanes than this leave the lanes and finish on a VirtualMachine each. */
+const int MIN_LOCKSTEP_LANES = 2;
+
+/** One value for every lane, laid out so that loops over the lanes compile to vector instructions. */
+struct alignas(LANE_COUNT * sizeof(int)) LaneValues
+{
+    int lane[LANE_COUNT];
+};
+
+/**
+ * Runs verified code once for each of up to LANE_COUNT inputs in lockstep.
+ *
+ * Every register and stack cell holds a value per lane. Lanes that execute the
+ * same instruction in the same frames form a group, which decodes the
+ * instruction once and applies it to all of its lanes together. Lanes outside
+ * the group keep their values.
+ *
+ * A branch the lanes of a group disagree on splits it. The lanes that jump
+ * wait at the branch target while the others go on. The group furthest behind
+ * in the code runs first, so groups that split at a condition tend to meet
+ * again where it ends, and run as one once they do. A group left with fewer
+ * than MIN_LOCKSTEP_LANES lanes finishes on a VirtualMachine, which runs a
+ * single lane faster.
+ *
+ * Each lane runs exactly as a VirtualMachine would run the code with its input
+ * and output, and ends in the same state.
+ *
+ * Operations on all lanes are plain loops for the compiler to vectorize. Build
+ * with PMACHINE_ENABLE_AVX2=ON to have them use 256 bit vectors.
+ */
+class LaneMachine
+{
+public:
+    /**
+     * @param code Code to execute. Must stay valid while the machine exists.
+     * @param codeLength Number of instructions in code
+     * @param verification Result of verifyCode() for code, which has to be
+     *     verified. Must stay valid while the machine exists.
+     */
+    LaneMachine(const Instruction* code, int codeLength, const Verification& verification);
+
+    /**
+     * Run the code from the start once for each lane, until every lane halted
+     * or stopped. Lanes read their input without checking if it is ready.
+     *
+     * @param laneCount Number of lanes to run, at most LANE_COUNT
+     * @param outputs Destination for the values written by each lane
+     * @param inputs Source of the values read by each lane
+     * @param budget Number of instructions each lane may execute, checked like
+     *     VirtualMachine::resume() does. Zero runs lanes until they halt or the
+     *     deadline passes.
+     */
+    void run(int laneCount, OutputSink* const outputs[], InputSource* const inputs[], std::uint64_t budget = 0);
+
+    /**
+     * Stop lanes once the deadline has passed, at the same points a
+     * VirtualMachine would. Lanes waiting for their turn still get it, and
+     * stop at their next check unless they halt first.
+     */
+    void setDeadline(std::chrono::steady_clock::time_point deadline)
+    {
+        mDeadline = deadline;
+        mHasDeadline = true;
+    }
+
+    /** Why lane stopped in the last run. */
+    ExecutionStatus status(int lane) const
+    {
+        return mStatus[lane];
+    }
+
+    /** Number of instructions lane executed in the last run. */
+    std::uint64_t instructionsExecuted(int lane) const
+    {
+        return mExecuted[lane];
+    }
+
+    /** Instructions dispatched for groups in the last run, once for all lanes of a group. */
+    std::uint64_t dispatched() const
+    {
+        return mDispatched;
+    }
+
+    /** Lanes the last run finished on a VirtualMachine. */
+    int scalarLanes() const
+    {
+        return mScalarLanes;
+    }
+
+private:
+    /** Lanes executing the same instruction in the same frames. */
+    struct LaneGroup
+    {
+        /** Bit per lane in the group. */
+        unsigned lanes = 0;
+        int pc = 0;
+        int bp = 1;
+        int sp = 0;
+        /** Number of procedure frames above the main program. */
+        int depth = 0;
+    };
+
+    /** Run group until it ends, splits, or another group may have to run first. */
+    void execute(LaneGroup& group);
+
+    /** Run the only lane of group on a VirtualMachine until it stops. */
+    void finishAlone(const LaneGroup& group);
+
+    /** Merge group with groups waiting in the same place and switch to the group furthest behind. */
+    void reschedule(LaneGroup& group);
+
+    /** Let group wait, together with a group already waiting in the same place. */
+    void addWaiting(const LaneGroup& group);
+
+    /** Remove and return waiting group index. */
+    LaneGroup takeWaiting(int index);
+
+    /** Returns if the lanes of both groups are at the same instruction in the same frames. */
+    bool samePlace(const LaneGroup& first, const LaneGroup& second) const;
+
+    /** Add steps instructions to the count of every lane in lanes. */
+    void account(unsigned lanes, std::uint64_t steps);
+
+    /** Stop the lanes that used up their budget. @return The lanes that did not */
+    unsigned withinBudget(unsigned lanes);
+
+    /** Returns if the deadline passed, looking at the clock every DEADLINE_CHECK_INTERVAL calls. */
+    bool deadlinePassed();
+
+    /** Stop lanes because the deadline passed. */
+    void expire(unsigned lanes);
+
+    const Instruction* mCode;
+    int mCodeLength;
+    const Verification* mVerification;
+
+    /** Register file of every lane. */
+    LaneValues mRegisters[REGISTER_COUNT] = {};
+
+    /** Stack of every lane, MAX_STACK_HEIGHT cells. */
+    std::vector<LaneValues> mStack;
+
+    /** Groups that split off and wait for their turn. */
+    std::vector<LaneGroup> mWaiting;
+
+    /** Number of waiting groups at each instruction, one past the code included. */
+    std::vector<int> mWaitingAt;
+
+    OutputSink* mOutputs[LANE_COUNT] = {};
+    InputSource* mInputs[LANE_COUNT] = {};
+    ExecutionStatus mStatus[LANE_COUNT] = {};
+    std::uint64_t mExecuted[LANE_COUNT] = {};
+
+    /** Instructions a lane may execute. UINT64_MAX for no limit. */
+    std::uint64_t mBudget = 0;
+
+    std::chrono::steady_clock::time_point mDeadline;
+    bool mHasDeadline = false;
+    int mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+    bool mDeadlinePassed = false;
+
+    std::uint64_t mDispatched = 0;
+    int mScalarLanes = 0;
+};
+
+#endif // LANEMACHINE_H
@@ -0,0 +1,352 @@
+#include "LexicalAnalyzer.h"
+
+#include <algorithm> // count()
+#include <iomanip> // setw()
+#include <thread>
+#include <utility>
+
+/**
+ * Split source into at most chunkCount chunks that can be lexed on their own.
+ * A chunk never starts inside a lexeme or comment: boundaries are moved forward
+ * out of comments and then to the next whitespace character or comment start.
+ * @return Offsets the chunks start at, followed by the size of the source
+ */
+static std::vector<std::size_t> splitSource(const std::string& source, std::size_t chunkCount)
+{
+    const std::size_t size = source.size();
+    std::vector<std::size_t> bounds{0};
+
+    // The next comment not ending before the boundary. Outside comments every /*
+    // starts one, since no lexeme ends with / and nothing else spans characters.
+    std::size_t commentStart = source.find("/*");
+    std::size_t commentEnd = std::string::npos;
+    auto findCommentEnd = [&]()
+    {
+        std::size_t close = commentStart == std::string::npos ? std::string::npos : source.find("*/", commentStart + 2);
+        commentEnd = close == std::string::npos ? size : close + 2;
+    };
+    findCommentEnd();
+
+    for (std::size_t k = 1; k < chunkCount; ++k)
+    {
+        std::size_t bound = std::max(size / chunkCount * k, bounds.back());
+        while (commentStart != std::string::npos && commentEnd <= bound && commentEnd < size)
+        {
+            commentStart = source.find("/*", commentEnd);
+            findCommentEnd();
+        }
+
+        if (commentStart != std::string::npos && commentStart < bound)
+        {
+            // Inside a comment. An unclosed one runs to the end of the source.
+            bound = commentEnd;
+        }
+        else
+        {
+            bound = std::min(source.find_first_of(" \t\n\v\f\r", bound), commentStart);
+        }
+
+        if (bound >= size)
+        {
+            break;
+        }
+        if (bound > bounds.back())
+        {
+            bounds.push_back(bound);
+        }
+    }
+    bounds.push_back(size);
+    return bounds;
+}
+
+Lexer::Lexer(const std::string& source, std::ostream& errorStream)
+    : mSource(source)
+    , mErrorStream(errorStream)
+    , mEnd(source.size())
+{
+}
+
+void Lexer::seek(std::size_t offset, int line)
+{
+    mOffset = offset;
+    mLineNumber = line;
+    std::size_t newline = offset == 0 ? std::string::npos : mSource.rfind('\n', offset - 1);
+    mLineStart = newline == std::string::npos ? 0 : newline + 1;
+}
+
+void Lexer::error(const std::string& message)
+{
+    mErrorFound = true;
+    mErrorStream << "\n\nError: " << message << "\n"
+        << "Error found on line " << mLineNumber << ", column " << mTokenStart - mLineStart + 1 << ".\n";
+}
+
+bool Lexer::next(Lexeme& lexeme)
+{
+    const std::size_t size = mSource.size();
+
+    // Confirm we haven't reached the end of the file.
+    while (mOffset < mEnd)
+    {
+        // State 1
+        std::size_t start = mOffset;
+        int column = static_cast<int>(start - mLineStart) + 1;
+        mTokenStart = start;
+        char ch = mSource[mOffset++];
+        std::string currentToken(1, ch);
+
+        // Check if the next character is a letter
+        if (isalpha(static_cast<unsigned char>(ch)))
+        {
+            // State 2 and 3
+            while (mOffset < size && isalnum(static_cast<unsigned char>(mSource[mOffset])))
+            {
+                ++mOffset;
+            }
+            currentToken = mSource.substr(start, mOffset - start);
+
+            // Check if identifier token is too long
+            if (currentToken.length() > MAX_IDENTIFIER_LENGTH)
+            {
+                error("Current identifier token " + currentToken + " exceeds "
+                    + std::to_string(MAX_IDENTIFIER_LENGTH) + " characters.");
+            }
+
+            // Check if found token is a reserved word
+            const auto itr = RESERVED_WORDS.find(currentToken);
+            token_type type = itr != RESERVED_WORDS.cend() ? itr->second : identSym;
+            lexeme = {currentToken, type, mLineNumber, start, column};
+            return true;
+        }
+
+        // State 4
+        // Check for the first digit in a number
+        if (isdigit(static_cast<unsigned char>(ch)))
+        {
+            // State 5
+            // Check if the number is followed directly by a letter. This means someone
+            // tried writing an identifier that starts with a number.
+            if (mOffset < size && isalpha(static_cast<unsigned char>(mSource[mOffset])))
+            {
+                error("Current identifier token " + currentToken + " starts with a number which is not allowed.");
+            }
+
+            // State 6
+            // Keep checking for more digits after the first digit.
+            while (mOffset < size && isdigit(static_cast<unsigned char>(mSource[mOffset])))
+            {
+                ++mOffset;
+            }
+            currentToken = mSource.substr(start, mOffset - start);
+
+            // Check if token is too long
+            if (currentToken.length() > MAX_NUMBER_LENGTH)
+            {
+                error("Current number token " + currentToken + " exceeds "
+                    + std::to_string(MAX_NUMBER_LENGTH) + " characters.");
+            }
+
+            lexeme = {currentToken, numberSym, mLineNumber, start, column};
+            return true;
+        }
+
+        if (isspace(static_cast<unsigned char>(ch)))
+        {
+            // A new line means we are moving to the next line in the code.
+            if (ch == '\n')
+            {
+                ++mLineNumber;
+                mLineStart = mOffset;
+            }
+
+            // We don't do anything for whitespace characters
+            continue;
+        }
+
+        // Not a letter, digit or whitespace character. It must be a special symbol.
+        // Symbols made of two characters need one character of look ahead.
+        char ch2 = mOffset < size ? mSource[mOffset] : '\0';
+        if (ch == '<' && (ch2 == '=' || ch2 == '>'))
+        {
+            // <= or <>
+            currentToken += ch2;
+            ++mOffset;
+        }
+        else if (ch == '>' && ch2 == '=')
+        {
+            currentToken = ">=";
+            ++mOffset;
+        }
+        else if (ch == ':' && mOffset < size)
+        {
+            if (ch2 == '=')
+            {
+                currentToken = ":=";
+                ++mOffset;
+            }
+            else
+            {
+                error("Found : not followed by =.");
+            }
+        }
+        else if (ch == '/' && ch2 == '*')
+        {
+            // Comments are skipped up to the end of comment sequence */
+            std::size_t end = mSource.find("*/", mOffset + 1);
+            if (end == std::string::npos)
+            {
+                // We have an error. A comment started but was never ended.
+                error("Comment started but never closed.");
+                mOffset = size;
+            }
+            else
+            {
+                for (std::size_t i = mOffset; i < end; ++i)
+                {
+                    if (mSource[i] == '\n')
+                    {
+                        ++mLineNumber;
+                        mLineStart = i + 1;
+                    }
+                }
+                mOffset = end + 2;
+            }
+            continue;
+        }
+
+        // Check if found token is a special symbol
+        const auto itr = SPECIAL_SYMBOLS.find(currentToken);
+        if (itr != SPECIAL_SYMBOLS.cend())
+        {
+            lexeme = {currentToken, itr->second, mLineNumber, start, column};
+            return true;
+        }
+        error("Unknow symbol type found: " + currentToken + ".");
+    }
+
+    return false;
+}
+
+bool lexSource(const std::string& source, std::ostream& errorStream, std::vector<Lexeme>& lexemeTable,
+    unsigned threadCount)
+{
+    if (threadCount == 0)
+    {
+        threadCount = std::max(1u, std::thread::hardware_concurrency());
+    }
+    std::size_t chunkCount = std::min<std::size_t>(threadCount, source.size() / PARALLEL_LEX_CHUNK_SIZE);
+
+    if (source.size() < PARALLEL_LEX_MIN_SIZE || chunkCount < 2)
+    {
+        Lexer lexer(source, errorStream);
+        Lexeme lexeme;
+        while (lexer.next(lexeme))
+        {
+            lexemeTable.push_back(std::move(lexeme));
+        }
+        return !lexer.errorFound();
+    }
+
+    std::vector<std::size_t> bounds = splitSource(source, chunkCount);
+    chunkCount = bounds.size() - 1;
+
+    // Lines are counted before lexing so that errors print the line they are on
+    std::vector<int> lines(chunkCount);
+    std::vector<std::thread> threads;
+    threads.reserve(chunkCount);
+    for (std::size_t i = 0; i < chunkCount; ++i)
+    {
+        threads.emplace_back([&source, &bounds, &lines, i]()
+        {
+            lines[i] = static_cast<int>(std::count(source.begin() + bounds[i], source.begin() + bounds[i + 1], '\n'));
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+    int line = 1;
+    for (int& chunkLine : lines)
+    {
+        std::swap(line, chunkLine);
+        line += chunkLine;
+    }
+
+    std::vector<std::vector<Lexeme>> chunks(chunkCount);
+    std::vector<std::stringstream> errors(chunkCount);
+    std::vector<char> errorFound(chunkCount);
+    threads.clear();
+    for (std::size_t i = 0; i < chunkCount; ++i)
+    {
+        threads.emplace_back([&, i]()
+        {
+            Lexer lexer(source, errors[i]);
+            lexer.seek(bounds[i], lines[i]);
+            lexer.stopAt(bounds[i + 1]);
+            Lexeme lexeme;
+            while (lexer.next(lexeme))
+            {
+                chunks[i].push_back(std::move(lexeme));
+            }
+            errorFound[i] = lexer.errorFound();
+        });
+    }
+    for (std::thread& thread : threads)
+    {
+        thread.join();
+    }
+
+    std::size_t lexemeCount = lexemeTable.size();
+    for (const std::vector<Lexeme>& chunk : chunks)
+    {
+        lexemeCount += chunk.size();
+    }
+    lexemeTable.reserve(lexemeCount);
+
+    bool lexicallyCorrect = true;
+    for (std::size_t i = 0; i < chunkCount; ++i)
+    {
+        lexemeTable.insert(lexemeTable.end(), std::make_move_iterator(chunks[i].begin()),
+            std::make_move_iterator(chunks[i].end()));
+        errorStream << errors[i].str();
+        lexicallyCorrect = lexicallyCorrect && !errorFound[i];
+    }
+    return lexicallyCorrect;
+}
+
+bool analyzeCode(std::stringstream& inputStream, std::stringstream& outputStream, std::vector<Lexeme>& lexemeTable)
+{
+    std::string source = inputStream.str();
+
+    // Print source program into the output file
+    outputStream << "Source Program: \n" 
+        << source << "\n\n";
+
+    bool lexicallyCorrect = lexSource(source, outputStream, lexemeTable);
+
+    outputStream << "\nLexeme Table:\n"
+        << std::setw(10) << std::left << "lexeme"
+        << std::setw(10) << std::left << "token type"
+        << "\n";
+
+    for (auto itr = lexemeTable.cbegin(); itr != lexemeTable.cend(); ++itr)
+    {
+        outputStream << std::setw(10) << std::left << itr->lexeme
+            << std::setw(10) << std::left << itr->type
+            << "\n";
+    }
+
+    outputStream << "\nLexeme List:\n";
+
+    for (auto itr = lexemeTable.cbegin(); itr != lexemeTable.cend(); ++itr)
+    {
+        outputStream << itr->type << " ";
+
+        if (itr->type == token_type::identSym || itr->type == token_type::numberSym)
+        {
+            outputStream << itr->lexeme << " ";
+        }
+    }
+
+    return lexicallyCorrect;
+}
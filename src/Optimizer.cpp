@@ -0,0 +1,2202 @@
+#include "Optimizer.h"
+
+#include "ControlFlowGraph.h"
+#include "Verifier.h"
+#include "VirtualMachine.h" // REGISTER_COUNT
+
+#include <algorithm> // binary_search(), count(), find_if(), lower_bound(), set_union(), sort()
+#include <climits>
+#include <cstdint>
+#include <iterator> // back_inserter()
+#include <map>
+#include <numeric> // iota()
+#include <tuple>
+#include <utility> // swap()
+
+/** Every register of the register file as a bit mask. */
+const std::uint32_t ALL_REGISTERS = (1u << REGISTER_COUNT) - 1;
+
+/** Estimated number of times a loop body runs per entry into the loop. */
+const int LOOP_WEIGHT = 8;
+
+/** Loop depth past which blocks are not estimated to run more often. */
+const int MAX_WEIGHTED_LOOP_DEPTH = 5;
+
+/** Value number of a register or frame cell whose value is not known. */
+const int UNKNOWN_VALUE = -1;
+
+/** Times values are numbered again once the code their reuse left dead is removed. */
+const int MAX_VALUE_NUMBERING_ROUNDS = 4;
+
+static std::uint32_t registerBit(int index)
+{
+    return 1u << index;
+}
+
+static bool isRegister(int index)
+{
+    return index >= 0 && index < REGISTER_COUNT;
+}
+
+static bool isComparison(InstructionType opCode)
+{
+    return opCode >= EQL && opCode <= GEQ;
+}
+
+/** Registers instruction reads, as a bit mask. */
+static std::uint32_t registerUses(const Instruction& instruction)
+{
+    switch (instruction.mOpCode)
+    {
+        case STO:
+        case JPC:
+        case SIO1:
+        case ODD:
+            return registerBit(instruction.mRegister);
+        case NEG:
+            return registerBit(instruction.mLexLevelOrReg);
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return registerBit(instruction.mLexLevelOrReg) | registerBit(instruction.mMOperand);
+        case CAL:
+            // The called procedure may read any register
+            return ALL_REGISTERS;
+        default:
+            return 0;
+    }
+}
+
+/** Register instruction writes, -1 for none. */
+static int registerDefinition(const Instruction& instruction)
+{
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+        case LOD:
+        case SIO2:
+        case NEG:
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case ODD:
+        case MOD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return instruction.mRegister;
+        default:
+            return -1;
+    }
+}
+
+/** Returns if every register instruction refers to is in the register file. */
+static bool registersValid(const Instruction& instruction)
+{
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+        case LOD:
+        case STO:
+        case JPC:
+        case SIO1:
+        case SIO2:
+        case ODD:
+            return isRegister(instruction.mRegister);
+        case NEG:
+            return isRegister(instruction.mRegister) && isRegister(instruction.mLexLevelOrReg);
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return isRegister(instruction.mRegister) && isRegister(instruction.mLexLevelOrReg)
+                && isRegister(instruction.mMOperand);
+        default:
+            return true;
+    }
+}
+
+/**
+ * Returns if instruction only computes its result, so it can be removed once
+ * the result is dead. Divisions may fault and are kept.
+ */
+static bool isPure(const Instruction& instruction)
+{
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+        case LOD:
+        case NEG:
+        case ADD:
+        case SUB:
+        case MUL:
+        case ODD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return true;
+        default:
+            return false;
+    }
+}
+
+/** Frame cells addressed by loads and stores at lex level 0, numbered densely. */
+class FrameCells
+{
+public:
+    explicit FrameCells(const ControlFlowGraph& graph)
+    {
+        for (const BasicBlock& block : graph.blocks())
+        {
+            for (const Instruction& instruction : block.code)
+            {
+                if ((instruction.mOpCode == LOD || instruction.mOpCode == STO) && instruction.mLexLevelOrReg == 0)
+                {
+                    mOffsets.push_back(instruction.mMOperand);
+                }
+            }
+        }
+        std::sort(mOffsets.begin(), mOffsets.end());
+        mOffsets.erase(std::unique(mOffsets.begin(), mOffsets.end()), mOffsets.end());
+    }
+
+    int count() const
+    {
+        return static_cast<int>(mOffsets.size());
+    }
+
+    /** Number of the cell at offset into the frame. */
+    int cell(int offset) const
+    {
+        return static_cast<int>(std::lower_bound(mOffsets.begin(), mOffsets.end(), offset) - mOffsets.begin());
+    }
+
+    /** Offset into the frame of cell. */
+    int offset(int cell) const
+    {
+        return mOffsets[cell];
+    }
+
+private:
+    std::vector<int> mOffsets;
+};
+
+/** Registers and frame cells whose value may still be used. */
+struct LiveSet
+{
+    std::uint32_t registers = 0;
+    std::vector<char> cells;
+
+    /** Add everything live in other. @return If anything was added */
+    bool merge(const LiveSet& other)
+    {
+        bool changed = (other.registers & ~registers) != 0;
+        registers |= other.registers;
+        for (std::size_t i = 0; i < cells.size(); ++i)
+        {
+            changed = changed || (other.cells[i] && !cells[i]);
+            cells[i] = cells[i] || other.cells[i];
+        }
+        return changed;
+    }
+
+    void addAll()
+    {
+        registers = ALL_REGISTERS;
+        std::fill(cells.begin(), cells.end(), 1);
+    }
+};
+
+/** Turn the set live after instruction into the set live before it. */
+static void transfer(const Instruction& instruction, const FrameCells& frameCells, LiveSet& live)
+{
+    int definition = registerDefinition(instruction);
+    if (definition != -1)
+    {
+        live.registers &= ~registerBit(definition);
+    }
+    if (instruction.mOpCode == STO && instruction.mLexLevelOrReg == 0)
+    {
+        live.cells[frameCells.cell(instruction.mMOperand)] = 0;
+    }
+
+    live.registers |= registerUses(instruction);
+    if (instruction.mOpCode == LOD && instruction.mLexLevelOrReg == 0)
+    {
+        live.cells[frameCells.cell(instruction.mMOperand)] = 1;
+    }
+    else if (instruction.mOpCode == CAL
+        || ((instruction.mOpCode == LOD || instruction.mOpCode == STO) && instruction.mLexLevelOrReg != 0))
+    {
+        // Following static links reads the frame, and the called procedure
+        // or the frame reached may be this one
+        std::fill(live.cells.begin(), live.cells.end(), 1);
+    }
+}
+
+/** What is live at the start of every block, and at its end before the instruction ending it. */
+struct Liveness
+{
+    std::vector<LiveSet> in;
+    std::vector<LiveSet> out;
+};
+
+static Liveness computeLiveness(const ControlFlowGraph& graph, const FrameCells& frameCells)
+{
+    const std::vector<BasicBlock>& blocks = graph.blocks();
+    const int blockCount = static_cast<int>(blocks.size());
+    LiveSet empty;
+    empty.cells.assign(frameCells.count(), 0);
+    Liveness liveness{std::vector<LiveSet>(blockCount, empty), std::vector<LiveSet>(blockCount, empty)};
+
+    bool changed = true;
+    while (changed)
+    {
+        changed = false;
+        for (int block = blockCount - 1; block >= 0; --block)
+        {
+            // Nothing is observable once the program halts. A return hands
+            // everything back to the caller.
+            LiveSet live = empty;
+            if (blocks[block].exit == BlockExit::Branch)
+            {
+                live.registers |= registerBit(blocks[block].condition);
+            }
+            else if (blocks[block].exit == BlockExit::Return)
+            {
+                live.addAll();
+            }
+            for (int successor : graph.successors(block))
+            {
+                live.merge(liveness.in[successor]);
+            }
+            liveness.out[block] = live;
+
+            const std::vector<Instruction>& code = blocks[block].code;
+            for (auto instruction = code.rbegin(); instruction != code.rend(); ++instruction)
+            {
+                transfer(*instruction, frameCells, live);
+            }
+            changed = liveness.in[block].merge(live) || changed;
+        }
+    }
+    return liveness;
+}
+
+enum class Simplification
+{
+    None,
+    Removed,    // The instruction leaves its result register as it was
+    Replaced    // The instruction was replaced by a LIT
+};
+
+/**
+ * Simplify arithmetic with one operand of known value: adding 0, multiplying
+ * or dividing by 1 leave the other operand as it is, and multiplying by 0 or
+ * taking a remainder by 1 give 0. The machine has no shifts, so division and
+ * remainder by other powers of two stay as they are.
+ */
+static Simplification simplify(Instruction& instruction, const bool* known, const int* value)
+{
+    const int result = instruction.mRegister;
+    const int left = instruction.mLexLevelOrReg;
+    const int right = instruction.mMOperand;
+    auto is = [known, value](int reg, int constant)
+    {
+        return known[reg] && value[reg] == constant;
+    };
+
+    switch (instruction.mOpCode)
+    {
+        case ADD:
+            if ((result == left && is(right, 0)) || (result == right && is(left, 0)))
+            {
+                return Simplification::Removed;
+            }
+            break;
+        case SUB:
+            if (result == left && is(right, 0))
+            {
+                return Simplification::Removed;
+            }
+            break;
+        case MUL:
+            if (is(left, 0) || is(right, 0))
+            {
+                instruction = {LIT, result, 0, 0};
+                return Simplification::Replaced;
+            }
+            if ((result == left && is(right, 1)) || (result == right && is(left, 1)))
+            {
+                return Simplification::Removed;
+            }
+            break;
+        case DIV:
+            if (result == left && is(right, 1))
+            {
+                return Simplification::Removed;
+            }
+            break;
+        case MOD:
+            if (is(right, 1))
+            {
+                instruction = {LIT, result, 0, 0};
+                return Simplification::Replaced;
+            }
+            break;
+        default:
+            break;
+    }
+    return Simplification::None;
+}
+
+/**
+ * Compute the result of arithmetic or a comparison of known operands. NEG and
+ * ODD only use left.
+ * @return false if the machine would fault or overflow, which is left to it
+ */
+static bool foldOperation(InstructionType opCode, int left, int right, int& result)
+{
+    long long a = left;
+    long long b = right;
+    long long wide = 0;
+    bool valid = true;
+    switch (opCode)
+    {
+        case NEG: wide = -a; break;
+        case ODD: wide = a % 2; break;
+        case ADD: wide = a + b; break;
+        case SUB: wide = a - b; break;
+        case MUL: wide = a * b; break;
+        case DIV: valid = b != 0; wide = valid ? a / b : 0; break;
+        case MOD: valid = b != 0 && !(a == INT_MIN && b == -1); wide = valid ? a % b : 0; break;
+        case EQL: wide = a == b; break;
+        case NEQ: wide = a != b; break;
+        case LSS: wide = a < b; break;
+        case LEQ: wide = a <= b; break;
+        case GTR: wide = a > b; break;
+        case GEQ: wide = a >= b; break;
+        default: valid = false; break;
+    }
+    if (!valid || wide < INT_MIN || wide > INT_MAX)
+    {
+        return false;
+    }
+    result = static_cast<int>(wide);
+    return true;
+}
+
+/**
+ * Replace arithmetic and comparisons of registers with a known value inside
+ * a block by a LIT, and branches on a known value by a jump. Arithmetic that
+ * leaves a register as it was is removed.
+ * @return If anything changed
+ */
+static bool foldConstants(ControlFlowGraph& graph, OptimizationStats& stats)
+{
+    bool changed = false;
+    for (BasicBlock& block : graph.blocks())
+    {
+        bool known[REGISTER_COUNT] = {};
+        int value[REGISTER_COUNT] = {};
+
+        std::size_t kept = 0;
+        for (std::size_t i = 0; i < block.code.size(); ++i)
+        {
+            Instruction& instruction = block.code[i];
+            int result = 0;
+            bool folded = false;
+            int left = instruction.mLexLevelOrReg;
+            int right = instruction.mMOperand;
+            bool operandsKnown = false;
+            switch (instruction.mOpCode)
+            {
+                case NEG:
+                    folded = known[left] && foldOperation(NEG, value[left], 0, result);
+                    break;
+                case ODD:
+                    folded = known[instruction.mRegister] && foldOperation(ODD, value[instruction.mRegister], 0, result);
+                    break;
+                case ADD:
+                case SUB:
+                case MUL:
+                case DIV:
+                case MOD:
+                case EQL:
+                case NEQ:
+                case LSS:
+                case LEQ:
+                case GTR:
+                case GEQ:
+                    operandsKnown = known[left] && known[right];
+                    folded = operandsKnown && foldOperation(instruction.mOpCode, value[left], value[right], result);
+                    break;
+                default:
+                    break;
+            }
+
+            if (folded)
+            {
+                instruction = {LIT, instruction.mRegister, 0, result};
+                ++stats.instructionsFolded;
+                changed = true;
+            }
+            else if (!operandsKnown)
+            {
+                switch (simplify(instruction, known, value))
+                {
+                    case Simplification::None:
+                        break;
+                    case Simplification::Removed:
+                        ++stats.instructionsSimplified;
+                        changed = true;
+                        continue;
+                    case Simplification::Replaced:
+                        ++stats.instructionsSimplified;
+                        changed = true;
+                        break;
+                }
+            }
+
+            if (instruction.mOpCode == LIT)
+            {
+                known[instruction.mRegister] = true;
+                value[instruction.mRegister] = instruction.mMOperand;
+            }
+            else if (instruction.mOpCode == CAL)
+            {
+                std::fill(known, known + REGISTER_COUNT, false);
+            }
+            else if (registerDefinition(instruction) != -1)
+            {
+                known[instruction.mRegister] = false;
+            }
+            block.code[kept] = instruction;
+            block.lines[kept] = block.lines[i];
+            ++kept;
+        }
+        block.code.resize(kept);
+        block.lines.resize(kept);
+
+        if (block.exit == BlockExit::Branch && known[block.condition])
+        {
+            block.exit = BlockExit::Jump;
+            block.next = value[block.condition] == 0 ? block.taken : block.next;
+            block.taken = -1;
+            block.takenCount = 0;
+            ++stats.branchesFolded;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Send jumps and branches to empty blocks straight to where those blocks lead.
+ * @return If anything changed
+ */
+static bool threadJumps(ControlFlowGraph& graph, OptimizationStats& stats)
+{
+    std::vector<BasicBlock>& blocks = graph.blocks();
+    const int blockCount = static_cast<int>(blocks.size());
+
+    // Where control ends up from block, or block itself if the empty blocks loop
+    auto destination = [&blocks, blockCount](int block)
+    {
+        int current = block;
+        for (int steps = 0; blocks[current].code.empty() && blocks[current].exit == BlockExit::Jump; ++steps)
+        {
+            if (steps == blockCount)
+            {
+                return block;
+            }
+            current = blocks[current].next;
+        }
+        return current;
+    };
+
+    bool changed = false;
+    for (BasicBlock& block : blocks)
+    {
+        if (block.exit != BlockExit::Jump && block.exit != BlockExit::Branch)
+        {
+            continue;
+        }
+        int next = destination(block.next);
+        if (next != block.next)
+        {
+            block.next = next;
+            ++stats.jumpsThreaded;
+            changed = true;
+        }
+        if (block.exit == BlockExit::Branch)
+        {
+            int taken = destination(block.taken);
+            if (taken != block.taken)
+            {
+                block.taken = taken;
+                ++stats.jumpsThreaded;
+                changed = true;
+            }
+            if (block.taken == block.next)
+            {
+                // Either way leads to the same place
+                block.exit = BlockExit::Jump;
+                block.taken = -1;
+                block.takenCount = 0;
+                changed = true;
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Append blocks that are only reached by jumping from one block to that block.
+ * The appended blocks are left unreachable.
+ * @return If anything changed
+ */
+static bool mergeBlocks(ControlFlowGraph& graph)
+{
+    std::vector<BasicBlock>& blocks = graph.blocks();
+    std::vector<std::vector<int>> predecessors = graph.predecessors();
+    std::vector<char> isRoot(blocks.size(), 0);
+    for (int root : graph.roots())
+    {
+        isRoot[root] = 1;
+    }
+
+    bool changed = false;
+    for (int block = 0; block < static_cast<int>(blocks.size()); ++block)
+    {
+        BasicBlock& current = blocks[block];
+        while (current.exit == BlockExit::Jump && current.next != block && !isRoot[current.next]
+            && predecessors[current.next].size() == 1)
+        {
+            int merged = current.next;
+            BasicBlock& appended = blocks[merged];
+            current.code.insert(current.code.end(), appended.code.begin(), appended.code.end());
+            current.lines.insert(current.lines.end(), appended.lines.begin(), appended.lines.end());
+            current.exit = appended.exit;
+            current.next = appended.next;
+            current.taken = appended.taken;
+            current.condition = appended.condition;
+            current.exitLine = appended.exitLine;
+            current.takenCount = appended.takenCount;
+
+            for (int successor : graph.successors(block))
+            {
+                std::replace(predecessors[successor].begin(), predecessors[successor].end(), merged, block);
+            }
+            predecessors[merged].clear();
+            appended.code.clear();
+            appended.lines.clear();
+            appended.exit = BlockExit::Halt;
+            changed = true;
+        }
+    }
+    return changed;
+}
+
+/**
+ * Remove instructions whose result is never used.
+ * @return If anything changed
+ */
+static bool removeDeadCode(ControlFlowGraph& graph, OptimizationStats& stats)
+{
+    FrameCells frameCells(graph);
+    Liveness liveness = computeLiveness(graph, frameCells);
+
+    bool changed = false;
+    std::vector<BasicBlock>& blocks = graph.blocks();
+    for (std::size_t block = 0; block < blocks.size(); ++block)
+    {
+        std::vector<Instruction>& code = blocks[block].code;
+        std::vector<int>& lines = blocks[block].lines;
+        LiveSet live = liveness.out[block];
+        for (int i = static_cast<int>(code.size()) - 1; i >= 0; --i)
+        {
+            const Instruction& instruction = code[i];
+            bool dead = false;
+            if (isPure(instruction))
+            {
+                dead = (live.registers & registerBit(instruction.mRegister)) == 0;
+            }
+            else if (instruction.mOpCode == STO && instruction.mLexLevelOrReg == 0)
+            {
+                dead = !live.cells[frameCells.cell(instruction.mMOperand)];
+            }
+
+            if (dead)
+            {
+                code.erase(code.begin() + i);
+                lines.erase(lines.begin() + i);
+                ++stats.deadInstructions;
+                changed = true;
+            }
+            else
+            {
+                transfer(instruction, frameCells, live);
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Registers no instruction of the original code refers to. Values hoisted out
+ * of loops are kept in them, each register holding a single value.
+ */
+class RegisterPool
+{
+public:
+    explicit RegisterPool(const ControlFlowGraph& graph)
+    {
+        std::uint32_t mentioned = 0;
+        for (const BasicBlock& block : graph.blocks())
+        {
+            for (const Instruction& instruction : block.code)
+            {
+                if (instruction.mOpCode != CAL)
+                {
+                    mentioned |= registerUses(instruction);
+                }
+                if (registerDefinition(instruction) != -1)
+                {
+                    mentioned |= registerBit(instruction.mRegister);
+                }
+            }
+            if (block.exit == BlockExit::Branch)
+            {
+                mentioned |= registerBit(block.condition);
+            }
+        }
+        mFree = ALL_REGISTERS & ~mentioned;
+    }
+
+    int available() const
+    {
+        int count = 0;
+        for (std::uint32_t free = mFree; free != 0; free &= free - 1)
+        {
+            ++count;
+        }
+        return count;
+    }
+
+    /** @return A register nothing else uses, -1 if there is none left */
+    int allocate()
+    {
+        for (int reg = 0; reg < REGISTER_COUNT; ++reg)
+        {
+            if ((mFree & registerBit(reg)) != 0)
+            {
+                mFree &= ~registerBit(reg);
+                mAllocated |= registerBit(reg);
+                return reg;
+            }
+        }
+        return -1;
+    }
+
+    /** Returns if reg was handed out by allocate(). */
+    bool allocated(int reg) const
+    {
+        return (mAllocated & registerBit(reg)) != 0;
+    }
+
+private:
+    std::uint32_t mFree = 0;
+    std::uint32_t mAllocated = 0;
+};
+
+/** What the instructions of a loop may change. */
+struct LoopEffects
+{
+    std::vector<char> inLoop;
+
+    /** Registers written in the loop. */
+    std::uint32_t registers = 0;
+
+    /** Offsets of the frame cells stored to at lex level 0. */
+    std::vector<int> cells;
+
+    /** Set if the loop calls procedures or stores through static links. */
+    bool storesAnywhere = false;
+
+    /** Set if the loop moves the stack pointer. */
+    bool movesFrame = false;
+
+    bool stores(int offset) const
+    {
+        return storesAnywhere || std::find(cells.begin(), cells.end(), offset) != cells.end();
+    }
+};
+
+static LoopEffects loopEffects(const ControlFlowGraph& graph, const Loop& loop)
+{
+    LoopEffects effects;
+    effects.inLoop.assign(graph.blocks().size(), 0);
+    for (int block : loop.blocks)
+    {
+        effects.inLoop[block] = 1;
+        for (const Instruction& instruction : graph.blocks()[block].code)
+        {
+            if (registerDefinition(instruction) != -1)
+            {
+                effects.registers |= registerBit(instruction.mRegister);
+            }
+            switch (instruction.mOpCode)
+            {
+                case STO:
+                    if (instruction.mLexLevelOrReg == 0)
+                    {
+                        effects.cells.push_back(instruction.mMOperand);
+                    }
+                    else
+                    {
+                        effects.storesAnywhere = true;
+                    }
+                    break;
+                case CAL:
+                    // The called procedure may change any register and, through
+                    // its static link, this frame
+                    effects.registers = ALL_REGISTERS;
+                    effects.storesAnywhere = true;
+                    break;
+                case INC:
+                    effects.movesFrame = true;
+                    break;
+                default:
+                    break;
+            }
+        }
+    }
+    return effects;
+}
+
+/**
+ * Returns if instruction computes the same value on every iteration of the
+ * loop and can run before it without faulting. Loads are only moved in
+ * verified code, where every load the loop makes is inside the frame.
+ */
+static bool isInvariant(const Instruction& instruction, const LoopEffects& effects, bool verified)
+{
+    auto invariant = [&effects](int reg)
+    {
+        return (effects.registers & registerBit(reg)) == 0;
+    };
+
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+            return true;
+        case LOD:
+            return verified && instruction.mLexLevelOrReg == 0 && !effects.movesFrame
+                && !effects.stores(instruction.mMOperand);
+        case NEG:
+            return invariant(instruction.mLexLevelOrReg);
+        case ADD:
+        case SUB:
+        case MUL:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return invariant(instruction.mLexLevelOrReg) && invariant(instruction.mMOperand);
+        default:
+            return false;
+    }
+}
+
+/** Index of the last instruction before index in code that writes reg, -1 for none. */
+static int lastDefinition(const std::vector<Instruction>& code, int index, int reg)
+{
+    for (int i = index - 1; i >= 0; --i)
+    {
+        if (registerDefinition(code[i]) == reg)
+        {
+            return i;
+        }
+    }
+    return -1;
+}
+
+/**
+ * Find the instructions reading the result of the instruction at index when
+ * they are all in its block.
+ * @param liveOut What is live at the end of the block
+ * @param end Receives the index after the last instruction that may read the result
+ * @return false if the result may be read outside of the block
+ */
+static bool findLocalUses(const BasicBlock& block, int index, const LiveSet& liveOut, int& end)
+{
+    const int reg = block.code[index].mRegister;
+    const int length = static_cast<int>(block.code.size());
+    for (int i = index + 1; i < length; ++i)
+    {
+        if (registerDefinition(block.code[i]) == reg)
+        {
+            // ODD reads its operand from its result register, which cannot be renamed
+            end = i + 1;
+            return block.code[i].mOpCode != ODD || (registerUses(block.code[i]) & registerBit(reg)) == 0;
+        }
+    }
+    end = length;
+    return (liveOut.registers & registerBit(reg)) == 0;
+}
+
+/** Read replacement instead of reg in the instructions in [first, end) of block. */
+static void renameUses(BasicBlock& block, int first, int end, int reg, int replacement)
+{
+    for (int i = first; i < end; ++i)
+    {
+        Instruction& instruction = block.code[i];
+        switch (instruction.mOpCode)
+        {
+            case STO:
+            case JPC:
+            case SIO1:
+                if (instruction.mRegister == reg)
+                {
+                    instruction.mRegister = replacement;
+                }
+                break;
+            case NEG:
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+            case MOD:
+            case EQL:
+            case NEQ:
+            case LSS:
+            case LEQ:
+            case GTR:
+            case GEQ:
+                if (instruction.mLexLevelOrReg == reg)
+                {
+                    instruction.mLexLevelOrReg = replacement;
+                }
+                if (instruction.mOpCode != NEG && instruction.mMOperand == reg)
+                {
+                    instruction.mMOperand = replacement;
+                }
+                break;
+            default:
+                break;
+        }
+    }
+}
+
+/** Instructions run once before a loop is entered. */
+struct Preheader
+{
+    std::vector<Instruction> code;
+    std::vector<int> lines;
+};
+
+/**
+ * Move the loop invariant instructions of loop to preheader. Their results
+ * go to registers from pool, and the instructions reading them in the loop
+ * are changed to read those registers instead.
+ * @return If anything was moved
+ */
+static bool hoistInvariants(ControlFlowGraph& graph, const Loop& loop, const Liveness& liveness, bool verified,
+    RegisterPool& pool, LoopEffects& effects, Preheader& preheader, OptimizationStats& stats)
+{
+    std::vector<int> definitions(REGISTER_COUNT, 0);
+    for (const BasicBlock& block : graph.blocks())
+    {
+        for (const Instruction& instruction : block.code)
+        {
+            if (registerDefinition(instruction) != -1)
+            {
+                ++definitions[instruction.mRegister];
+            }
+        }
+    }
+
+    // Registers already holding the value of a moved instruction, with the
+    // result register left out of the instruction
+    std::vector<std::pair<Instruction, int>> hoisted;
+    auto sameValue = [](const Instruction& a, const Instruction& b)
+    {
+        return a.mOpCode == b.mOpCode && a.mLexLevelOrReg == b.mLexLevelOrReg && a.mMOperand == b.mMOperand;
+    };
+
+    // Values computed in front of inner loops move on first, so the values
+    // of this loop can reuse their registers
+    bool moved = false;
+    for (bool innerValues : {true, false})
+    {
+        bool changed = true;
+        while (changed)
+        {
+            changed = false;
+            for (int index : loop.blocks)
+            {
+                BasicBlock& block = graph.blocks()[index];
+                for (int i = 0; i < static_cast<int>(block.code.size()); ++i)
+                {
+                    Instruction instruction = block.code[i];
+                    if (!isInvariant(instruction, effects, verified))
+                    {
+                        continue;
+                    }
+                    const int reg = instruction.mRegister;
+                    const bool innerValue = pool.allocated(reg) && definitions[reg] == 1;
+                    if (innerValue != innerValues)
+                    {
+                        continue;
+                    }
+
+                    if (innerValue)
+                    {
+                        // The register holds nothing else, so the instruction
+                        // can move on as it is
+                        effects.registers &= ~registerBit(reg);
+                        hoisted.emplace_back(instruction, reg);
+                    }
+                    else
+                    {
+                        int end = 0;
+                        if (!findLocalUses(block, i, liveness.out[index], end))
+                        {
+                            continue;
+                        }
+                        auto found = std::find_if(hoisted.begin(), hoisted.end(),
+                            [&](const std::pair<Instruction, int>& entry) { return sameValue(entry.first, instruction); });
+                        int replacement = found != hoisted.end() ? found->second : pool.allocate();
+                        if (replacement == -1)
+                        {
+                            continue;
+                        }
+                        renameUses(block, i + 1, end, reg, replacement);
+                        if (found != hoisted.end())
+                        {
+                            // Already computed before the loop
+                            block.code.erase(block.code.begin() + i);
+                            block.lines.erase(block.lines.begin() + i);
+                            --i;
+                            ++stats.instructionsHoisted;
+                            changed = true;
+                            moved = true;
+                            continue;
+                        }
+                        hoisted.emplace_back(instruction, replacement);
+                        instruction.mRegister = replacement;
+                    }
+
+                    preheader.code.push_back(instruction);
+                    preheader.lines.push_back(block.lines[i]);
+                    block.code.erase(block.code.begin() + i);
+                    block.lines.erase(block.lines.begin() + i);
+                    --i;
+                    ++stats.instructionsHoisted;
+                    changed = true;
+                    moved = true;
+                }
+            }
+        }
+    }
+    return moved;
+}
+
+/**
+ * Replace multiplications of an induction variable by a loop invariant with a
+ * register that holds the product. The register is set before the loop, and
+ * the step of the variable times the invariant is added to it wherever the
+ * variable is stepped. An induction variable is a frame cell stored once in
+ * the loop, with its own value plus or minus a loop invariant.
+ * @return If anything changed
+ */
+static bool reduceInductionMultiplications(ControlFlowGraph& graph, const Loop& loop, const Liveness& liveness,
+    bool verified, RegisterPool& pool, LoopEffects& effects, Preheader& preheader, OptimizationStats& stats)
+{
+    // Setting the product before the loop loads the variable there
+    if (!verified || effects.storesAnywhere || effects.movesFrame)
+    {
+        return false;
+    }
+
+    struct Induction
+    {
+        int offset;
+        InstructionType step;   // ADD or SUB
+        int stepRegister;       // Loop invariant the variable is stepped by
+    };
+    std::vector<Induction> inductions;
+    for (int offset : effects.cells)
+    {
+        if (std::count(effects.cells.begin(), effects.cells.end(), offset) != 1)
+        {
+            continue;
+        }
+        for (int index : loop.blocks)
+        {
+            const std::vector<Instruction>& code = graph.blocks()[index].code;
+            for (int i = 0; i < static_cast<int>(code.size()); ++i)
+            {
+                if (code[i].mOpCode != STO || code[i].mLexLevelOrReg != 0 || code[i].mMOperand != offset)
+                {
+                    continue;
+                }
+                int update = lastDefinition(code, i, code[i].mRegister);
+                if (update == -1 || (code[update].mOpCode != ADD && code[update].mOpCode != SUB))
+                {
+                    continue;
+                }
+                auto loadsVariable = [&](int reg)
+                {
+                    int load = lastDefinition(code, update, reg);
+                    return load != -1 && code[load].mOpCode == LOD && code[load].mLexLevelOrReg == 0
+                        && code[load].mMOperand == offset;
+                };
+                auto invariant = [&effects](int reg)
+                {
+                    return (effects.registers & registerBit(reg)) == 0;
+                };
+                const int left = code[update].mLexLevelOrReg;
+                const int right = code[update].mMOperand;
+                if (loadsVariable(left) && invariant(right))
+                {
+                    inductions.push_back({offset, code[update].mOpCode, right});
+                }
+                else if (code[update].mOpCode == ADD && loadsVariable(right) && invariant(left))
+                {
+                    inductions.push_back({offset, ADD, left});
+                }
+            }
+        }
+    }
+    if (inductions.empty())
+    {
+        return false;
+    }
+
+    // Product register and the step added to it, for every variable and factor
+    struct Product
+    {
+        int offset;
+        int factor;
+        int product;
+        int step;
+        int line;
+    };
+    std::vector<Product> products;
+
+    for (int index : loop.blocks)
+    {
+        BasicBlock& block = graph.blocks()[index];
+        for (int i = 0; i < static_cast<int>(block.code.size()); ++i)
+        {
+            const Instruction instruction = block.code[i];
+            if (instruction.mOpCode != MUL)
+            {
+                continue;
+            }
+
+            // The variable loaded in this block with no store to it since,
+            // times a loop invariant
+            const Induction* induction = nullptr;
+            int factor = -1;
+            for (int operand : {instruction.mLexLevelOrReg, instruction.mMOperand})
+            {
+                int other = operand == instruction.mLexLevelOrReg ? instruction.mMOperand : instruction.mLexLevelOrReg;
+                int load = lastDefinition(block.code, i, operand);
+                if (load == -1 || block.code[load].mOpCode != LOD || block.code[load].mLexLevelOrReg != 0
+                    || (effects.registers & registerBit(other)) != 0)
+                {
+                    continue;
+                }
+                int offset = block.code[load].mMOperand;
+                auto stored = std::find_if(block.code.begin() + load, block.code.begin() + i,
+                    [offset](const Instruction& between)
+                    {
+                        return between.mOpCode == STO && between.mLexLevelOrReg == 0 && between.mMOperand == offset;
+                    });
+                auto found = std::find_if(inductions.begin(), inductions.end(),
+                    [offset](const Induction& candidate) { return candidate.offset == offset; });
+                if (stored == block.code.begin() + i && found != inductions.end())
+                {
+                    induction = &*found;
+                    factor = other;
+                    break;
+                }
+            }
+            int end = 0;
+            if (induction == nullptr || !findLocalUses(block, i, liveness.out[index], end))
+            {
+                continue;
+            }
+
+            auto product = std::find_if(products.begin(), products.end(), [&](const Product& candidate)
+            {
+                return candidate.offset == induction->offset && candidate.factor == factor;
+            });
+            if (product == products.end())
+            {
+                if (pool.available() < 2)
+                {
+                    continue;
+                }
+                int productRegister = pool.allocate();
+                int stepRegister = pool.allocate();
+                products.push_back({induction->offset, factor, productRegister, stepRegister, block.lines[i]});
+                product = products.end() - 1;
+
+                preheader.code.push_back({LOD, productRegister, 0, induction->offset});
+                preheader.code.push_back({MUL, productRegister, productRegister, factor});
+                preheader.code.push_back({MUL, stepRegister, induction->stepRegister, factor});
+                preheader.lines.insert(preheader.lines.end(), 3, block.lines[i]);
+                effects.registers |= registerBit(productRegister);
+            }
+
+            renameUses(block, i + 1, end, instruction.mRegister, product->product);
+            block.code.erase(block.code.begin() + i);
+            block.lines.erase(block.lines.begin() + i);
+            --i;
+            ++stats.multiplicationsReduced;
+        }
+    }
+    if (products.empty())
+    {
+        return false;
+    }
+
+    // Step the products right after their variable
+    for (int index : loop.blocks)
+    {
+        BasicBlock& block = graph.blocks()[index];
+        for (int i = 0; i < static_cast<int>(block.code.size()); ++i)
+        {
+            const Instruction store = block.code[i];
+            if (store.mOpCode != STO || store.mLexLevelOrReg != 0)
+            {
+                continue;
+            }
+            for (const Product& product : products)
+            {
+                auto induction = std::find_if(inductions.begin(), inductions.end(),
+                    [&product](const Induction& candidate) { return candidate.offset == product.offset; });
+                if (store.mMOperand != product.offset)
+                {
+                    continue;
+                }
+                ++i;
+                block.code.insert(block.code.begin() + i,
+                    Instruction{induction->step, product.product, product.product, product.step});
+                block.lines.insert(block.lines.begin() + i, block.lines[i - 1]);
+            }
+        }
+    }
+    return true;
+}
+
+/**
+ * Move loop invariant code out of every loop and strength reduce its
+ * induction variable multiplications, inner loops first. What is moved goes
+ * to a new block in front of the loop header.
+ * @param verified If the code passed verifyCode()
+ * @return If anything changed
+ */
+static bool optimizeLoops(ControlFlowGraph& graph, bool verified, OptimizationStats& stats)
+{
+    RegisterPool pool(graph);
+    std::vector<Loop> loops = graph.loops();
+    std::stable_sort(loops.begin(), loops.end(), [](const Loop& a, const Loop& b)
+    {
+        return a.blocks.size() < b.blocks.size();
+    });
+    std::vector<int> headers;
+    for (const Loop& loop : loops)
+    {
+        headers.push_back(loop.header);
+    }
+
+    bool changed = false;
+    std::vector<int> roots = graph.roots();
+    for (int header : headers)
+    {
+        // Blocks added in front of inner loops belong to the loops around them
+        std::vector<Loop> current = graph.loops();
+        auto loop = std::find_if(current.begin(), current.end(),
+            [header](const Loop& candidate) { return candidate.header == header; });
+        if (loop == current.end() || std::find(roots.begin(), roots.end(), header) != roots.end())
+        {
+            continue;
+        }
+
+        // Only loops entered through their header get a preheader
+        LoopEffects effects = loopEffects(graph, *loop);
+        std::vector<std::vector<int>> predecessors = graph.predecessors();
+        bool singleEntry = true;
+        for (int block : loop->blocks)
+        {
+            for (int predecessor : predecessors[block])
+            {
+                singleEntry = singleEntry && (block == header || effects.inLoop[predecessor]);
+            }
+        }
+        if (!singleEntry)
+        {
+            continue;
+        }
+
+        FrameCells frameCells(graph);
+        Liveness liveness = computeLiveness(graph, frameCells);
+        Preheader preheader;
+        bool hoisted = hoistInvariants(graph, *loop, liveness, verified, pool, effects, preheader, stats);
+        bool reduced = reduceInductionMultiplications(graph, *loop, liveness, verified, pool, effects, preheader,
+            stats);
+        if (!hoisted && !reduced)
+        {
+            continue;
+        }
+
+        BasicBlock block;
+        block.code = std::move(preheader.code);
+        block.lines = std::move(preheader.lines);
+        block.next = header;
+        block.exitLine = block.lines.empty() ? graph.blocks()[header].exitLine : block.lines.back();
+        const int added = static_cast<int>(graph.blocks().size());
+        for (int predecessor : predecessors[header])
+        {
+            BasicBlock& entry = graph.blocks()[predecessor];
+            if (effects.inLoop[predecessor])
+            {
+                continue;
+            }
+            block.count += graph.edgeCount(predecessor, header);
+            if (entry.next == header)
+            {
+                entry.next = added;
+            }
+            if (entry.exit == BlockExit::Branch && entry.taken == header)
+            {
+                entry.taken = added;
+            }
+        }
+        graph.blocks().push_back(std::move(block));
+        changed = true;
+    }
+    return changed;
+}
+
+/**
+ * Numbers values so that instructions computing the same value get the same
+ * number. A value is a constant, what a frame cell holds, or an operation on
+ * values. Operations on constants are folded, and the operands of commutative
+ * operations and mirrored comparisons are put in one order.
+ */
+class ValueTable
+{
+public:
+    int constant(int value)
+    {
+        return number(LIT, value, 0, {});
+    }
+
+    /** What frame cell holds until it is stored to. */
+    int cell(int frameCell)
+    {
+        return number(LOD, frameCell, 0, {frameCell});
+    }
+
+    /** Result of opCode applied to values. NEG and ODD only use left. */
+    int operation(InstructionType opCode, int left, int right)
+    {
+        const bool unary = opCode == NEG || opCode == ODD;
+        if (left == UNKNOWN_VALUE || (!unary && right == UNKNOWN_VALUE))
+        {
+            return UNKNOWN_VALUE;
+        }
+        int folded = 0;
+        if (isConstant(left) && (unary || isConstant(right))
+            && foldOperation(opCode, constantValue(left), unary ? 0 : constantValue(right), folded))
+        {
+            return constant(folded);
+        }
+        if (unary)
+        {
+            return number(opCode, left, UNKNOWN_VALUE, mValues[left].cells);
+        }
+
+        switch (opCode)
+        {
+            case GTR:
+                opCode = LSS;
+                std::swap(left, right);
+                break;
+            case GEQ:
+                opCode = LEQ;
+                std::swap(left, right);
+                break;
+            case ADD:
+            case MUL:
+            case EQL:
+            case NEQ:
+                if (right < left)
+                {
+                    std::swap(left, right);
+                }
+                break;
+            default:
+                break;
+        }
+        std::vector<int> cells;
+        std::set_union(mValues[left].cells.begin(), mValues[left].cells.end(),
+            mValues[right].cells.begin(), mValues[right].cells.end(), std::back_inserter(cells));
+        return number(opCode, left, right, std::move(cells));
+    }
+
+    bool isConstant(int value) const
+    {
+        return value != UNKNOWN_VALUE && mValues[value].opCode == LIT;
+    }
+
+    int constantValue(int value) const
+    {
+        return mValues[value].left;
+    }
+
+    /** Frame cell value is what the cell holds, -1 if it is no such value. */
+    int cellOf(int value) const
+    {
+        return value != UNKNOWN_VALUE && mValues[value].opCode == LOD ? mValues[value].left : -1;
+    }
+
+    /** Returns if value depends on what cell holds. */
+    bool reads(int value, int cell) const
+    {
+        const std::vector<int>& cells = mValues[value].cells;
+        return std::binary_search(cells.begin(), cells.end(), cell);
+    }
+
+    /** Returns if value depends on what any frame cell holds. */
+    bool readsCells(int value) const
+    {
+        return !mValues[value].cells.empty();
+    }
+
+private:
+    struct Value
+    {
+        InstructionType opCode;
+        int left;
+        int right;
+        /** Frame cells the value depends on, sorted. */
+        std::vector<int> cells;
+    };
+
+    int number(InstructionType opCode, int left, int right, std::vector<int> cells)
+    {
+        auto found = mNumbers.find(std::make_tuple(opCode, left, right));
+        if (found != mNumbers.end())
+        {
+            return found->second;
+        }
+        const int number = static_cast<int>(mValues.size());
+        mNumbers.emplace(std::make_tuple(opCode, left, right), number);
+        mValues.push_back({opCode, left, right, std::move(cells)});
+        return number;
+    }
+
+    std::map<std::tuple<int, int, int>, int> mNumbers;
+    std::vector<Value> mValues;
+};
+
+/** Values the registers and frame cells hold at a point of the code. */
+struct ValueState
+{
+    int registers[REGISTER_COUNT];
+
+    /** Value last stored to each frame cell, UNKNOWN_VALUE if not known. */
+    std::vector<int> cells;
+
+    /** Forget the values that differ in other. @return If anything was forgotten */
+    bool meet(const ValueState& other)
+    {
+        bool changed = false;
+        for (int reg = 0; reg < REGISTER_COUNT; ++reg)
+        {
+            if (registers[reg] != other.registers[reg] && registers[reg] != UNKNOWN_VALUE)
+            {
+                registers[reg] = UNKNOWN_VALUE;
+                changed = true;
+            }
+        }
+        for (std::size_t cell = 0; cell < cells.size(); ++cell)
+        {
+            if (cells[cell] != other.cells[cell] && cells[cell] != UNKNOWN_VALUE)
+            {
+                cells[cell] = UNKNOWN_VALUE;
+                changed = true;
+            }
+        }
+        return changed;
+    }
+};
+
+/**
+ * Follows the values of registers and frame cells through code. Frame cells
+ * are only followed in verified code, where loads and stores at lex level 0
+ * stay inside the frame.
+ */
+class ValueNumbering
+{
+public:
+    ValueNumbering(const FrameCells& frameCells, bool verified)
+        : mFrameCells(frameCells)
+        , mVerified(verified)
+    {
+    }
+
+    ValueTable& table()
+    {
+        return mTable;
+    }
+
+    /** State at the start of a procedure, where nothing is known. */
+    ValueState unknown() const
+    {
+        ValueState state;
+        std::fill(state.registers, state.registers + REGISTER_COUNT, UNKNOWN_VALUE);
+        state.cells.assign(mFrameCells.count(), UNKNOWN_VALUE);
+        return state;
+    }
+
+    /** value with what a frame cell holds replaced by the value last stored to it, when that is known. */
+    int resolve(int value, const ValueState& state) const
+    {
+        int cell = mTable.cellOf(value);
+        return cell != -1 && state.cells[cell] != UNKNOWN_VALUE ? state.cells[cell] : value;
+    }
+
+    /** Value instruction writes to its result register in state, UNKNOWN_VALUE if it is not known. */
+    int result(const Instruction& instruction, const ValueState& state)
+    {
+        auto operand = [this, &state](int reg)
+        {
+            return resolve(state.registers[reg], state);
+        };
+
+        switch (instruction.mOpCode)
+        {
+            case LIT:
+                return mTable.constant(instruction.mMOperand);
+            case LOD:
+                return mVerified && instruction.mLexLevelOrReg == 0
+                    ? mTable.cell(mFrameCells.cell(instruction.mMOperand)) : UNKNOWN_VALUE;
+            case NEG:
+                return mTable.operation(NEG, operand(instruction.mLexLevelOrReg), UNKNOWN_VALUE);
+            case ODD:
+                return mTable.operation(ODD, operand(instruction.mRegister), UNKNOWN_VALUE);
+            case ADD:
+            case SUB:
+            case MUL:
+            case DIV:
+            case MOD:
+            case EQL:
+            case NEQ:
+            case LSS:
+            case LEQ:
+            case GTR:
+            case GEQ:
+                return mTable.operation(instruction.mOpCode, operand(instruction.mLexLevelOrReg),
+                    operand(instruction.mMOperand));
+            default:
+                return UNKNOWN_VALUE;
+        }
+    }
+
+    /** Turn the state before instruction into the state after it. */
+    void step(const Instruction& instruction, ValueState& state)
+    {
+        switch (instruction.mOpCode)
+        {
+            case STO:
+                if (mVerified && instruction.mLexLevelOrReg == 0)
+                {
+                    const int cell = mFrameCells.cell(instruction.mMOperand);
+                    const int reg = instruction.mRegister;
+                    int stored = resolve(state.registers[reg], state);
+                    forget(state, [this, cell](int value) { return mTable.reads(value, cell); });
+                    state.cells[cell] = stored != UNKNOWN_VALUE && !mTable.reads(stored, cell) ? stored : UNKNOWN_VALUE;
+                    if (state.registers[reg] == UNKNOWN_VALUE)
+                    {
+                        state.registers[reg] = mTable.cell(cell);
+                    }
+                }
+                else
+                {
+                    // Following static links may store to this frame
+                    forgetCells(state);
+                }
+                break;
+            case CAL:
+                // The called procedure may change any register and, through
+                // its static link, this frame
+                std::fill(state.registers, state.registers + REGISTER_COUNT, UNKNOWN_VALUE);
+                forgetCells(state);
+                break;
+            default:
+            {
+                int definition = registerDefinition(instruction);
+                if (definition != -1)
+                {
+                    state.registers[definition] = result(instruction, state);
+                }
+                break;
+            }
+        }
+    }
+
+private:
+    /** Forget the values forgotten returns true for. */
+    template <typename Predicate>
+    static void forget(ValueState& state, Predicate forgotten)
+    {
+        for (int& value : state.registers)
+        {
+            if (value != UNKNOWN_VALUE && forgotten(value))
+            {
+                value = UNKNOWN_VALUE;
+            }
+        }
+        for (int& value : state.cells)
+        {
+            if (value != UNKNOWN_VALUE && forgotten(value))
+            {
+                value = UNKNOWN_VALUE;
+            }
+        }
+    }
+
+    void forgetCells(ValueState& state)
+    {
+        forget(state, [this](int value) { return mTable.readsCells(value); });
+        std::fill(state.cells.begin(), state.cells.end(), UNKNOWN_VALUE);
+    }
+
+    ValueTable mTable;
+    const FrameCells& mFrameCells;
+    bool mVerified;
+};
+
+/** Blocks control can continue at after block, given the state at its end. */
+static std::vector<int> feasibleSuccessors(const ControlFlowGraph& graph, int block, const ValueState& state,
+    ValueNumbering& numbering)
+{
+    const BasicBlock& current = graph.blocks()[block];
+    if (current.exit == BlockExit::Branch)
+    {
+        int condition = numbering.resolve(state.registers[current.condition], state);
+        if (numbering.table().isConstant(condition))
+        {
+            return {numbering.table().constantValue(condition) == 0 ? current.taken : current.next};
+        }
+    }
+    return graph.successors(block);
+}
+
+/** Values known at the start of the blocks control can reach. */
+struct ValueFlow
+{
+    std::vector<char> reached;
+    std::vector<ValueState> in;
+};
+
+/**
+ * Find the values known at the start of every block: those that are the same
+ * at the end of every predecessor control can come from. Branches on a known
+ * value only lead on to one successor, so blocks behind them are not reached.
+ */
+static ValueFlow computeValueFlow(const ControlFlowGraph& graph, ValueNumbering& numbering)
+{
+    const std::vector<BasicBlock>& blocks = graph.blocks();
+    ValueFlow flow{std::vector<char>(blocks.size(), 0), std::vector<ValueState>(blocks.size())};
+    std::vector<char> queued(blocks.size(), 0);
+    std::vector<int> pending;
+    for (int root : graph.roots())
+    {
+        flow.reached[root] = 1;
+        flow.in[root] = numbering.unknown();
+        queued[root] = 1;
+        pending.push_back(root);
+    }
+
+    while (!pending.empty())
+    {
+        int block = pending.back();
+        pending.pop_back();
+        queued[block] = 0;
+
+        ValueState state = flow.in[block];
+        for (const Instruction& instruction : blocks[block].code)
+        {
+            numbering.step(instruction, state);
+        }
+        for (int successor : feasibleSuccessors(graph, block, state, numbering))
+        {
+            bool changed = !flow.reached[successor];
+            if (changed)
+            {
+                flow.reached[successor] = 1;
+                flow.in[successor] = state;
+            }
+            else
+            {
+                changed = flow.in[successor].meet(state);
+            }
+            if (changed && !queued[successor])
+            {
+                queued[successor] = 1;
+                pending.push_back(successor);
+            }
+        }
+    }
+    return flow;
+}
+
+/**
+ * Returns if the uses of the result of the instruction at index, up to end,
+ * can read holder instead: holder keeps its value until the last of them,
+ * and no procedure called on the way may read the result.
+ */
+static bool canReadInstead(const BasicBlock& block, int index, int end, int holder)
+{
+    for (int i = index + 1; i < end; ++i)
+    {
+        const Instruction& instruction = block.code[i];
+        if (instruction.mOpCode == CAL || (registerDefinition(instruction) == holder && i < end - 1))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+/**
+ * Remove the instructions of block computing a value their register already
+ * holds, and have the uses of a value another register holds read that
+ * register instead. Values known to be constant become a LIT, and a value a
+ * frame cell holds is loaded from it rather than computed again. A load of a
+ * cell holding a copy of another cell loads the other cell, so the copy may
+ * become dead. A branch on a known value becomes a jump.
+ * @param state Values known at the start of the block
+ * @param changed Set if anything changed
+ * @return If uses were renamed, after which the values known for other blocks no longer hold
+ */
+static bool reuseValues(BasicBlock& block, ValueState state, const LiveSet& liveOut, const FrameCells& frameCells,
+    ValueNumbering& numbering, OptimizationStats& stats, bool& changed)
+{
+    ValueTable& table = numbering.table();
+    bool renamed = false;
+    for (int i = 0; i < static_cast<int>(block.code.size()); ++i)
+    {
+        Instruction& instruction = block.code[i];
+        const int reg = instruction.mRegister;
+        const int value = numbering.resolve(numbering.result(instruction, state), state);
+        if (registerDefinition(instruction) == -1 || value == UNKNOWN_VALUE)
+        {
+            numbering.step(instruction, state);
+            continue;
+        }
+
+        if (numbering.resolve(state.registers[reg], state) == value)
+        {
+            // The register already holds the value
+            block.code.erase(block.code.begin() + i);
+            block.lines.erase(block.lines.begin() + i);
+            --i;
+            ++stats.valuesReused;
+            changed = true;
+            continue;
+        }
+        if (table.isConstant(value))
+        {
+            if (instruction.mOpCode != LIT)
+            {
+                instruction = {LIT, reg, 0, table.constantValue(value)};
+                ++stats.instructionsFolded;
+                changed = true;
+            }
+            numbering.step(instruction, state);
+            continue;
+        }
+
+        int holder = -1;
+        for (int other = 0; other < REGISTER_COUNT && holder == -1; ++other)
+        {
+            if (other != reg && numbering.resolve(state.registers[other], state) == value)
+            {
+                holder = other;
+            }
+        }
+        int end = 0;
+        if (holder != -1 && findLocalUses(block, i, liveOut, end) && canReadInstead(block, i, end, holder))
+        {
+            renameUses(block, i + 1, end, reg, holder);
+            block.code.erase(block.code.begin() + i);
+            block.lines.erase(block.lines.begin() + i);
+            --i;
+            ++stats.valuesReused;
+            changed = true;
+            renamed = true;
+            continue;
+        }
+
+        // A cell holding the value, or the cell a loaded cell is a copy of
+        int source = table.cellOf(value);
+        if (source == -1 && instruction.mOpCode != LOD)
+        {
+            auto found = std::find(state.cells.begin(), state.cells.end(), value);
+            source = found != state.cells.end() ? static_cast<int>(found - state.cells.begin()) : -1;
+        }
+        if (source != -1 && !(instruction.mOpCode == LOD && frameCells.cell(instruction.mMOperand) == source))
+        {
+            instruction = {LOD, reg, 0, frameCells.offset(source)};
+            ++stats.valuesReused;
+            changed = true;
+        }
+        numbering.step(instruction, state);
+    }
+
+    if (block.exit == BlockExit::Branch)
+    {
+        int condition = numbering.resolve(state.registers[block.condition], state);
+        if (table.isConstant(condition))
+        {
+            block.exit = BlockExit::Jump;
+            block.next = table.constantValue(condition) == 0 ? block.taken : block.next;
+            block.taken = -1;
+            block.takenCount = 0;
+            ++stats.branchesFolded;
+            changed = true;
+        }
+    }
+    return renamed;
+}
+
+/**
+ * Number the values computed across the blocks of each procedure, following
+ * registers and frame cells, and reuse values that are already held instead
+ * of computing them again.
+ * @param verified If the code passed verifyCode()
+ * @return If anything changed
+ */
+static bool numberValues(ControlFlowGraph& graph, bool verified, OptimizationStats& stats)
+{
+    bool changed = false;
+    bool renamed = true;
+    while (renamed)
+    {
+        renamed = false;
+        FrameCells frameCells(graph);
+        Liveness liveness = computeLiveness(graph, frameCells);
+        ValueNumbering numbering(frameCells, verified);
+        ValueFlow flow = computeValueFlow(graph, numbering);
+        for (std::size_t block = 0; block < graph.blocks().size() && !renamed; ++block)
+        {
+            if (flow.reached[block])
+            {
+                renamed = reuseValues(graph.blocks()[block], flow.in[block], liveness.out[block], frameCells,
+                    numbering, stats, changed);
+            }
+        }
+    }
+    return changed;
+}
+
+/**
+ * Returns if the branch ending block tests the result of a comparison in the
+ * block that nothing else reads, so the comparison can be inverted.
+ */
+static bool canInvert(const ControlFlowGraph& graph, const Liveness& liveness, int block)
+{
+    const BasicBlock& current = graph.blocks()[block];
+    std::uint32_t condition = registerBit(current.condition);
+    if (((liveness.in[current.next].registers | liveness.in[current.taken].registers) & condition) != 0)
+    {
+        return false;
+    }
+
+    for (auto instruction = current.code.rbegin(); instruction != current.code.rend(); ++instruction)
+    {
+        if (registerDefinition(*instruction) == current.condition)
+        {
+            return isComparison(instruction->mOpCode);
+        }
+        if ((registerUses(*instruction) & condition) != 0)
+        {
+            return false;
+        }
+    }
+    return false;
+}
+
+/** Make block branch to where it continued when the condition was not 0, and the other way around. */
+static void invertBranch(BasicBlock& block)
+{
+    for (auto instruction = block.code.rbegin(); instruction != block.code.rend(); ++instruction)
+    {
+        if (registerDefinition(*instruction) == block.condition)
+        {
+            switch (instruction->mOpCode)
+            {
+                case EQL: instruction->mOpCode = NEQ; break;
+                case NEQ: instruction->mOpCode = EQL; break;
+                case LSS: instruction->mOpCode = GEQ; break;
+                case GEQ: instruction->mOpCode = LSS; break;
+                case LEQ: instruction->mOpCode = GTR; break;
+                default: instruction->mOpCode = LEQ; break;
+            }
+            break;
+        }
+    }
+    std::swap(block.next, block.taken);
+    block.takenCount = block.count - std::min(block.takenCount, block.count);
+}
+
+/**
+ * Order the blocks so that the more frequent successor of each block follows
+ * it. Edges are weighted by how often the profile saw them taken, or else by
+ * the estimated frequency of their block, and followed greedily from the
+ * heaviest, joining chains of blocks. Chains the profile saw run come before
+ * those it did not.
+ */
+static std::vector<int> layoutBlocks(ControlFlowGraph& graph, OptimizationStats& stats)
+{
+    std::vector<BasicBlock>& blocks = graph.blocks();
+    const int blockCount = static_cast<int>(blocks.size());
+    FrameCells frameCells(graph);
+    Liveness liveness = computeLiveness(graph, frameCells);
+    std::vector<int> depths = graph.loopDepths();
+
+    struct Edge
+    {
+        long long weight;
+        int from;
+        int to;
+        /** Set for the edge of a jump, which costs a JMP whenever it does not fall through. */
+        bool jump;
+    };
+    std::vector<Edge> edges;
+    for (int block = 0; block < blockCount; ++block)
+    {
+        const BasicBlock& current = blocks[block];
+        if (current.exit != BlockExit::Jump && current.exit != BlockExit::Branch)
+        {
+            continue;
+        }
+
+        // Weights of going on to next and to taken
+        long long next = 0;
+        long long taken = 0;
+        if (graph.profiled())
+        {
+            next = static_cast<long long>(graph.edgeCount(block, current.next));
+            taken = static_cast<long long>(current.takenCount);
+        }
+        else
+        {
+            long long frequency = 1;
+            for (int depth = 0; depth < std::min(depths[block], MAX_WEIGHTED_LOOP_DEPTH); ++depth)
+            {
+                frequency *= LOOP_WEIGHT;
+            }
+
+            next = frequency * 10;
+            if (current.exit == BlockExit::Branch)
+            {
+                // Staying in a loop is more likely than leaving it
+                next = frequency * 5;
+                if (depths[current.next] != depths[current.taken])
+                {
+                    next = frequency * (depths[current.next] > depths[current.taken] ? 9 : 1);
+                }
+                taken = frequency * 10 - next;
+            }
+        }
+
+        edges.push_back({next, block, current.next, current.exit == BlockExit::Jump});
+        if (current.exit == BlockExit::Branch && canInvert(graph, liveness, block))
+        {
+            edges.push_back({taken, block, current.taken, false});
+        }
+    }
+
+    // Heaviest first. Between equals jumps first, since a branch can be
+    // inverted, and then keep the order the code had.
+    std::stable_sort(edges.begin(), edges.end(), [](const Edge& a, const Edge& b)
+    {
+        if (a.weight != b.weight)
+        {
+            return a.weight > b.weight;
+        }
+        if (a.jump != b.jump)
+        {
+            return a.jump;
+        }
+        return (a.to == a.from + 1) > (b.to == b.from + 1);
+    });
+
+    std::vector<int> following(blockCount, -1);
+    std::vector<int> preceding(blockCount, -1);
+    std::vector<int> chain(blockCount);
+    std::iota(chain.begin(), chain.end(), 0);
+    auto findChain = [&chain](int block)
+    {
+        while (chain[block] != block)
+        {
+            chain[block] = chain[chain[block]];
+            block = chain[block];
+        }
+        return block;
+    };
+
+    for (const Edge& edge : edges)
+    {
+        // The entry block has to stay first
+        if (following[edge.from] != -1 || preceding[edge.to] != -1 || edge.to == 0
+            || findChain(edge.from) == findChain(edge.to))
+        {
+            continue;
+        }
+        following[edge.from] = edge.to;
+        preceding[edge.to] = edge.from;
+        chain[findChain(edge.to)] = findChain(edge.from);
+    }
+
+    // The chain starting with the entry block first, then the others in code
+    // order, with the chains that never ran last
+    std::vector<int> heads;
+    for (int head = 0; head < blockCount; ++head)
+    {
+        if (preceding[head] == -1)
+        {
+            heads.push_back(head);
+        }
+    }
+    if (graph.profiled())
+    {
+        std::stable_partition(heads.begin() + 1, heads.end(), [&](int head)
+        {
+            for (int block = head; block != -1; block = following[block])
+            {
+                if (blocks[block].count != 0)
+                {
+                    return true;
+                }
+            }
+            return false;
+        });
+    }
+    std::vector<int> order;
+    order.reserve(blockCount);
+    for (int head : heads)
+    {
+        for (int block = head; block != -1; block = following[block])
+        {
+            order.push_back(block);
+        }
+    }
+
+    for (int position = 0; position + 1 < blockCount; ++position)
+    {
+        BasicBlock& block = blocks[order[position]];
+        if (block.exit == BlockExit::Branch && block.taken == order[position + 1]
+            && canInvert(graph, liveness, order[position]))
+        {
+            invertBranch(block);
+            ++stats.branchesInverted;
+        }
+    }
+    return order;
+}
+
+/**
+ * Fuse a comparison and the branch on its result into a compare and branch
+ * superinstruction, and a load, addition and store of the same cell of the
+ * current frame into ADDM. The comparison has to compare into its left
+ * operand, and nothing may jump into the middle of the fused instructions.
+ * @param hot Per code index, if the instruction may be fused
+ * @return Number of superinstructions
+ */
+static int fuseInstructions(std::vector<Instruction>& code, std::vector<int>& codeLines, const std::vector<char>& hot)
+{
+    const int codeLength = static_cast<int>(code.size());
+    std::vector<char> isTarget(codeLength, 0);
+    for (const Instruction& instruction : code)
+    {
+        if (instruction.mOpCode == JMP || instruction.mOpCode == JPC || instruction.mOpCode == CAL)
+        {
+            isTarget[instruction.mMOperand] = 1;
+        }
+    }
+    auto fusable = [&](int first, int count)
+    {
+        if (first + count > codeLength)
+        {
+            return false;
+        }
+        for (int i = first; i < first + count; ++i)
+        {
+            if (!hot[i] || (i != first && isTarget[i]))
+            {
+                return false;
+            }
+        }
+        return true;
+    };
+
+    // Index of every instruction in the fused code. Instructions fused into
+    // the one before them are never jumped to.
+    std::vector<int> fusedIndex(codeLength, 0);
+    int kept = 0;
+    int fused = 0;
+    for (int i = 0; i < codeLength; ++kept)
+    {
+        const Instruction& instruction = code[i];
+        fusedIndex[i] = kept;
+        codeLines[kept] = codeLines[i];
+
+        if (fusable(i, 2) && isComparison(instruction.mOpCode) && instruction.mRegister == instruction.mLexLevelOrReg
+            && code[i + 1].mOpCode == JPC && code[i + 1].mRegister == instruction.mRegister)
+        {
+            InstructionType opCode = static_cast<InstructionType>(JEQL + (instruction.mOpCode - EQL));
+            code[kept] = {opCode, instruction.mRegister, instruction.mMOperand, code[i + 1].mMOperand};
+            i += 2;
+            ++fused;
+            continue;
+        }
+
+        if (fusable(i, 3) && instruction.mOpCode == LOD && instruction.mLexLevelOrReg == 0)
+        {
+            const int reg = instruction.mRegister;
+            const Instruction& add = code[i + 1];
+            const Instruction& store = code[i + 2];
+            int addend = add.mLexLevelOrReg == reg ? add.mMOperand : add.mLexLevelOrReg;
+            if (add.mOpCode == ADD && add.mRegister == reg && addend != reg
+                && (add.mLexLevelOrReg == reg || add.mMOperand == reg)
+                && store.mOpCode == STO && store.mRegister == reg && store.mLexLevelOrReg == 0
+                && store.mMOperand == instruction.mMOperand)
+            {
+                code[kept] = {ADDM, reg, addend, instruction.mMOperand};
+                i += 3;
+                ++fused;
+                continue;
+            }
+        }
+
+        code[kept] = instruction;
+        ++i;
+    }
+    code.resize(kept);
+    codeLines.resize(kept);
+
+    for (Instruction& instruction : code)
+    {
+        if (instruction.mOpCode == JMP || instruction.mOpCode == JPC || instruction.mOpCode == CAL
+            || (instruction.mOpCode >= JEQL && instruction.mOpCode <= JGEQ))
+        {
+            instruction.mMOperand = fusedIndex[instruction.mMOperand];
+        }
+    }
+    return fused;
+}
+
+/** Fold, thread, merge and remove until nothing changes. */
+static void simplifyGraph(ControlFlowGraph& graph, OptimizationStats& stats)
+{
+    bool changed = true;
+    while (changed)
+    {
+        changed = foldConstants(graph, stats);
+        changed = threadJumps(graph, stats) || changed;
+        changed = mergeBlocks(graph) || changed;
+        int removed = graph.removeUnreachable();
+        stats.blocksRemoved += removed;
+        changed = removeDeadCode(graph, stats) || removed > 0 || changed;
+    }
+}
+
+OptimizationStats optimizeCode(std::vector<Instruction>& code, std::vector<int>& codeLines,
+    const ExecutionProfile* profile)
+{
+    OptimizationStats stats;
+    stats.instructionsBefore = static_cast<int>(code.size());
+    stats.instructionsAfter = stats.instructionsBefore;
+
+    for (const Instruction& instruction : code)
+    {
+        if (!registersValid(instruction))
+        {
+            return stats;
+        }
+    }
+    if (profile != nullptr && !profile->matches(code.data(), static_cast<int>(code.size())))
+    {
+        profile = nullptr;
+    }
+    ControlFlowGraph graph(code, codeLines, profile);
+    if (!graph.valid())
+    {
+        return stats;
+    }
+    bool verified = verifyCode(code.data(), static_cast<int>(code.size())).verified;
+
+    simplifyGraph(graph, stats);
+    if (optimizeLoops(graph, verified, stats))
+    {
+        simplifyGraph(graph, stats);
+    }
+    for (int round = 0; round < MAX_VALUE_NUMBERING_ROUNDS && numberValues(graph, verified, stats); ++round)
+    {
+        simplifyGraph(graph, stats);
+    }
+
+    std::vector<int> order = layoutBlocks(graph, stats);
+    std::vector<int> blockStarts;
+    graph.emit(order, code, codeLines, &blockStarts);
+    if (profile != nullptr)
+    {
+        // Superinstructions go where the profile saw code run
+        std::vector<char> hot(code.size(), 0);
+        for (std::size_t position = 0; position < order.size(); ++position)
+        {
+            int end = position + 1 < order.size() ? blockStarts[order[position + 1]] : static_cast<int>(code.size());
+            std::fill(hot.begin() + blockStarts[order[position]], hot.begin() + end,
+                graph.blocks()[order[position]].count != 0);
+        }
+        stats.superinstructions = fuseInstructions(code, codeLines, hot);
+    }
+    stats.instructionsAfter = static_cast<int>(code.size());
+    return stats;
+}
@@ -0,0 +1,79 @@
+#ifndef OPTIMIZER_H
+#define OPTIMIZER_H
+
+#include "ExecutionProfile.h"
+#include "Instruction.h"
+
+#include <vector>
+
+/** What optimizeCode() did. */
+struct OptimizationStats
+{
+    int instructionsBefore = 0;
+    int instructionsAfter = 0;
+    /** Arithmetic and comparisons of constants replaced by a LIT. */
+    int instructionsFolded = 0;
+    /** Arithmetic with 0 or 1 removed or replaced by a LIT. */
+    int instructionsSimplified = 0;
+    /** Branches on a constant replaced by a jump. */
+    int branchesFolded = 0;
+    /** Blocks removed because nothing reaches them. */
+    int blocksRemoved = 0;
+    /** Instructions removed because their result is never used. */
+    int deadInstructions = 0;
+    /** Edges redirected past empty blocks. */
+    int jumpsThreaded = 0;
+    /** Branches whose comparison was inverted so the likely successor falls through. */
+    int branchesInverted = 0;
+    /** Loop invariant instructions moved in front of their loop. */
+    int instructionsHoisted = 0;
+    /** Multiplications of induction variables replaced by a running product. */
+    int multiplicationsReduced = 0;
+    /** Instructions computing a value a register or variable already held, removed or replaced by a load. */
+    int valuesReused = 0;
+    /** Superinstructions each replacing a comparison and branch, or a load, addition and store. */
+    int superinstructions = 0;
+};
+
+/**
+ * Optimize generated code over its control flow graph.
+ *
+ * Constants are folded within each block, and branches on a constant become
+ * jumps. Jumps through empty blocks go straight to where they lead, blocks
+ * with a single predecessor are merged into it, and blocks nothing reaches are
+ * removed. Instructions whose result is never used, including stores to
+ * variables that are not loaded again, are removed.
+ *
+ * Loop invariant literals, loads and arithmetic are moved in front of their
+ * loop into registers the code leaves unused, and multiplications of an
+ * induction variable by a loop invariant become a running product stepped
+ * along with the variable. Loads are only moved out of code that passes
+ * verifyCode().
+ *
+ * Values are then numbered across the blocks of each procedure, following
+ * registers and, in verified code, variables. An instruction computing a
+ * value its register already holds is removed, and its uses read another
+ * register holding the value instead where they can. Otherwise a value held
+ * by a variable is loaded from it, and a load of a variable that copies
+ * another loads the original. Values known to be constant on every path become
+ * a LIT, and blocks only reached past branches on such values are removed.
+ *
+ * Finally the blocks are laid out so that the more frequently taken successor
+ * of a block falls through, estimated from loop nesting. Loops are rotated to
+ * test their condition at the bottom when the comparison can be inverted.
+ *
+ * Given a profile of the code, the layout follows the measured counts instead,
+ * blocks that never ran go to the end, and the code that ran uses
+ * superinstructions where it can. Code with superinstructions cannot be
+ * optimized again.
+ *
+ * Code that cannot be split into basic blocks or uses registers outside of the
+ * register file is left as it is.
+ *
+ * @param codeLines Source line of each instruction, kept in step with code
+ * @param profile Counts recorded by running code. Ignored unless recorded for this code.
+ */
+OptimizationStats optimizeCode(std::vector<Instruction>& code, std::vector<int>& codeLines,
+    const ExecutionProfile* profile = nullptr);
+
+#endif // OPTIMIZER_H
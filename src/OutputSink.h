@@ -0,0 +1,192 @@
+#ifndef OUTPUTSINK_H
+#define OUTPUTSINK_H
+
+#include <charconv> // to_chars()
+#include <cstddef>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+/** Size of the user space buffer a buffered sink fills before handing it to its destination. */
+const std::size_t OUTPUT_BUFFER_SIZE = 64 * 1024;
+
+/** Room needed to format one value: sign, 10 digits and a newline. */
+const std::size_t MAX_FORMATTED_VALUE_LENGTH = 12;
+
+/**
+ * Destination for the values written by the SIO1 instruction.
+ * The virtual machine calls flush() when it halts and before it reads input
+ * so that anything written so far is visible to the user.
+ */
+class OutputSink
+{
+public:
+    virtual ~OutputSink() = default;
+
+    /** Write one value followed by a new line. */
+    virtual void write(int value) = 0;
+
+    /** Hand any buffered output to the destination. */
+    virtual void flush() = 0;
+};
+
+/**
+ * Sink that formats values into a large user space buffer and only passes the
+ * buffer to its destination when it fills up or is flushed.
+ */
+class BufferedOutputSink : public OutputSink
+{
+public:
+    BufferedOutputSink()
+    {
+        mBuffer.reserve(OUTPUT_BUFFER_SIZE);
+    }
+
+    void write(int value) override
+    {
+        if (mBuffer.size() + MAX_FORMATTED_VALUE_LENGTH > OUTPUT_BUFFER_SIZE)
+        {
+            flush();
+        }
+
+        char formatted[MAX_FORMATTED_VALUE_LENGTH];
+        char* end = std::to_chars(formatted, formatted + sizeof(formatted), value).ptr;
+        *end++ = '\n';
+        mBuffer.append(formatted, end);
+    }
+
+    void flush() override
+    {
+        if (!mBuffer.empty())
+        {
+            writeBuffer(mBuffer.data(), mBuffer.size());
+            mBuffer.clear();
+        }
+    }
+
+protected:
+    /** Pass size characters starting at data to the destination. */
+    virtual void writeBuffer(const char* data, std::size_t size) = 0;
+
+private:
+    /** Formatted output that has not yet been handed to the destination. */
+    std::string mBuffer;
+};
+
+/** Buffered sink writing to standard output. */
+class StdoutSink : public BufferedOutputSink
+{
+public:
+    ~StdoutSink() override
+    {
+        flush();
+    }
+
+protected:
+    void writeBuffer(const char* data, std::size_t size) override
+    {
+        std::cout.write(data, size);
+        std::cout.flush();
+    }
+};
+
+/** Buffered sink writing to a file. */
+class FileSink : public BufferedOutputSink
+{
+public:
+    explicit FileSink(const std::string& fileName)
+        : mFile(fileName, std::ios::binary)
+    {
+    }
+
+    ~FileSink() override
+    {
+        flush();
+    }
+
+    /** Returns if the file could be opened for writing. */
+    bool isOpen() const
+    {
+        return mFile.is_open();
+    }
+
+protected:
+    void writeBuffer(const char* data, std::size_t size) override
+    {
+        mFile.write(data, size);
+        mFile.flush();
+    }
+
+private:
+    std::ofstream mFile;
+};
+
+/**
+ * Sink capturing the written values in memory. Nothing is formatted and no
+ * system calls are made, which makes it the sink of choice for batch runs.
+ */
+class VectorSink : public OutputSink
+{
+public:
+    void write(int value) override
+    {
+        mValues.push_back(value);
+    }
+
+    void flush() override
+    {
+    }
+
+    /** Values written so far, in order. */
+    const std::vector<int>& values() const
+    {
+        return mValues;
+    }
+
+    /** Discard captured values. */
+    void clear()
+    {
+        mValues.clear();
+    }
+
+private:
+    std::vector<int> mValues;
+};
+
+/** Sink capturing values in memory up to a limit and dropping the rest. A limit of 0 keeps every value. */
+class LimitedVectorSink : public OutputSink
+{
+public:
+    LimitedVectorSink(std::vector<int>& values, std::size_t maxValues)
+        : mValues(values)
+        , mMaxValues(maxValues)
+    {
+    }
+
+    void write(int value) override
+    {
+        if (mMaxValues != 0 && mValues.size() >= mMaxValues)
+        {
+            mTruncated = true;
+            return;
+        }
+        mValues.push_back(value);
+    }
+
+    void flush() override
+    {
+    }
+
+    bool truncated() const
+    {
+        return mTruncated;
+    }
+
+private:
+    std::vector<int>& mValues;
+    std::size_t mMaxValues;
+    bool mTruncated = false;
+};
+
+#endif // OUTPUTSINK_H
@@ -0,0 +1,889 @@
+#include "ParserAndCodeGenerator.h"
+
+#include "VirtualMachine.h" // MAX_CODE_LENGTH
+
+#include <charconv> // from_chars()
+#include <iomanip>
+
+/** Get next token and place it in TOKEN */
+#define GET(TOKEN) TOKEN = mTokens.next();
+
+/** Peek at the next token. */
+#define PEEK(TOKEN) TOKEN = mTokens.peek();
+
+/** Tokens that can start a declaration. */
+const TokenSet DECLARATION_FIRST{constSym, varSym, procSym};
+
+/** Keywords that start a statement. */
+const TokenSet STATEMENT_KEYWORDS{beginSym, callSym, ifSym, whileSym, readSym, writeSym};
+
+/** Tokens that can follow a statement. */
+const TokenSet STATEMENT_FOLLOW{semicolonSym, endSym, elseSym, periodSym};
+
+/** Tokens parsing resumes at after an error in a statement. */
+const TokenSet STATEMENT_SYNC = STATEMENT_FOLLOW | STATEMENT_KEYWORDS;
+
+/** Tokens parsing resumes at after an error at the end of a declaration. */
+const TokenSet DECLARATION_SYNC = TokenSet{semicolonSym, periodSym} | DECLARATION_FIRST | STATEMENT_KEYWORDS;
+
+/** Tokens parsing resumes at after an error in one item of a declaration list. */
+const TokenSet DECLARATION_ITEM_SYNC = DECLARATION_SYNC | TokenSet{commaSym};
+
+/** Value of a number lexeme. Numbers too long to fit were reported by the lexer and are 0. */
+static int numberValue(const Lexeme& lexeme)
+{
+    int value = 0;
+    std::from_chars(lexeme.lexeme.data(), lexeme.lexeme.data() + lexeme.lexeme.size(), value);
+    return value;
+}
+
+/****************************************************************************************
+    EBNF of  tiny PL/0:
+
+    program ::= block "." . 
+    block ::= const-declaration  var-declaration  statement.
+    const-declaration ::= [ “const” ident "=" number {"," ident "=" number} “;"].
+    var-declaration  ::= [ "var" ident {"," ident} “;"].
+    statement   ::= [ ident ":=" expression
+                | "begin" statement { ";" statement } "end" 
+                | "if" condition "then" statement 
+                | "while" condition "do" statement
+                | "read" ident 
+                | "write"  ident 
+                | e ] .  
+    condition ::= "odd" expression 
+            | expression  rel-op  expression.  
+    rel-op ::= "="|“<>"|"<"|"<="|">"|">=“.
+    expression ::= [ "+"|"-"] term { ("+"|"-") term}.
+    term ::= factor {("*"|"/") factor}. 
+    factor ::= ident | number | "(" expression ")“.
+    number ::= digit {digit}.
+    ident ::= letter {letter | digit}.
+    digit ;;= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9“.
+    letter ::= "a" | "b" | … | "y" | "z" | "A" | "B" | ... |"Y" | "Z".
+
+
+    program ::= block "." . 
+    block ::= const-declaration  var-declaration  procedure-declaration statement.	
+    constdeclaration ::= ["const" ident "=" number {"," ident "=" number} ";"].	
+    var-declaration  ::= [ "int "ident {"," ident} “;"].
+    procedure-declaration ::= { "procedure" ident ";" block ";" }
+    statement   ::= [ ident ":=" expression
+                | "call" ident
+                | "begin" statement { ";" statement } "end" 
+                | "if" condition "then" statement ["else" statement]
+                | "while" condition "do" statement
+                | "read" ident
+                | "write" expression
+                | e ] .  
+    condition ::= "odd" expression 
+            | expression  rel-op  expression.  
+    rel-op ::= "="|“!="|"<"|"<="|">"|">=“.
+    expression ::= [ "+"|"-"] term { ("+"|"-") term}.
+    term ::= factor {("*"|"/") factor}. 
+    factor ::= ident | number | "(" expression ")“.
+    number ::= digit {digit}.
+    ident ::= letter {letter | digit}.
+    digit ;;= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9“.
+    letter ::= "a" | "b" | … | "y" | "z" | "A" | "B" | ... | "Y" | "Z".
+
+    
+    Based on Wirth’s definition for EBNF we have the following rule:
+    [ ] means an optional item.
+    { } means repeat 0 or more times.
+    Terminal symbols are enclosed in quote marks.
+    A period is used to indicate the end of the definition of a syntactic class.
+*****************************************************************************************/
+
+ParserAndCodeGenerator::ParserAndCodeGenerator(const std::vector<Lexeme>& lexemes, std::stringstream& outputStream,
+    std::pmr::memory_resource* memory)
+    : mTable(std::make_unique<LexemeTableStream>(lexemes))
+    , mTokens(*mTable)
+    , mOutputStream(outputStream)
+    , mSymbolTable(1, Symbol{0, "", 0, 0, 0, 0}, memory)
+{
+}
+
+ParserAndCodeGenerator::ParserAndCodeGenerator(TokenStream& tokens, std::stringstream& outputStream,
+    std::pmr::memory_resource* memory)
+    : mTokens(tokens)
+    , mOutputStream(outputStream)
+    , mSymbolTable(1, Symbol{0, "", 0, 0, 0, 0}, memory)
+{
+}
+
+bool ParserAndCodeGenerator::parse()
+{
+    program();
+
+    mCurrentSourceLine = mToken->line;
+    codegen(SIO3, 0, 0, 3);
+
+    mOutputStream << "Generated Code:\n";
+    printCode(mOutputStream, mCode);
+
+    if (mSyntaxCorrect)
+    {
+        mOutputStream << "\n\nNo errors, program is syntactically correct.\n";
+    }
+
+    return mSyntaxCorrect;
+}
+
+void ParserAndCodeGenerator::program() {
+    GET(mToken);
+    mCurrentSourceLine = mToken->line;
+    block();
+    if (mToken->type != token_type::periodSym)
+    {
+        error("Period expected.");
+    }
+}
+
+int ParserAndCodeGenerator::parseDeclarations()
+{
+    GET(mToken);
+    mCurrentSourceLine = mToken->line;
+    declarations();
+    return static_cast<int>(mTokens.position()) - 1;
+}
+
+int ParserAndCodeGenerator::parseStatement(int first, int rx)
+{
+    mCode.clear();
+    mCodeLines.clear();
+    mRX = rx;
+    mLastErrorPosition = 0;
+    mTable->seek(first);
+    GET(mToken);
+    statement();
+    return static_cast<int>(mTokens.position()) - 1;
+}
+
+void ParserAndCodeGenerator::block() {
+    declarations();
+    statement();
+}
+
+void ParserAndCodeGenerator::declarations() {
+    if (mToken->type == token_type::constSym)
+    {
+        do
+        {
+            GET(mToken);
+            if (mToken->type != token_type::identSym)
+            {
+                error("const must be followed by an identifier.");
+                synchronize(DECLARATION_ITEM_SYNC);
+                continue;
+            }
+            // Get symbol name before it changes
+            std::string symName = mToken->lexeme; 
+
+            // Constants with errors are still declared, so their uses
+            // are not reported as undeclared.
+            GET(mToken);
+            if (mToken->type == token_type::becomesSym)
+            {
+                // The usual mistake. Carry on as if it was =.
+                error("Use = instead of :=.");
+            }
+            else if (mToken->type != token_type::eqSym)
+            {
+                error("Identifier must be followed by =.");
+                addSymbol({1, symName, 0, -1, -1, 0});
+                synchronize(DECLARATION_ITEM_SYNC);
+                continue;
+            }
+
+            GET(mToken);
+            if (mToken->type != token_type::numberSym)
+            {
+                error("= must be followed by a number.");
+                addSymbol({1, symName, 0, -1, -1, 0});
+                synchronize(DECLARATION_ITEM_SYNC);
+                continue;
+            }
+
+            // Add const symbol to symbol table. Consts have no
+            // lex level or memory address and start out unmarked.
+            addSymbol({1, symName, numberValue(*mToken), -1, -1, 0});
+
+            GET(mToken);
+        } while (mToken->type == token_type::commaSym);
+        declarationEnd();
+    }
+    if (mToken->type == token_type::varSym)
+    {
+        mCurrentSourceLine = mToken->line;
+        do
+        {
+            GET(mToken);
+            if (mToken->type != token_type::identSym)
+            {
+                error("var must be followed by an identifier.");
+                synchronize(DECLARATION_ITEM_SYNC);
+                continue;
+            }
+
+            addSymbol({2, mToken->lexeme, 0, 0, mCSA, 0}); // var
+            ++mCSA;  // Change to next stack address
+
+            GET(mToken);
+        } while (mToken->type == token_type::commaSym);
+        declarationEnd();
+
+        codegen(INC, 0, 0, mCSA);
+    }
+    // Procedures are not supported yet. Their declarations are still parsed
+    // so that errors inside them are found, and their names dropped afterwards.
+    while (mToken->type == token_type::procSym)
+    {
+        error("procedure not yet supported.");
+        std::size_t symbolCount = mSymbolTable.size();
+        int csa = mCSA;
+
+        GET(mToken);
+        if (mToken->type == token_type::identSym)
+        {
+            GET(mToken);
+        }
+        else
+        {
+            error("procedure must be followed by an identifier.");
+        }
+        declarationEnd();
+
+        block();
+        mSymbolTable.erase(mSymbolTable.begin() + symbolCount, mSymbolTable.end());
+        mCSA = csa;
+        declarationEnd();
+    }
+}
+
+void ParserAndCodeGenerator::declarationEnd()
+{
+    if (mToken->type != token_type::semicolonSym)
+    {
+        error("semicolon or comma missing.");
+        synchronize(DECLARATION_SYNC);
+    }
+    if (mToken->type == token_type::semicolonSym)
+    {
+        GET(mToken);
+    }
+}
+
+void ParserAndCodeGenerator::statement()
+{
+    // Attribute generated code to the line the statement starts on. Code generated
+    // after a nested statement returns belongs to this statement again.
+    int enclosingSourceLine = mCurrentSourceLine;
+    mCurrentSourceLine = mToken->line;
+    int errorCount = mErrorCount;
+
+    switch(mToken->type)
+    {
+        case token_type::identSym:
+        {
+            // Find identifier in symbol table
+            int i = findSymbol(mToken->lexeme);
+            if (i == 0)
+            {
+                error("Undeclared identifier.");
+            }
+            if (mSymbolTable[i].kind != 2)
+            {
+                error("Assignment to constant or procedure is not allowed.");
+                i = 0;
+            }
+
+            GET(mToken);
+            if (mToken->type == token_type::becomesSym)
+            {
+                GET(mToken);
+            }
+            else
+            {
+                error("Assignment operator expected.");
+                // = is the usual mistake for :=. Anything else may
+                // already be the expression.
+                if (mToken->type == token_type::eqSym)
+                {
+                    GET(mToken);
+                }
+            }
+
+            int reg1 = mRX;
+
+            expression();
+
+            if (i != 0)
+            {
+                // Generate store call
+                codegen(STO, reg1, 0, mSymbolTable[i].adr);
+                --mRX;
+            }
+
+            break;
+        }
+        case token_type::callSym:
+        {
+            error("call not yet supported.");
+
+            GET(mToken);
+            if (mToken->type == token_type::identSym)
+            {
+                GET(mToken);
+            }
+            else
+            {
+                error("call must be followed by an identifier.");
+            }
+            break;
+        }
+        case token_type::beginSym:
+        {
+            // Get the next mToken after the begin mToken 
+            // and handle statement
+            GET(mToken);
+            statement();
+            
+            // As long as the next symbol is a starting statement mToken,
+            // keep parsing/generating statement code. An identifier
+            // means the semicolon before its statement is missing.
+            while (STATEMENT_TOKENS.count(mToken->type) || mToken->type == token_type::identSym)
+            {
+                if (mToken->type == token_type::identSym)
+                {
+                    error("Semicolon between statements missing.");
+                }
+
+                // If the next symbol is a semicolon, get the next mToken
+                // so we handle the next statement.
+                while (mToken->type == token_type::semicolonSym)
+                {
+                    GET(mToken);
+                }
+
+                statement();
+            }
+
+            if (mToken->type == token_type::endSym)
+            {
+                GET(mToken);
+            }
+            else
+            {
+                error("Incorrect symbol after statement. end, semicolon or } expected.");
+            }
+            break;
+        }
+        case token_type::ifSym:
+        {
+            int reg1 = mRX;
+
+            GET(mToken);
+            condition();
+            if (mToken->type == token_type::thenSym)
+            {
+                GET(mToken);
+            }
+            else
+            {
+                error("then expected.");
+            }
+            
+            int ctemp = codeIndex();
+            codegen(JPC, reg1, 0, 0);
+
+            statement();
+
+            if (mToken->type == token_type::semicolonSym)
+            {
+                auto tokenTemp = mToken;
+                PEEK(mToken);
+
+                if (mToken->type == token_type::elseSym)
+                {
+                    // If the mToken after the semicolon is an else mToken, 
+                    // then get the next mToken so the else code can be 
+                    // processed. 
+                    GET(mToken)
+                }
+                else
+                {
+                    // If it isn't an else mToken, revert the mToken back
+                    // to its previous held value so it can be processed
+                    // as the end of a statment section of code when this
+                    // function returns.
+                    mToken = tokenTemp;
+                }
+                
+            }
+
+            if (mToken->type == token_type::elseSym)
+            {
+                // Token after else mToken
+                GET(mToken);
+
+                // Create jump that will bring the
+                // stack pointer to the code after the
+                // else statment should the if statement
+                // execute.
+                int ctemp2 = codeIndex();
+                codegen(JMP, reg1, 0, 0);
+                
+                // Update jump that will bring the
+                // stack pointer to the code in the else
+                // condition if the if condition fails
+                patchJump(ctemp, codeIndex());
+
+                statement();
+
+                // Update the jump at the end of the if statment.
+                // The stack pointer will need to be moved to the
+                // currently stored stack index which is right after
+                // the else statemnt.
+                patchJump(ctemp2, codeIndex());
+            }
+            else 
+            {
+                patchJump(ctemp, codeIndex());
+            }
+
+            break;
+        }
+        case token_type::whileSym:
+        {
+            int reg1 = mRX;
+            int ctemp1 = codeIndex();
+            GET(mToken);
+            condition();
+            
+            int ctemp2 = codeIndex();
+            codegen(JPC, reg1, 0, 0);
+
+            if (mToken->type == token_type::doSym)
+            {
+                GET(mToken);
+            }
+            else
+            {
+                error("do expected.");
+            }
+            statement();
+
+            codegen(JMP, 0, 0, ctemp1);
+            patchJump(ctemp2, codeIndex());
+            break;
+        }
+        case token_type::readSym:
+        {
+            GET(mToken);
+            if (mToken->type != token_type::identSym)
+            {
+                error("read must be followed by an identifier.");
+                break;
+            }
+
+            // Find identifier in symbol table
+            int i = findSymbol(mToken->lexeme);
+            if (i == 0)
+            {
+                error("Undeclared identifier.");
+            }
+            if (mSymbolTable[i].kind != 2)
+            {
+                error("Cannot write to a constant or procedure.");
+                i = 0;
+            }
+
+            ++mRX;
+            codegen(SIO2, mRX, 0, 0);
+
+            if (i != 0)
+            {
+                // Store value in register mRX into variable at adr from symbol table
+                codegen(STO, mRX, 0, mSymbolTable[i].adr);
+                --mRX;
+            }
+            GET(mToken);
+
+            break;
+        }
+        case token_type::writeSym:
+        {   
+            GET(mToken);
+            
+            if (mToken->type == token_type::identSym)
+            {
+                // Find identifier in symbol table
+                int i = findSymbol(mToken->lexeme);
+                if (i == 0)
+                {
+                    error("Undeclared identifier.");
+                }
+
+                ++mRX;
+                // Copy value of the identifier into register at mRX
+                loadSymbol(i, mRX);
+
+                // Print value stored register at mRX
+                codegen(SIO1, mRX, 0, 0);
+                --mRX;
+
+                GET(mToken);  
+            }
+            else
+            {
+                error("Write must be followed by an identifier.");
+            }
+
+            break;
+        }
+        default:
+        {
+            // Handle an empty statement
+            
+        }
+    }
+
+    // Skip anything that cannot follow the statement, reporting it once. An
+    // identifier after a correct statement is the next statement with the
+    // semicolon before it missing. The end of input is left to the callers.
+    bool nextStatement = mToken->type == token_type::identSym && mErrorCount == errorCount;
+    if (!STATEMENT_SYNC.contains(mToken->type) && !nextStatement && !isEndOfInput(*mToken))
+    {
+        error("Incorrect symbol after statement.");
+        synchronize(STATEMENT_SYNC);
+    }
+
+    mCurrentSourceLine = enclosingSourceLine;
+}
+
+void ParserAndCodeGenerator::condition()
+{
+    if (mToken->type == token_type::oddSym)
+    {
+        // TODO
+        GET(mToken);
+        expression();
+    }
+    else
+    {
+        expression();
+        if (relationOperator.count(mToken->type) == 0)
+        {
+            error("relation operator expected.");
+            return;
+        }
+        token_type relop = mToken->type;
+        
+        int reg1 = mRX - 1;
+        int reg2 = mRX;
+
+        GET(mToken);
+        expression();
+
+        switch(relop)
+        {
+            case neqSym:
+            {
+                codegen(NEQ, reg1, reg1, reg2);
+                break;
+            }
+            case eqSym:
+            {
+                codegen(EQL, reg1, reg1, reg2);
+                break;
+            }
+            case lesSym:
+            {
+                codegen(LSS, reg1, reg1, reg2);
+                break;
+            }
+            case leqSym:
+            {
+                codegen(LEQ, reg1, reg1, reg2);
+                break;
+            }
+            case gtrSym:
+            {
+                codegen(GTR, reg1, reg1, reg2);
+                break;
+            }
+            case geqSym:
+            {
+                codegen(GEQ, reg1, reg1, reg2);
+                break;
+            }
+            default:
+            {
+                mOutputStream << "Error: - relationship operator not handled.\n";
+            }
+        }
+    }
+}
+
+void ParserAndCodeGenerator::expression()
+{
+    // We can ignore the condition of a + before a term since this
+    // doesn't effect the result.
+    if (mToken->type == token_type::minusSym)
+    {
+        int reg1 = mRX - 1;
+        int reg2 = mRX;
+
+        GET(mToken);
+        term();
+
+        codegen(NEG, reg1, reg1, 0);
+        --mRX;
+    }
+    else
+    {
+        term();
+        while (mToken->type == token_type::plusSym || mToken->type == token_type::minusSym)
+        {
+            token_type plusMinusOp = mToken->type;
+
+            int reg1 = mRX;
+            int reg2 = mRX - 1;
+
+            GET(mToken);
+            term();
+
+            switch (plusMinusOp)
+            {
+                case token_type::plusSym:
+                {
+                    codegen(ADD, reg2, reg2, reg1);
+                    --mRX;
+                    break;
+                }
+                case token_type::minusSym:
+                {
+                    codegen(SUB, reg2, reg2, reg1);
+                    --mRX;
+                    break;
+                }
+                default:
+                {
+                    mOutputStream << "Error - term operator not handled.\n";
+                }
+            }
+        }
+    }
+}
+
+void ParserAndCodeGenerator::term()
+{
+    factor(); // this will do a load and modify mRX
+    while (mToken->type == token_type::multSym || mToken->type == token_type::slashSym)
+    {
+        token_type mulDivOp = mToken->type;
+        
+        int reg1 = mRX - 1;
+        int reg2 = mRX;
+
+        GET(mToken);
+        factor(); // this will do a load and modify mRX
+        
+        if (mulDivOp == token_type::multSym)
+        {
+            codegen(MUL, reg1, reg1, reg2);
+            --mRX;
+        }
+        else
+        {
+            codegen(DIV, reg1, reg1, reg2);
+            --mRX;
+            break;
+        }
+    }
+}
+
+void ParserAndCodeGenerator::factor()
+{
+    if (mToken->type == token_type::identSym)
+    {
+        // Find identifier in symbol table
+        int i = findSymbol(mToken->lexeme);
+        if (i == 0)
+        {
+            error("Undeclared identifier.");
+        }
+
+        loadSymbol(i, mRX);
+        ++mRX;
+
+        GET(mToken);
+    }
+    else if (mToken->type == token_type::numberSym)
+    {
+        codegen(LIT, mRX, 0, numberValue(*mToken));
+        ++mRX;
+
+        GET(mToken);
+    }
+    else if (mToken->type == token_type::lparentSym)
+    {
+        GET(mToken);
+        expression();
+        if (mToken->type == token_type::rparentSym)
+        {
+            GET(mToken);
+        }
+        else
+        {
+            error("Right parenthesis missing.");
+        }
+    }
+    else
+    {
+        error("The preceding factor cannot begin with this symbol.");
+    }
+}
+
+void ParserAndCodeGenerator::loadSymbol(int index, int reg)
+{
+    // Constants have no memory address, their value goes into the code
+    if (mSymbolTable[index].kind == 1)
+    {
+        codegen(LIT, reg, 0, mSymbolTable[index].val);
+    }
+    else
+    {
+        codegen(LOD, reg, 0, mSymbolTable[index].adr);
+    }
+}
+
+void ParserAndCodeGenerator::codegen(InstructionType instType, int reg, int lexLevOrReg, int op)
+{
+    if (codeIndex() >= MAX_CODE_LENGTH)
+    {
+        // Once is enough, every instruction after it would repeat the error
+        if (!mCodeTooLong)
+        {
+            error("Generated code length became too large.");
+            mCodeTooLong = true;
+        }
+        mSyntaxCorrect = false;
+    }
+    else
+    {
+        mCode.push_back({instType, reg, lexLevOrReg, op});
+        mCodeLines.push_back(mCurrentSourceLine);
+    }
+}
+
+void ParserAndCodeGenerator::patchJump(int jump, int target)
+{
+    if (jump < codeIndex())
+    {
+        mCode[jump].mMOperand = target;
+    }
+}
+
+void ParserAndCodeGenerator::error(const std::string& message)
+{
+    mSyntaxCorrect = false;
+
+    // Errors after the first at the same lexeme are almost always caused by it
+    std::size_t position = mTokens.position();
+    if (position == mLastErrorPosition)
+    {
+        return;
+    }
+    mLastErrorPosition = position;
+    ++mErrorCount;
+
+    mOutputStream << "Error: - Line " << mToken->line << ", column " << mToken->column << ": " << message << "\n";
+}
+
+void ParserAndCodeGenerator::synchronize(TokenSet follow)
+{
+    while (!follow.contains(mToken->type) && !isEndOfInput(*mToken))
+    {
+        GET(mToken);
+    }
+}
+
+void ParserAndCodeGenerator::addSymbol(const Symbol& symbol)
+{
+    if (mSymbolTable.size() >= MAX_NAME_TABLE_SIZE)
+    {
+        error("Too many symbols declared.");
+        return;
+    }
+    mSymbolTable.push_back(symbol);
+}
+
+int ParserAndCodeGenerator::findSymbol(const std::string& name) const
+{
+    int i;
+    for (i = static_cast<int>(mSymbolTable.size()) - 1; i > 0; --i)
+    {
+        if (mSymbolTable[i].name == name)
+        {
+            // Symbol found
+            break;
+        }
+    }
+    return i;
+}
+
+void printCode(std::ostream& outputStream, const std::vector<Instruction>& code)
+{
+    outputStream << "Line       OP        R    L    M\n";
+    for (std::size_t i = 0; i < code.size(); ++i)
+    {
+        outputStream << std::setw(11) << std::left << i
+            << std::setw(10) << std::left << InstructionTypeLookupTable[code[i].mOpCode]
+            << code[i].mRegister << "    "
+            << code[i].mLexLevelOrReg << "    "
+            << code[i].mMOperand << "\n";
+    }
+}
+
+bool parseAndGenerage(const std::vector<Lexeme>& lexemes, std::stringstream& outputStream,
+    std::vector<Instruction>& code, std::vector<int>& codeLines, std::pmr::memory_resource* memory)
+{
+    ParserAndCodeGenerator parser(lexemes, outputStream, memory);
+    bool syntaxCorrect = parser.parse();
+    code = parser.code();
+    codeLines = parser.codeLines();
+    return syntaxCorrect;
+}
+
+bool parseAndGenerateStreaming(const std::string& source, std::stringstream& outputStream,
+    std::vector<Instruction>& code, std::vector<int>& codeLines, bool lexOnThread)
+{
+    auto parseTokens = [&](TokenStream& tokens)
+    {
+        ParserAndCodeGenerator parser(tokens, outputStream);
+        bool syntaxCorrect = parser.parse();
+        code = parser.code();
+        codeLines = parser.codeLines();
+        return syntaxCorrect;
+    };
+
+    std::stringstream lexicalErrors;
+    bool syntaxCorrect;
+    bool lexicallyCorrect;
+    if (lexOnThread)
+    {
+        ThreadedLexerTokenStream tokens(source, lexicalErrors);
+        syntaxCorrect = parseTokens(tokens);
+        lexicallyCorrect = tokens.finish();
+    }
+    else
+    {
+        LexerTokenStream tokens(source, lexicalErrors);
+        syntaxCorrect = parseTokens(tokens);
+        lexicallyCorrect = tokens.finish();
+    }
+    outputStream << lexicalErrors.str();
+    return syntaxCorrect && lexicallyCorrect;
+}
@@ -2,15 +2,15 @@
 #define PARSERANDCODEGENERATOR_H
 
 #include "Instruction.h"
+#include "TokenStream.h"
 #include "Tokens.h"
-#include "VirtualMachine.h"
 
 #include <climits>
+#include <memory>
+#include <memory_resource>
+#include <sstream>
 #include <string>
 #include <vector>
-#include <utility>
-
-std::stringstream* localOutputStream;
 
 /** Maximum number of names that can be stored in the symbols table */
 const unsigned short MAX_NAME_TABLE_SIZE = USHRT_MAX;
@@ -30,744 +30,192 @@ struct Symbol // namerecord_t
     int adr;            /** M address */
     int mark;		    /** to indicate that code has been generated already for a block. */
 };
-                       
-Symbol symbol_table[MAX_NAME_TABLE_SIZE];
-
-std::vector<std::pair<std::string, token_type>> lexemeTable;
-std::pair<std::string, token_type>* token = nullptr;
-
-/** Code Index */
-int CX = 0;
-
-/** Register Index */
-int RX = 0;
-
-/** Symbol Table Pointer */
-int TP = 1;
-
-/** Current Stack Address */
-int CSA = 4;
-
-/** Tracks if syntax is correct throughout generation of program. */
-bool syntaxCorrect = true;
-
-/** Lexeme Table Index */
-int lexItr = 0;
-
-/** Get next token and place it in TOKEN */
-#define GET(TOKEN) TOKEN = &lexemeTable[lexItr++];
-
-/** Peek at the next token. */
-#define PEEK(TOKEN) TOKEN = &lexemeTable[lexItr];
-
-// Forward declarations
-void program();
-void block();
-void statement();
-void expression();
-void condition();
-void expression();
-void term();
-void factor();
-void codegen(InstructionType instType, int reg, int lexLevOrReg, int op);
-
-/****************************************************************************************
-    EBNF of  tiny PL/0:
-
-    program ::= block "." . 
-    block ::= const-declaration  var-declaration  statement.
-    const-declaration ::= [ “const” ident "=" number {"," ident "=" number} “;"].
-    var-declaration  ::= [ "var" ident {"," ident} “;"].
-    statement   ::= [ ident ":=" expression
-                | "begin" statement { ";" statement } "end" 
-                | "if" condition "then" statement 
-                | "while" condition "do" statement
-                | "read" ident 
-                | "write"  ident 
-                | e ] .  
-    condition ::= "odd" expression 
-            | expression  rel-op  expression.  
-    rel-op ::= "="|“<>"|"<"|"<="|">"|">=“.
-    expression ::= [ "+"|"-"] term { ("+"|"-") term}.
-    term ::= factor {("*"|"/") factor}. 
-    factor ::= ident | number | "(" expression ")“.
-    number ::= digit {digit}.
-    ident ::= letter {letter | digit}.
-    digit ;;= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9“.
-    letter ::= "a" | "b" | … | "y" | "z" | "A" | "B" | ... |"Y" | "Z".
-
-
-    program ::= block "." . 
-    block ::= const-declaration  var-declaration  procedure-declaration statement.	
-    constdeclaration ::= ["const" ident "=" number {"," ident "=" number} ";"].	
-    var-declaration  ::= [ "int "ident {"," ident} “;"].
-    procedure-declaration ::= { "procedure" ident ";" block ";" }
-    statement   ::= [ ident ":=" expression
-                | "call" ident
-                | "begin" statement { ";" statement } "end" 
-                | "if" condition "then" statement ["else" statement]
-                | "while" condition "do" statement
-                | "read" ident
-                | "write" expression
-                | e ] .  
-    condition ::= "odd" expression 
-            | expression  rel-op  expression.  
-    rel-op ::= "="|“!="|"<"|"<="|">"|">=“.
-    expression ::= [ "+"|"-"] term { ("+"|"-") term}.
-    term ::= factor {("*"|"/") factor}. 
-    factor ::= ident | number | "(" expression ")“.
-    number ::= digit {digit}.
-    ident ::= letter {letter | digit}.
-    digit ;;= "0" | "1" | "2" | "3" | "4" | "5" | "6" | "7" | "8" | "9“.
-    letter ::= "a" | "b" | … | "y" | "z" | "A" | "B" | ... | "Y" | "Z".
-
-    
-    Based on Wirth’s definition for EBNF we have the following rule:
-    [ ] means an optional item.
-    { } means repeat 0 or more times.
-    Terminal symbols are enclosed in quote marks.
-    A period is used to indicate the end of the definition of a syntactic class.
-*****************************************************************************************/
-
-inline void program() {
-    GET(token);
-    block();
-    if (token->second != token_type::periodSym)
-    {
-        (*localOutputStream) << "Error: - Period expected.\n";
-        syntaxCorrect = false;
-    }
-}
 
-inline void block() {
-    if (token->second == token_type::constSym)
-    {
-        do
-        {
-            GET(token);
-            if (token->second != token_type::identSym)
-            {
-                (*localOutputStream) << "Error: - const must be followed by an identifier.\n";
-                syntaxCorrect = false;
-            }
-            // Get symbol name before it changes
-            std::string symName = token->first; 
-
-            GET(token);
-            if (token->second != token_type::eqSym)
-            {
-                (*localOutputStream) << "Error: - Identifier must be followed by =.\n";
-                syntaxCorrect = false;
-            }
-
-            GET(token);
-            if (token->second != token_type::numberSym)
-            {
-                (*localOutputStream) << "Error: - = must be followed by a number.\n";
-                syntaxCorrect = false;
-            }
-
-            // Add const symbol to symbol table
-            symbol_table[TP].kind = 1; // const
-            symbol_table[TP].name = symName; // symbol name
-            symbol_table[TP].val = std::stoi(token->first); // symbol value
-            symbol_table[TP].level = -1; // No lex level for const symbols
-            symbol_table[TP].adr = -1; // No memory address for const symbols
-            symbol_table[TP].mark = 0; // Set symbol as unmarked
-
-            // Go to next position in symbol table
-            ++TP;
-
-            GET(token);
-        } while (token->second == token_type::commaSym);
-        if (token->second != token_type::semicolonSym)
-        {
-            (*localOutputStream) << "Error: - semicolon or comma missing.\n";
-            syntaxCorrect = false;
-        }
-        GET(token);
-    }
-    if (token->second == token_type::varSym)
-    {
-        do
-        {
-            GET(token);
-            if (token->second != token_type::identSym)
-            {
-                (*localOutputStream) << "Error: - var must be followed by an identifier.\n";
-                syntaxCorrect = false;
-            }
-
-            symbol_table[TP].kind = 2; // var
-            symbol_table[TP].name = token->first; // symbol name
-            symbol_table[TP].val = 0;
-            symbol_table[TP].level = 0;
-            symbol_table[TP].adr = CSA;
-            symbol_table[TP].mark = 0;
-
-            ++TP;   // Go to next position in symbol table
-            ++CSA;  // Change to next stack address
-
-            GET(token);
-        } while (token->second == token_type::commaSym);
-        if (token->second != token_type::semicolonSym)
-        {
-            (*localOutputStream) << "Error: - semicolon or comma missing.\n";
-            syntaxCorrect = false;
-        }
-        GET(token);
-
-        codegen(INC, 0, 0, CSA);
-    }
-    // Procedure not yet supported
-    if (token->second == token_type::procSym)
-    {
-        (*localOutputStream) << "Error: - procedure not yet supported.\n";
-        syntaxCorrect = false;
-    }
-    // while (token->second == token_type::procSym)
-    // {
-    //     GET(token);
-    //     if (token->second != token_type::identSym)
-    //     {
-    //         // Error
-    //     }
-    //     GET(token);
-    //     if (token->second != semicolonSym)
-    //     {
-    //         // Error
-    //     }
-    //     block();
-    //     if (token->second != token_type::semicolonSym)
-    //     {
-    //         // Error
-    //     }
-    //     GET(token);
-    // }
-    statement();
-}
-
-inline void statement()
+/**
+ * Recursive descent parser for PL/0 that generates code for the
+ * virtual machine as it parses.
+ *
+ * All state lives in the parser object so that any number of
+ * programs can be compiled side by side.
+ *
+ * Errors are printed with the line and column of the lexeme they were found
+ * at. Parsing then skips ahead to a lexeme that can follow the broken
+ * declaration or statement and carries on, so one pass reports every error.
+ */
+class ParserAndCodeGenerator
 {
-    switch(token->second)
-    {
-        case token_type::identSym:
-        {
-            // Find identifier in symbol table
-            int i;
-            for (i = TP - 1; i > 0; --i)
-            {
-                if (symbol_table[i].name == token->first)
-                {
-                    // Symbol found
-                    break;
-                }
-            }
-            if (i == 0)
-            {
-                (*localOutputStream) << "Error: - Undeclared identifier.\n";
-                syntaxCorrect = false;
-            }
-            if (symbol_table[i].kind != 2)
-            {
-                (*localOutputStream) << "Error: - Assignment to constant or procedure is not allowed.\n";
-                syntaxCorrect = false;
-                i = 0;
-            }
-
-            GET(token);
-            if (token->second != token_type::becomesSym)
-            {
-                (*localOutputStream) << "Error: - Assignment operator expected.\n";
-                syntaxCorrect = false;
-            }
-            GET(token);
-
-            int reg1 = RX;
-
-            expression();
-
-            if (i != 0)
-            {
-                // Generate store call
-                codegen(STO, reg1, 0, symbol_table[i].adr);
-                --RX;
-            }
-
-            break;
-        }
-        case token_type::callSym:
-        {
-            (*localOutputStream) << "Error: - call not yet supported.\n";
-            syntaxCorrect = false;
-
-            // GET(token);
-            // if (token->second != token_type::identSym)
-            // {
-            //     // Error
-            // }
-            // GET(token);
-            break;
-        }
-        case token_type::beginSym:
-        {
-            // Get the next token after the begin token 
-            // and handle statement
-            GET(token);
-            statement();
-            
-            // As long as the next symbol is a starting statement token,
-            // keep parsing/generating statement code
-            while (STATEMENT_TOKENS.count(token->second))
-            {
-                // If the next symbol is a semicolon, get the next token
-                // so we handle the next statement.
-                while (token->second == token_type::semicolonSym)
-                {
-                    GET(token);
-                }
-                // else
-                // {
-                //     // If not a semicolon, don't grab next symbol
-                //     // so that statement can still continue running.
-                //     (*localOutputStream) << "Warning: - Semicolon between statements missing.\n";
-                // }
-
-                statement();
-            }
-
-            if (token->second != token_type::endSym)
-            {
-                (*localOutputStream) << "Error: - Incorrect symbol after statement. end, semicolon or } expected.\n";
-                syntaxCorrect = false;
-            }
-            GET(token);
-            break;
-        }
-        case token_type::ifSym:
-        {
-            int reg1 = RX;
-
-            GET(token);
-            condition();
-            if (token->second != token_type::thenSym)
-            {
-                (*localOutputStream) << "Error: - then expected.\n";
-                syntaxCorrect = false;
-            }
-            
-            GET(token);
-            
-            int ctemp = CX;
-            codegen(JPC, reg1, 0, 0);
-
-            statement();
-
-            if (token->second == token_type::semicolonSym)
-            {
-                auto tokenTemp = token;
-                PEEK(token);
-
-                if (token->second == token_type::elseSym)
-                {
-                    // If the token after the semicolon is an else token, 
-                    // then get the next token so the else code can be 
-                    // processed. 
-                    GET(token)
-                }
-                else
-                {
-                    // If it isn't an else token, revert the token back
-                    // to its previous held value so it can be processed
-                    // as the end of a statment section of code when this
-                    // function returns.
-                    token = tokenTemp;
-                }
-                
-            }
-
-            if (token->second == token_type::elseSym)
-            {
-                // Token after else token
-                GET(token);
-
-                // Create jump that will bring the
-                // stack pointer to the code after the
-                // else statment should the if statement
-                // execute.
-                int ctemp2 = CX;
-                codegen(JMP, reg1, 0, 0);
-                
-                // Update jump that will bring the
-                // stack pointer to the code in the else
-                // condition if the if condition fails
-                CODE[ctemp].mMOperand = CX;
-
-                statement();
-
-                // Update the jump at the end of the if statment.
-                // The stack pointer will need to be moved to the
-                // currently stored stack index which is right after
-                // the else statemnt.
-                CODE[ctemp2].mMOperand = CX;
-            }
-            else 
-            {
-                CODE[ctemp].mMOperand = CX;
-            }
-
-            break;
-        }
-        case token_type::whileSym:
-        {
-            int reg1 = RX;
-            int ctemp1 = CX;
-            GET(token);
-            condition();
-            
-            int ctemp2 = CX;
-            codegen(JPC, reg1, 0, 0);
-
-            if (token->second != token_type::doSym)
-            {
-                (*localOutputStream) << "Error: - do expected.\n";
-                syntaxCorrect = false;
-            }
-            GET(token);
-            statement();
-
-            codegen(JMP, 0, 0, ctemp1);
-            CODE[ctemp2].mMOperand = CX;
-            break;
-        }
-        case token_type::readSym:
-        {
-            GET(token);
-
-            // Find identifier in symbol table
-            int i;
-            for (i = TP - 1; i > 0; --i)
-            {
-                if (symbol_table[i].name == token->first)
-                {
-                    // Symbol found
-                    break;
-                }
-            }
-            if (i == 0)
-            {
-                (*localOutputStream) << "Error: - Undeclared identifier.\n";
-                syntaxCorrect = false;
-            }
-            if (symbol_table[i].kind != 2)
-            {
-                (*localOutputStream) << "Error: - Cannot write to a constant or procedure.\n";
-                syntaxCorrect = false;
-                i = 0;
-            }
-
-            ++RX;
-            codegen(SIO2, RX, 0, 0);
-
-            if (i != 0)
-            {
-                // Store value in register RX into variable at adr from symbol table
-                codegen(STO, RX, 0, symbol_table[i].adr);
-                --RX;
-            }
-            GET(token);
-
-            break;
-        }
-        case token_type::writeSym:
-        {   
-            GET(token);
-            
-            if (token->second == token_type::identSym)
-            {
-                // Find identifier in symbol table
-                int i;
-                for (i = TP - 1; i > 0; --i)
-                {
-                    if (symbol_table[i].name == token->first)
-                    {
-                        // Symbol found
-                        break;
-                    }
-                }
-                if (i == 0)
-                {
-                    (*localOutputStream) << "Error: - Undeclared identifier.\n";
-                    syntaxCorrect = false;
-                }
-
-                ++RX;
-                // Copy value at found address into register at RX
-                codegen(LOD, RX, 0, symbol_table[i].adr);
-
-                // Print value stored register at RX
-                codegen(SIO1, RX, 0, 0);
-                --RX;
-
-                GET(token);  
-            }
-            else
-            {
-                (*localOutputStream) << "Error: - Write must be followed by an identifier.\n";
-                    syntaxCorrect = false;
-            }
-
-            break;
-        }
-        default:
-        {
-            // Handle an empty statement
-            
-            // (*localOutputStream) << "Error: - statement expected.\n";
-            // syntaxCorrect = false;
-        }
-    }
-}
+public:
+    /**
+     * @param lexemes Lexeme table produced by analyzeCode()
+     * @param outputStream Stream errors and the generated code are printed to
+     * @param memory Where the symbol table is kept, such as a CompilationArena. Must outlive the parser.
+     */
+    ParserAndCodeGenerator(const std::vector<Lexeme>& lexemes, std::stringstream& outputStream,
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource());
 
-inline void condition()
-{
-    if (token->second == token_type::oddSym)
-    {
-        // TODO
-        GET(token);
-        expression();
-    }
-    else
-    {
-        expression();
-        if (relationOperator.count(token->second) == 0)
-        {
-            (*localOutputStream) << "Error: - relation operator expected.\n";
-            syntaxCorrect = false;
-        }
-        token_type relop = token->second;
-        
-        int reg1 = RX - 1;
-        int reg2 = RX;
-
-        GET(token);
-        expression();
-
-        switch(relop)
-        {
-            case neqSym:
-            {
-                codegen(NEQ, reg1, reg1, reg2);
-                break;
-            }
-            case eqSym:
-            {
-                codegen(EQL, reg1, reg1, reg2);
-                break;
-            }
-            case lesSym:
-            {
-                codegen(LSS, reg1, reg1, reg2);
-                break;
-            }
-            case leqSym:
-            {
-                codegen(LEQ, reg1, reg1, reg2);
-                break;
-            }
-            case gtrSym:
-            {
-                codegen(GTR, reg1, reg1, reg2);
-                break;
-            }
-            case geqSym:
-            {
-                codegen(GEQ, reg1, reg1, reg2);
-                break;
-            }
-            default:
-            {
-                (*localOutputStream) << "Error: - relationship operator not handled.\n";
-            }
-        }
-    }
-}
+    /**
+     * Parse lexemes as they are pulled from tokens, without a lexeme table.
+     * parseStatement() needs a lexeme table and cannot be used.
+     * @param tokens Must outlive the parser
+     * @param outputStream Stream errors and the generated code are printed to
+     * @param memory Where the symbol table is kept, such as a CompilationArena. Must outlive the parser.
+     */
+    ParserAndCodeGenerator(TokenStream& tokens, std::stringstream& outputStream,
+        std::pmr::memory_resource* memory = std::pmr::get_default_resource());
 
-inline void expression()
-{
-    // We can ignore the condition of a + before a term since this
-    // doesn't effect the result.
-    if (token->second == token_type::minusSym)
-    {
-        int reg1 = RX - 1;
-        int reg2 = RX;
+    /**
+     * Parse the program, generate its code and print the generated code.
+     * @return If the program is syntactically correct
+     */
+    bool parse();
 
-        GET(token);
-        term();
+    /**
+     * Parse the declarations at the start of the program and generate their code.
+     * @return Lexeme index of the statement following the declarations
+     */
+    int parseDeclarations();
 
-        codegen(NEG, reg1, reg1, 0);
-        --RX;
-    }
-    else
-    {
-        term();
-        while (token->second == token_type::plusSym || token->second == token_type::minusSym)
-        {
-            token_type plusMinusOp = token->second;
-
-            int reg1 = RX;
-            int reg2 = RX - 1;
-
-            GET(token);
-            term();
-
-            switch (plusMinusOp)
-            {
-                case token_type::plusSym:
-                {
-                    codegen(ADD, reg2, reg2, reg1);
-                    --RX;
-                    break;
-                }
-                case token_type::minusSym:
-                {
-                    codegen(SUB, reg2, reg2, reg1);
-                    --RX;
-                    break;
-                }
-                default:
-                {
-                    (*localOutputStream) << "Error - term operator not handled.\n";
-                }
-            }
-        }
-    }
-}
+    /**
+     * Generate code for the single statement at lexeme index first, after
+     * parseDeclarations(). Code generated before is discarded, so jump targets
+     * in the new code are relative to the start of the statement.
+     * @param rx Register index the statement starts with
+     * @return Lexeme index following the statement
+     */
+    int parseStatement(int first, int rx);
 
-inline void term()
-{
-    factor(); // this will do a load and modify RX
-    while (token->second == token_type::multSym || token->second == token_type::slashSym)
+    /** Register index the next statement starts with. */
+    int registerIndex() const
     {
-        token_type mulDivOp = token->second;
-        
-        int reg1 = RX - 1;
-        int reg2 = RX;
-
-        GET(token);
-        factor(); // this will do a load and modify RX
-        
-        if (mulDivOp == token_type::multSym)
-        {
-            codegen(MUL, reg1, reg1, reg2);
-            --RX;
-        }
-        else
-        {
-            codegen(DIV, reg1, reg1, reg2);
-            --RX;
-            break;
-        }
+        return mRX;
     }
-}
 
-inline void factor()
-{
-    if (token->second == token_type::identSym)
+    /** Returns if no syntax errors were found so far. */
+    bool syntaxCorrect() const
     {
-        // Find identifier in symbol table
-        int i;
-        for (i = TP - 1; i > 0; --i)
-        {
-            if (symbol_table[i].name == token->first)
-            {
-                // Symbol found
-                break;
-            }
-        }
-        if (i == 0)
-        {
-            (*localOutputStream) << "Error: - Undeclared identifier.\n";
-            syntaxCorrect = false;
-        }
-
-        codegen(LOD, RX, 0, symbol_table[i].adr);
-        ++RX;
-
-        GET(token);
+        return mSyntaxCorrect;
     }
-    else if (token->second == token_type::numberSym)
-    {
-        codegen(LIT, RX, 0, std::stoi(token->first));
-        ++RX;
 
-        GET(token);
-    }
-    else if (token->second == token_type::lparentSym)
-    {
-        GET(token);
-        expression();
-        if (token->second != token_type::rparentSym)
-        {
-            (*localOutputStream) << "Error: - Right parenthesis missing.\n";
-            syntaxCorrect = false;
-        }
-        GET(token);
-    }
-    else
+    /** Append an instruction to the generated code. */
+    void codegen(InstructionType instType, int reg, int lexLevOrReg, int op);
+
+    /** The generated code. */
+    const std::vector<Instruction>& code() const
     {
-        (*localOutputStream) << "Error: - The preceding factor cannot begin with this symbol.\n";
-        syntaxCorrect = false;
+        return mCode;
     }
-}
 
-inline void codegen(InstructionType instType, int reg, int lexLevOrReg, int op)
-{
-    if (CX > MAX_CODE_LENGTH)
+    /** Source line each generated instruction came from, starting at 1. */
+    const std::vector<int>& codeLines() const
     {
-        (*localOutputStream) << "Error: - Generated code length became too large.\n";
-        syntaxCorrect = false;
+        return mCodeLines;
     }
-    else
+
+private:
+    void program();
+    void block();
+    void declarations();
+    /** Expect the semicolon ending a declaration, skipping anything before it. */
+    void declarationEnd();
+    void statement();
+    void condition();
+    void expression();
+    void term();
+    void factor();
+
+    /** Index the next generated instruction will be stored at. */
+    int codeIndex() const
     {
-        CODE[CX].mOpCode = instType;
-        CODE[CX].mRegister = reg;
-        CODE[CX].mLexLevelOrReg = lexLevOrReg;
-        CODE[CX].mMOperand = op;
-        ++CX;
+        return static_cast<int>(mCode.size());
     }
-}
 
-inline bool parseAndGenerage(const std::vector<std::pair<std::string, token_type>>& lexemes, 
-    std::stringstream& outputStream)
-{
-    lexemeTable = lexemes;
+    /**
+     * Print an error at the current lexeme and mark the program incorrect.
+     * Only the first error at a lexeme is printed.
+     */
+    void error(const std::string& message);
 
-    localOutputStream = &outputStream;
+    /** Skip lexemes until one in follow or the end of input. */
+    void synchronize(TokenSet follow);
 
-    program();
+    /** Point the jump at index jump to target, if the jump was generated. */
+    void patchJump(int jump, int target);
 
-    codegen(SIO3, 0, 0, 3);
+    /** Add a symbol to the end of the symbol table. */
+    void addSymbol(const Symbol& symbol);
 
-    (*localOutputStream) << "Generated Code:\n";
-    int i = 0;  
-    outputStream << "Line       OP        R    L    M\n";
-    while (CODE[i].mOpCode != 0)
-    {
-        outputStream << std::setw(11) << std::left << i
-            << std::setw(10) << std::left << InstructionTypeLookupTable[CODE[i].mOpCode]
-            << CODE[i].mRegister << "    "
-            << CODE[i].mLexLevelOrReg << "    "
-            << CODE[i].mMOperand << "\n";
-        ++i;
-    }
+    /**
+     * Find the most recently declared symbol with the given name.
+     * @return Index of the symbol in the symbol table, 0 if not found
+     */
+    int findSymbol(const std::string& name) const;
 
-    if (syntaxCorrect)
-    {
-        (*localOutputStream) << "\n\nNo errors, program is syntactically correct.\n";
-    }
+    /** Generate code loading the value of the symbol at index into register reg. */
+    void loadSymbol(int index, int reg);
+
+    /** Set when parsing a lexeme table. */
+    std::unique_ptr<LexemeTableStream> mTable;
+    TokenStream& mTokens;
+    std::stringstream& mOutputStream;
+
+    /** Symbol table. Index 0 is a placeholder returned for unknown names. */
+    std::pmr::vector<Symbol> mSymbolTable;
 
-    return syntaxCorrect;
-}
+    std::vector<Instruction> mCode;
+    std::vector<int> mCodeLines;
+
+    /** Current token */
+    const Lexeme* mToken = nullptr;
+
+    /** Register Index */
+    int mRX = 0;
+
+    /** Current Stack Address */
+    int mCSA = 4;
+
+    /** Tracks if syntax is correct throughout generation of program. */
+    bool mSyntaxCorrect = true;
+
+    /** Stream position of the lexeme the last error was printed for, 0 for none. */
+    std::size_t mLastErrorPosition = 0;
+
+    /** Number of errors printed. */
+    int mErrorCount = 0;
+
+    /** Set once code length became too large. */
+    bool mCodeTooLong = false;
+
+    /** Source line of the statement or declaration code is currently generated for. */
+    int mCurrentSourceLine = 0;
+};
+
+/** Print a listing of code with the index, op code and operands of every instruction. */
+void printCode(std::ostream& outputStream, const std::vector<Instruction>& code);
+
+/**
+ * Parse the lexeme table and generate code for it.
+ * @param lexemes Lexeme table produced by analyzeCode()
+ * @param outputStream Stream errors and the generated code are printed to
+ * @param code Receives the generated code
+ * @param codeLines Receives the source line each instruction came from
+ * @param memory Where the symbol table is kept while parsing, such as a CompilationArena
+ * @return If the program is syntactically correct and the code can be run
+ */
+bool parseAndGenerage(const std::vector<Lexeme>& lexemes, std::stringstream& outputStream,
+    std::vector<Instruction>& code, std::vector<int>& codeLines,
+    std::pmr::memory_resource* memory = std::pmr::get_default_resource());
+
+/**
+ * Lex, parse and generate code for source in one pass. The parser pulls
+ * lexemes from the lexer as it needs them, so no lexeme table is built.
+ * Lexical errors are printed after the parser output.
+ * @param outputStream Stream errors and the generated code are printed to
+ * @param code Receives the generated code
+ * @param codeLines Receives the source line each instruction came from
+ * @param lexOnThread Run the lexer on a thread of its own, overlapping lexing with parsing
+ * @return If the program is lexically and syntactically correct and the code can be run
+ */
+bool parseAndGenerateStreaming(const std::string& source, std::stringstream& outputStream,
+    std::vector<Instruction>& code, std::vector<int>& codeLines, bool lexOnThread = false);
 
-#endif // PARSERANDCODEGENERATOR_H
\ No newline at end of file
+#endif // PARSERANDCODEGENERATOR_H
@@ -0,0 +1,106 @@
+#include "PerfCounters.h"
+
+#include <cstring> // memset()
+
+#ifdef __linux__
+#include <linux/perf_event.h>
+#include <sys/syscall.h> // SYS_perf_event_open
+#include <unistd.h>      // close(), read(), syscall()
+
+/** Fill in the type and config of event. */
+static void describeEvent(PerfEvent event, perf_event_attr& attributes)
+{
+    switch (event)
+    {
+        case PerfEvent::Cycles:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CPU_CYCLES;
+            break;
+        case PerfEvent::Instructions:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_INSTRUCTIONS;
+            break;
+        case PerfEvent::BranchMisses:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_BRANCH_MISSES;
+            break;
+        case PerfEvent::CacheMisses:
+            attributes.type = PERF_TYPE_HARDWARE;
+            attributes.config = PERF_COUNT_HW_CACHE_MISSES;
+            break;
+        case PerfEvent::L1DataReadMisses:
+            attributes.type = PERF_TYPE_HW_CACHE;
+            attributes.config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8)
+                | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+            break;
+    }
+}
+#endif
+
+PerfCounters::PerfCounters()
+{
+    for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+    {
+        mFiles[index] = -1;
+#ifdef __linux__
+        perf_event_attr attributes;
+        std::memset(&attributes, 0, sizeof(attributes));
+        attributes.size = sizeof(attributes);
+        describeEvent(static_cast<PerfEvent>(index), attributes);
+        attributes.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        attributes.inherit = 1;
+        // Unprivileged processes may only count their own user space
+        attributes.exclude_kernel = 1;
+        attributes.exclude_hv = 1;
+        mFiles[index] = static_cast<int>(syscall(SYS_perf_event_open, &attributes, 0, -1, -1, 0));
+        if (mFiles[index] < 0)
+        {
+            mFiles[index] = -1;
+        }
+#endif
+    }
+}
+
+PerfCounters::~PerfCounters()
+{
+#ifdef __linux__
+    for (int file : mFiles)
+    {
+        if (file != -1)
+        {
+            close(file);
+        }
+    }
+#endif
+}
+
+bool PerfCounters::anyAvailable() const
+{
+    for (int file : mFiles)
+    {
+        if (file != -1)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+PerfSample PerfCounters::read() const
+{
+    PerfSample sample;
+#ifdef __linux__
+    for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+    {
+        // Value, time enabled and time actually counting
+        std::uint64_t data[3];
+        if (mFiles[index] == -1 || ::read(mFiles[index], data, sizeof(data)) != sizeof(data) || data[2] == 0)
+        {
+            continue;
+        }
+        sample.values[index] = data[2] < data[1]
+            ? static_cast<std::uint64_t>(static_cast<double>(data[0]) * data[1] / data[2]) : data[0];
+    }
+#endif
+    return sample;
+}
@@ -0,0 +1,88 @@
+#ifndef PERFCOUNTERS_H
+#define PERFCOUNTERS_H
+
+#include <cstdint>
+#include <string>
+
+/** Hardware events PerfCounters counts. */
+enum class PerfEvent : int
+{
+    Cycles,
+    Instructions,
+    BranchMisses,
+    CacheMisses,
+    L1DataReadMisses    // What perf stat calls L1-dcache-load-misses
+};
+
+/** Number of PerfEvent values. */
+const int PERF_EVENT_COUNT = 5;
+
+/** Names of the events in reports, indexed by PerfEvent. */
+const std::string PerfEventNames[] =
+{
+    "cycles",
+    "instructions",
+    "branch_misses",
+    "cache_misses",
+    "l1d_read_misses"
+};
+
+/** Totals of every event at one point, or their difference between two points. */
+struct PerfSample
+{
+    std::uint64_t values[PERF_EVENT_COUNT] = {};
+
+    std::uint64_t operator[](PerfEvent event) const
+    {
+        return values[static_cast<int>(event)];
+    }
+};
+
+/** Events counted between earlier and later. */
+inline PerfSample operator-(const PerfSample& later, const PerfSample& earlier)
+{
+    PerfSample difference;
+    for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+    {
+        difference.values[index] = later.values[index] - earlier.values[index];
+    }
+    return difference;
+}
+
+/**
+ * Counts hardware events of the calling thread and threads it starts later
+ * with perf_event_open(), in user space only. Counting starts when the object
+ * is created.
+ *
+ * Events the kernel or the hardware do not offer, and every event on systems
+ * other than Linux, are left out and read as 0. When there are more events
+ * than hardware counters the kernel takes turns between them, and the counts
+ * are scaled up to the whole time they were enabled.
+ */
+class PerfCounters
+{
+public:
+    PerfCounters();
+    ~PerfCounters();
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    /** Returns if event is counted. */
+    bool available(PerfEvent event) const
+    {
+        return mFiles[static_cast<int>(event)] != -1;
+    }
+
+    /** Returns if any event is counted. */
+    bool anyAvailable() const;
+
+    /** Totals of every event since the object was created. */
+    PerfSample read() const;
+
+private:
+    /** File descriptor of the counter of each event, -1 if it is not counted. */
+    int mFiles[PERF_EVENT_COUNT];
+};
+
+#endif // PERFCOUNTERS_H
@@ -0,0 +1,240 @@
+#include "PhaseStats.h"
+
+#include <iomanip>
+#include <sstream>
+
+#include <sys/resource.h> // getrusage()
+
+/** Highest resident set size of the process so far, in kilobytes. */
+static std::uint64_t peakResidentSize()
+{
+    rusage usage;
+    if (getrusage(RUSAGE_SELF, &usage) != 0)
+    {
+        return 0;
+    }
+#ifdef __APPLE__
+    // Bytes rather than kilobytes
+    return static_cast<std::uint64_t>(usage.ru_maxrss) / 1024;
+#else
+    return static_cast<std::uint64_t>(usage.ru_maxrss);
+#endif
+}
+
+/** Format a duration with a unit that keeps it readable, such as 1.25 ms. */
+static std::string formatDuration(std::chrono::nanoseconds duration)
+{
+    static const char* const UNITS[] = { "ns", "us", "ms", "s" };
+    double value = static_cast<double>(duration.count());
+    int unit = 0;
+    while (value >= 1000.0 && unit < 3)
+    {
+        value /= 1000.0;
+        ++unit;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(unit == 0 ? 0 : 2) << value << " " << UNITS[unit];
+    return text.str();
+}
+
+/** Format a size given in bytes, such as 4.5 KB. */
+static std::string formatBytes(std::uint64_t bytes)
+{
+    static const char* const UNITS[] = { "B", "KB", "MB", "GB" };
+    double value = static_cast<double>(bytes);
+    int unit = 0;
+    while (value >= 1024.0 && unit < 3)
+    {
+        value /= 1024.0;
+        ++unit;
+    }
+    std::ostringstream text;
+    text << std::fixed << std::setprecision(unit == 0 ? 0 : 1) << value << " " << UNITS[unit];
+    return text.str();
+}
+
+PhaseStats::PhaseStats(bool enabled)
+    : mEnabled(enabled)
+{
+    if (mEnabled)
+    {
+        mCounters = std::make_unique<PerfCounters>();
+    }
+}
+
+void PhaseStats::beginPhase(const std::string& name, const std::string& itemUnit)
+{
+    if (!mEnabled)
+    {
+        return;
+    }
+
+    PhaseRecord phase;
+    phase.name = name;
+    phase.itemUnit = itemUnit;
+    mPhases.push_back(phase);
+
+    // Read the clock and counters last, so that none of the above is measured
+    mPhasePeakResident = peakResidentSize();
+    mPhaseAllocations = allocationTotals();
+    mPhaseEvents = mCounters->read();
+    mPhaseStart = Clock::now();
+    mSliceEvents = mPhaseEvents;
+    mSliceStart = mPhaseStart;
+    mSliceInstructions = 0;
+}
+
+void PhaseStats::endPhase(std::uint64_t items)
+{
+    if (!mEnabled || mPhases.empty())
+    {
+        return;
+    }
+
+    Clock::time_point end = Clock::now();
+    PerfSample events = mCounters->read();
+    AllocationTotals allocations = allocationTotals();
+    PhaseRecord& phase = mPhases.back();
+    phase.wallTime = end - mPhaseStart;
+    phase.events = events - mPhaseEvents;
+    phase.peakResidentGrowth = peakResidentSize() - mPhasePeakResident;
+    phase.allocations.allocations = allocations.allocations - mPhaseAllocations.allocations;
+    phase.allocations.bytes = allocations.bytes - mPhaseAllocations.bytes;
+    phase.allocations.deallocations = allocations.deallocations - mPhaseAllocations.deallocations;
+    phase.items = items;
+}
+
+void PhaseStats::endSlice(std::uint64_t instructionsExecuted)
+{
+    if (!mEnabled)
+    {
+        return;
+    }
+
+    Clock::time_point end = Clock::now();
+    PerfSample events = mCounters->read();
+    SliceRecord slice;
+    slice.instructions = instructionsExecuted - mSliceInstructions;
+    slice.wallTime = end - mSliceStart;
+    slice.events = events - mSliceEvents;
+    mSlices.push_back(slice);
+
+    mSliceEvents = mCounters->read();
+    mSliceStart = Clock::now();
+    mSliceInstructions = instructionsExecuted;
+}
+
+void PhaseStats::writeMeasurement(std::ostream& stream, std::chrono::nanoseconds wallTime,
+    const PerfSample& events) const
+{
+    stream << "\"wall_ns\": " << wallTime.count();
+    for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+    {
+        stream << ", \"" << PerfEventNames[index] << "\": ";
+        if (mCounters != nullptr && mCounters->available(static_cast<PerfEvent>(index)))
+        {
+            stream << events.values[index];
+        }
+        else
+        {
+            stream << "null";
+        }
+    }
+}
+
+void PhaseStats::writeJson(std::ostream& stream) const
+{
+    stream << "{\n  \"phases\": [";
+    for (std::size_t index = 0; index < mPhases.size(); ++index)
+    {
+        const PhaseRecord& phase = mPhases[index];
+        stream << (index == 0 ? "\n" : ",\n") << "    {\"name\": \"" << phase.name << "\", ";
+        writeMeasurement(stream, phase.wallTime, phase.events);
+        stream << ", \"peak_rss_growth_kb\": " << phase.peakResidentGrowth;
+        if (allocationsCounted())
+        {
+            stream << ", \"allocations\": " << phase.allocations.allocations
+                << ", \"allocated_bytes\": " << phase.allocations.bytes
+                << ", \"deallocations\": " << phase.allocations.deallocations;
+        }
+        else
+        {
+            stream << ", \"allocations\": null, \"allocated_bytes\": null, \"deallocations\": null";
+        }
+        stream << ", \"items\": " << phase.items << ", \"item_unit\": \"" << phase.itemUnit << "\"}";
+    }
+    stream << "\n  ],\n  \"vm_slices\": [";
+    for (std::size_t index = 0; index < mSlices.size(); ++index)
+    {
+        stream << (index == 0 ? "\n" : ",\n") << "    {\"vm_instructions\": " << mSlices[index].instructions << ", ";
+        writeMeasurement(stream, mSlices[index].wallTime, mSlices[index].events);
+        stream << "}";
+    }
+    stream << "\n  ]\n}\n";
+}
+
+void PhaseStats::writeReport(std::ostream& stream) const
+{
+    bool counted = allocationsCounted();
+    stream << std::left << std::setw(12) << "Phase" << std::right
+        << std::setw(12) << "Wall time"
+        << std::setw(12) << "Peak RSS"
+        << std::setw(13) << "Allocations"
+        << std::setw(12) << "Allocated"
+        << std::setw(13) << "Frees"
+        << "  Processed\n";
+    for (const PhaseRecord& phase : mPhases)
+    {
+        stream << std::left << std::setw(12) << phase.name << std::right
+            << std::setw(12) << formatDuration(phase.wallTime)
+            << std::setw(12) << ("+" + formatBytes(phase.peakResidentGrowth * 1024));
+        if (counted)
+        {
+            stream << std::setw(13) << phase.allocations.allocations
+                << std::setw(12) << formatBytes(phase.allocations.bytes)
+                << std::setw(13) << phase.allocations.deallocations;
+        }
+        else
+        {
+            stream << std::setw(13) << "-" << std::setw(12) << "-" << std::setw(13) << "-";
+        }
+        stream << "  " << phase.items << " " << phase.itemUnit;
+        if (phase.items != 0 && phase.wallTime.count() != 0)
+        {
+            double perSecond = phase.items * 1e9 / static_cast<double>(phase.wallTime.count());
+            stream << " (" << std::fixed << std::setprecision(2) << perSecond / 1e6 << " M/s)";
+            stream.unsetf(std::ios::floatfield);
+        }
+        stream << "\n";
+    }
+    if (!counted)
+    {
+        stream << "Allocations are not counted by this program.\n";
+    }
+
+    if (mCounters == nullptr || !mCounters->anyAvailable())
+    {
+        return;
+    }
+    stream << "\n" << std::left << std::setw(12) << "Phase" << std::right;
+    for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+    {
+        if (mCounters->available(static_cast<PerfEvent>(index)))
+        {
+            stream << std::setw(18) << PerfEventNames[index];
+        }
+    }
+    stream << "\n";
+    for (const PhaseRecord& phase : mPhases)
+    {
+        stream << std::left << std::setw(12) << phase.name << std::right;
+        for (int index = 0; index < PERF_EVENT_COUNT; ++index)
+        {
+            if (mCounters->available(static_cast<PerfEvent>(index)))
+            {
+                stream << std::setw(18) << phase.events.values[index];
+            }
+        }
+        stream << "\n";
+    }
+}
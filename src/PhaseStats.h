@@ -0,0 +1,117 @@
+#ifndef PHASESTATS_H
+#define PHASESTATS_H
+
+#include "AllocationCounter.h"
+#include "PerfCounters.h"
+
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/** Instructions in a slice of a run measured by compile --stats, unless told otherwise. */
+const std::uint64_t DEFAULT_SLICE_INSTRUCTIONS = 100000;
+
+/** Time, memory and hardware events of one phase of compiling or running a program. */
+struct PhaseRecord
+{
+    std::string name;
+    std::chrono::nanoseconds wallTime = std::chrono::nanoseconds::zero();
+    PerfSample events;
+
+    /** How much the peak resident set size of the process grew during the phase, in kilobytes. */
+    std::uint64_t peakResidentGrowth = 0;
+
+    /** Allocations made during the phase. Only counted when allocationsCounted(). */
+    AllocationTotals allocations;
+
+    /** Work done by the phase, such as tokens read or instructions executed. */
+    std::uint64_t items = 0;
+    std::string itemUnit;
+};
+
+/** Wall time and hardware events of a slice of the instructions the virtual machine executed. */
+struct SliceRecord
+{
+    /** Instructions executed in the slice. */
+    std::uint64_t instructions = 0;
+    std::chrono::nanoseconds wallTime = std::chrono::nanoseconds::zero();
+    PerfSample events;
+};
+
+/**
+ * Measures the phases of compiling and running a program, and slices of the
+ * run, for compile -s and --stats. A disabled recorder measures nothing and costs
+ * next to nothing, so phases can be marked whether or not stats were asked for.
+ */
+class PhaseStats
+{
+public:
+    explicit PhaseStats(bool enabled);
+
+    bool enabled() const
+    {
+        return mEnabled;
+    }
+
+    /**
+     * Start measuring phase name. Phases do not nest.
+     * @param itemUnit What the phase processes, such as "tokens"
+     */
+    void beginPhase(const std::string& name, const std::string& itemUnit);
+
+    /**
+     * Stop measuring the current phase.
+     * @param items How many of its unit the phase processed
+     */
+    void endPhase(std::uint64_t items);
+
+    /**
+     * End the current slice of a run and start the next one. The first slice
+     * starts with the phase.
+     * @param instructionsExecuted Instructions the machine executed since it was reset
+     */
+    void endSlice(std::uint64_t instructionsExecuted);
+
+    const std::vector<PhaseRecord>& phases() const
+    {
+        return mPhases;
+    }
+
+    const std::vector<SliceRecord>& slices() const
+    {
+        return mSlices;
+    }
+
+    /** Write the phases and slices as JSON. Events and allocations that were not counted are null. */
+    void writeJson(std::ostream& stream) const;
+
+    /** Write the phases as a table for people to read, followed by the events counted per phase. */
+    void writeReport(std::ostream& stream) const;
+
+private:
+    using Clock = std::chrono::steady_clock;
+
+    /** Write the wall time and events of a record as JSON members. */
+    void writeMeasurement(std::ostream& stream, std::chrono::nanoseconds wallTime, const PerfSample& events) const;
+
+    bool mEnabled;
+
+    /** Only opened when enabled. */
+    std::unique_ptr<PerfCounters> mCounters;
+
+    std::vector<PhaseRecord> mPhases;
+    std::vector<SliceRecord> mSlices;
+
+    Clock::time_point mPhaseStart;
+    PerfSample mPhaseEvents;
+    std::uint64_t mPhasePeakResident = 0;
+    AllocationTotals mPhaseAllocations;
+    Clock::time_point mSliceStart;
+    PerfSample mSliceEvents;
+    std::uint64_t mSliceInstructions = 0;
+};
+
+#endif // PHASESTATS_H
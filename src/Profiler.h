@@ -0,0 +1,300 @@
+#ifndef PROFILER_H
+#define PROFILER_H
+
+#include "Instruction.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdint>
+#include <iomanip>
+#include <map>
+#include <ostream>
+#include <string>
+#include <vector>
+
+#if defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h> // __rdtsc()
+#endif
+
+/**
+ * Number of op code slots counted by the profiler. Slot 0, which is no op
+ * code, counts the instructions of unverified code whose op code is invalid.
+ */
+const int PROFILER_OP_CODE_COUNT = LAST_OP_CODE + 1;
+
+/** Number of hottest instructions listed in the report. */
+const int PROFILER_HOT_SPOT_COUNT = 10;
+
+/**
+ * Counts executions per op code and per code index while the virtual machine runs.
+ *
+ * Optionally the cost of every Nth instruction is measured with the time stamp
+ * counter (or steady_clock where that is not available) and scaled up by N to
+ * estimate where the cycles go.
+ *
+ * The virtual machine only calls into the profiler when built with
+ * PMACHINE_PROFILING defined, so builds without it pay nothing.
+ */
+class Profiler
+{
+public:
+    /**
+     * @param codeLength Number of instructions in the code being profiled
+     * @param sampleInterval Measure the cost of every sampleInterval-th instruction.
+     *     Zero only counts executions.
+     */
+    explicit Profiler(int codeLength, int sampleInterval = 0)
+        : mExecutions(codeLength, 0)
+        , mTaken(codeLength, 0)
+        , mCycles(codeLength, 0)
+        , mSampleInterval(sampleInterval)
+        , mNextSample(sampleInterval)
+    {
+    }
+
+    /**
+     * Count the execution of the instruction at index pc.
+     * @return If the cost of this instruction should be measured,
+     *     in which case endSample() must be called once it executed.
+     */
+    bool beginStep(int pc, InstructionType opCode)
+    {
+        ++mExecutions[pc];
+        ++mOpCodeExecutions[opCodeSlot(opCode)];
+
+        if (mSampleInterval == 0 || --mNextSample != 0)
+        {
+            return false;
+        }
+        mNextSample = mSampleInterval;
+        mSampleStart = now();
+        return true;
+    }
+
+    /** Finish measuring the instruction at index pc. */
+    void endSample(int pc)
+    {
+        mCycles[pc] += (now() - mSampleStart) * mSampleInterval;
+    }
+
+    /** Count the branch at index pc jumping. */
+    void branchTaken(int pc)
+    {
+        ++mTaken[pc];
+    }
+
+    /** Number of instructions in the profiled code. */
+    int codeLength() const
+    {
+        return static_cast<int>(mExecutions.size());
+    }
+
+    /** Number of times the instruction at index pc executed. */
+    std::uint64_t executions(int pc) const
+    {
+        return mExecutions[pc];
+    }
+
+    /** Number of times the branch at index pc jumped rather than falling through. */
+    std::uint64_t taken(int pc) const
+    {
+        return mTaken[pc];
+    }
+
+    /** Number of times instructions with the given op code executed. */
+    std::uint64_t opCodeExecutions(InstructionType opCode) const
+    {
+        return mOpCodeExecutions[opCodeSlot(opCode)];
+    }
+
+    /**
+     * Print the hot spot report.
+     * @param code The profiled code
+     * @param codeLines Source line each instruction was generated for
+     * @param source The source program, used to show the text of hot lines
+     */
+    void report(std::ostream& output, const Instruction* code, const int* codeLines, const std::string& source) const
+    {
+        int codeLength = static_cast<int>(mExecutions.size());
+        std::uint64_t total = 0;
+        std::uint64_t totalCycles = 0;
+        for (int i = 0; i < codeLength; ++i)
+        {
+            total += mExecutions[i];
+            totalCycles += mCycles[i];
+        }
+        bool measured = mSampleInterval != 0;
+        const char* unit = timeUnit();
+
+        output << "Profile:\n"
+            << "Instructions executed: " << total << "\n";
+        if (measured)
+        {
+            output << "Estimated " << unit << ": " << totalCycles
+                << " (sampled every " << mSampleInterval << " instructions)\n";
+        }
+
+        // Executions per op code, most frequent first
+        std::vector<int> opCodes;
+        for (int op = 0; op < PROFILER_OP_CODE_COUNT; ++op)
+        {
+            if (mOpCodeExecutions[op] != 0)
+            {
+                opCodes.push_back(op);
+            }
+        }
+        std::stable_sort(opCodes.begin(), opCodes.end(), [this](int a, int b)
+            {
+                return mOpCodeExecutions[a] > mOpCodeExecutions[b];
+            });
+
+        output << "\nOP        Count       %\n";
+        for (int op : opCodes)
+        {
+            output << std::setw(10) << std::left << InstructionTypeLookupTable[op]
+                << std::setw(12) << std::left << mOpCodeExecutions[op]
+                << std::fixed << std::setprecision(1) << percent(mOpCodeExecutions[op], total) << "\n";
+        }
+
+        // Hottest instructions
+        std::vector<int> order(codeLength);
+        for (int i = 0; i < codeLength; ++i)
+        {
+            order[i] = i;
+        }
+        std::stable_sort(order.begin(), order.end(), [this, measured](int a, int b)
+            {
+                return measured ? mCycles[a] > mCycles[b] : mExecutions[a] > mExecutions[b];
+            });
+
+        output << "\nHot Spots:\n"
+            << "Line       OP        R    L    M        Source  Count       %";
+        if (measured)
+        {
+            output << "      " << unit;
+        }
+        output << "\n";
+        for (int n = 0; n < codeLength && n < PROFILER_HOT_SPOT_COUNT; ++n)
+        {
+            int i = order[n];
+            if (mExecutions[i] == 0)
+            {
+                break;
+            }
+            output << std::setw(11) << std::left << i
+                << std::setw(10) << std::left << InstructionTypeLookupTable[opCodeSlot(code[i].mOpCode)]
+                << std::setw(5) << std::left << code[i].mRegister
+                << std::setw(5) << std::left << code[i].mLexLevelOrReg
+                << std::setw(9) << std::left << code[i].mMOperand
+                << std::setw(8) << std::left << codeLines[i]
+                << std::setw(12) << std::left << mExecutions[i]
+                << std::setw(6) << std::left << std::fixed << std::setprecision(1) << percent(mExecutions[i], total);
+            if (measured)
+            {
+                output << " " << mCycles[i];
+            }
+            output << "\n";
+        }
+
+        // Executions and cost per source line
+        std::map<int, std::pair<std::uint64_t, std::uint64_t>> lines;
+        for (int i = 0; i < codeLength; ++i)
+        {
+            auto& line = lines[codeLines[i]];
+            line.first += mExecutions[i];
+            line.second += mCycles[i];
+        }
+        std::vector<std::string> sourceLines = splitLines(source);
+
+        output << "\nSource Lines:\n"
+            << "Source  Count       %     ";
+        if (measured)
+        {
+            output << std::setw(12) << std::left << unit;
+        }
+        output << "Text\n";
+        for (const auto& line : lines)
+        {
+            if (line.second.first == 0)
+            {
+                continue;
+            }
+            output << std::setw(8) << std::left << line.first
+                << std::setw(12) << std::left << line.second.first
+                << std::setw(6) << std::left << std::fixed << std::setprecision(1) << percent(line.second.first, total);
+            if (measured)
+            {
+                output << std::setw(12) << std::left << line.second.second;
+            }
+            if (line.first > 0 && line.first <= static_cast<int>(sourceLines.size()))
+            {
+                output << sourceLines[line.first - 1];
+            }
+            output << "\n";
+        }
+    }
+
+private:
+    /** Slot opCode is counted in. Checked runs of unverified code get here before the op code is validated. */
+    static int opCodeSlot(InstructionType opCode)
+    {
+        return opCode >= LIT && opCode <= LAST_OP_CODE ? opCode : 0;
+    }
+
+    static std::uint64_t now()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return __rdtsc();
+#else
+        return std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::steady_clock::now().time_since_epoch()).count();
+#endif
+    }
+
+    static const char* timeUnit()
+    {
+#if defined(__x86_64__) || defined(__i386__)
+        return "cycles";
+#else
+        return "ns";
+#endif
+    }
+
+    static double percent(std::uint64_t part, std::uint64_t total)
+    {
+        return total == 0 ? 0.0 : 100.0 * part / total;
+    }
+
+    static std::vector<std::string> splitLines(const std::string& text)
+    {
+        std::vector<std::string> lines;
+        std::string::size_type start = 0;
+        while (start < text.size())
+        {
+            std::string::size_type end = text.find('\n', start);
+            if (end == std::string::npos)
+            {
+                end = text.size();
+            }
+            lines.push_back(text.substr(start, end - start));
+            start = end + 1;
+        }
+        return lines;
+    }
+
+    /** Executions per code index. */
+    std::vector<std::uint64_t> mExecutions;
+    /** Jumps taken per code index of a branch. */
+    std::vector<std::uint64_t> mTaken;
+    /** Measured cost per code index, scaled by the sample interval. */
+    std::vector<std::uint64_t> mCycles;
+    /** Executions per op code. */
+    std::uint64_t mOpCodeExecutions[PROFILER_OP_CODE_COUNT] = {};
+    int mSampleInterval;
+    /** Instructions left until the next measured one. */
+    int mNextSample;
+    /** Time stamp taken before the measured instruction executed. */
+    std::uint64_t mSampleStart = 0;
+};
+
+#endif // PROFILER_H
@@ -0,0 +1,287 @@
+#include "Program.h"
+
+#include "CompilationArena.h"
+#include "LaneMachine.h"
+#include "LexicalAnalyzer.h"
+#include "Optimizer.h"
+#include "ParserAndCodeGenerator.h"
+#include "VirtualMachine.h"
+
+#include <algorithm> // min()
+#include <sstream>
+#include <utility>
+
+static RunStatus runStatus(ExecutionStatus status)
+{
+    switch (status)
+    {
+        case ExecutionStatus::BudgetExhausted:
+            return RunStatus::InstructionLimit;
+        case ExecutionStatus::DeadlineExpired:
+            return RunStatus::TimedOut;
+        case ExecutionStatus::Fault:
+            return RunStatus::Fault;
+        default:
+            return RunStatus::Halted;
+    }
+}
+
+struct Execution::State
+{
+    State(const Program& program, const std::vector<int>& inputs)
+        : program(program)
+        , input(inputs)
+        , output(values, 0)
+        , vm(program.code().data(), static_cast<int>(program.code().size()), output, input,
+            program.verification())
+    {
+        vm.reset();
+    }
+
+    /** Keeps the code alive for as long as the machine runs it. */
+    Program program;
+    std::vector<int> values;
+    VectorInput input;
+    LimitedVectorSink output;
+    VirtualMachine vm;
+};
+
+Execution::Execution(std::unique_ptr<State> state)
+    : mState(std::move(state))
+{
+}
+
+Execution::Execution(Execution&&) noexcept = default;
+Execution& Execution::operator=(Execution&&) noexcept = default;
+Execution::~Execution() = default;
+
+ExecutionStatus Execution::resume(std::uint64_t budget)
+{
+    return mState->vm.resume(budget);
+}
+
+void Execution::setDeadline(std::chrono::steady_clock::time_point deadline)
+{
+    mState->vm.setDeadline(deadline);
+}
+
+bool Execution::finished() const
+{
+    return mState->vm.halted();
+}
+
+const std::vector<int>& Execution::output() const
+{
+    return mState->values;
+}
+
+std::uint64_t Execution::instructionsExecuted() const
+{
+    return mState->vm.instructionsExecuted();
+}
+
+Snapshot Execution::snapshot() const
+{
+    const std::vector<Instruction>& code = mState->program.code();
+    return Snapshot(code.data(), static_cast<int>(code.size()), mState->vm.saveState(),
+        mState->values, mState->input.remaining());
+}
+
+bool Execution::restore(const Snapshot& snapshot)
+{
+    if (snapshot.empty())
+    {
+        return false;
+    }
+    return restore(snapshot, snapshot.input());
+}
+
+bool Execution::restore(const Snapshot& snapshot, std::vector<int> inputs)
+{
+    const std::vector<Instruction>& code = mState->program.code();
+    if (!snapshot.matches(code.data(), static_cast<int>(code.size()))
+        || !mState->vm.loadState(snapshot.machine()))
+    {
+        return false;
+    }
+
+    mState->values = snapshot.output();
+    mState->input.reset(std::move(inputs));
+    return true;
+}
+
+Program::Program(std::shared_ptr<const Compiled> compiled)
+    : mCompiled(std::move(compiled))
+{
+}
+
+bool Program::valid() const
+{
+    return mCompiled->valid;
+}
+
+const std::string& Program::diagnostics() const
+{
+    return mCompiled->diagnostics;
+}
+
+const std::vector<Instruction>& Program::code() const
+{
+    return mCompiled->code;
+}
+
+const std::vector<int>& Program::codeLines() const
+{
+    return mCompiled->codeLines;
+}
+
+const Verification& Program::verification() const
+{
+    return mCompiled->verification;
+}
+
+Result Program::run(const std::vector<int>& inputs, const Limits& limits) const
+{
+    return run(inputs, limits, nullptr);
+}
+
+Result Program::run(const std::vector<int>& inputs, ExecutionProfile& profile, const Limits& limits) const
+{
+    const std::vector<Instruction>& code = mCompiled->code;
+    Profiler profiler(static_cast<int>(code.size()));
+    Result result = run(inputs, limits, &profiler);
+    if (mCompiled->valid)
+    {
+        ExecutionProfile recorded(code.data(), static_cast<int>(code.size()), profiler);
+        if (!profile.merge(recorded))
+        {
+            profile = std::move(recorded);
+        }
+    }
+    return result;
+}
+
+Result Program::run(const std::vector<int>& inputs, const Limits& limits, Profiler* profiler) const
+{
+    Result result;
+    LimitedVectorSink output(result.output, limits.maxOutputValues);
+    VectorInput input(inputs);
+
+    if (!mCompiled->valid)
+    {
+        result.status = RunStatus::InvalidProgram;
+        return result;
+    }
+
+    const std::vector<Instruction>& code = mCompiled->code;
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), output, input, mCompiled->verification);
+    vm.setProfiler(profiler);
+    result.status = runLimited(vm, limits);
+    result.outputTruncated = output.truncated();
+    result.instructionsExecuted = vm.instructionsExecuted();
+    return result;
+}
+
+RunStatus Program::run(OutputSink& output, InputSource& input, const Limits& limits) const
+{
+    if (!mCompiled->valid)
+    {
+        return RunStatus::InvalidProgram;
+    }
+
+    const std::vector<Instruction>& code = mCompiled->code;
+    VirtualMachine vm(code.data(), static_cast<int>(code.size()), output, input, mCompiled->verification);
+    return runLimited(vm, limits);
+}
+
+std::vector<Result> Program::runAll(const std::vector<std::vector<int>>& inputSets, const Limits& limits) const
+{
+    std::vector<Result> results(inputSets.size());
+    if (!mCompiled->valid || !mCompiled->verification.verified)
+    {
+        // Only verified code can run in lanes
+        for (std::size_t index = 0; index < inputSets.size(); ++index)
+        {
+            results[index] = run(inputSets[index], limits);
+        }
+        return results;
+    }
+
+    const std::vector<Instruction>& code = mCompiled->code;
+    LaneMachine machine(code.data(), static_cast<int>(code.size()), mCompiled->verification);
+    for (std::size_t first = 0; first < inputSets.size(); first += LANE_COUNT)
+    {
+        int laneCount = static_cast<int>(std::min<std::size_t>(LANE_COUNT, inputSets.size() - first));
+        std::vector<LimitedVectorSink> outputs;
+        std::vector<VectorInput> inputs;
+        OutputSink* outputSinks[LANE_COUNT];
+        InputSource* inputSources[LANE_COUNT];
+        outputs.reserve(laneCount);
+        inputs.reserve(laneCount);
+        for (int lane = 0; lane < laneCount; ++lane)
+        {
+            outputs.emplace_back(results[first + lane].output, limits.maxOutputValues);
+            inputs.emplace_back(inputSets[first + lane]);
+            outputSinks[lane] = &outputs[lane];
+            inputSources[lane] = &inputs[lane];
+        }
+
+        if (limits.timeout != std::chrono::nanoseconds::zero())
+        {
+            machine.setDeadline(std::chrono::steady_clock::now() + limits.timeout);
+        }
+        machine.run(laneCount, outputSinks, inputSources, limits.maxInstructions);
+
+        for (int lane = 0; lane < laneCount; ++lane)
+        {
+            Result& result = results[first + lane];
+            result.status = runStatus(machine.status(lane));
+            result.outputTruncated = outputs[lane].truncated();
+            result.instructionsExecuted = machine.instructionsExecuted(lane);
+        }
+    }
+    return results;
+}
+
+Execution Program::start(const std::vector<int>& inputs) const
+{
+    return Execution(std::make_unique<Execution::State>(*this, inputs));
+}
+
+RunStatus Program::runLimited(VirtualMachine& vm, const Limits& limits)
+{
+    if (limits.timeout != std::chrono::nanoseconds::zero())
+    {
+        vm.setDeadline(std::chrono::steady_clock::now() + limits.timeout);
+    }
+
+    vm.reset();
+    return runStatus(vm.resume(limits.maxInstructions));
+}
+
+Program compile(const std::string& source, const CompileOptions& options)
+{
+    auto compiled = std::make_shared<Program::Compiled>();
+
+    std::stringstream input(source);
+    std::stringstream diagnostics;
+    std::vector<Lexeme> lexemeTable;
+    bool lexicallyCorrect = analyzeCode(input, diagnostics, lexemeTable);
+    diagnostics << "\n\n\n";
+
+    CompilationArena arena;
+    compiled->valid = parseAndGenerage(lexemeTable, diagnostics, compiled->code, compiled->codeLines,
+        arena.resource()) && lexicallyCorrect;
+    arena.release();
+    if (compiled->valid && options.optimize)
+    {
+        OptimizationStats stats = optimizeCode(compiled->code, compiled->codeLines, options.profile);
+        diagnostics << "\n\nOptimized Code (" << stats.instructionsBefore << " -> " << stats.instructionsAfter
+            << " instructions):\n";
+        printCode(diagnostics, compiled->code);
+    }
+    compiled->diagnostics = diagnostics.str();
+    compiled->verification = verifyCode(compiled->code.data(), static_cast<int>(compiled->code.size()));
+
+    return Program(std::move(compiled));
+}
@@ -0,0 +1,223 @@
+#ifndef PROGRAM_H
+#define PROGRAM_H
+
+#include "ExecutionProfile.h"
+#include "InputSource.h"
+#include "Instruction.h"
+#include "OutputSink.h"
+#include "Snapshot.h"
+#include "Verifier.h"
+#include "VirtualMachine.h"
+
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <vector>
+
+/** Limits applied to a single run of a program. */
+struct Limits
+{
+    /** Stop capturing output after this many values. 0 captures everything. */
+    std::size_t maxOutputValues = 0;
+
+    /**
+     * Stop the program after about this many instructions. 0 runs until the
+     * program halts. The limit is checked at loop back edges and calls, so a
+     * program may run past it by up to the length of its code.
+     */
+    std::uint64_t maxInstructions = 0;
+
+    /** Stop the program once it ran for this long. 0 allows any amount of time. */
+    std::chrono::nanoseconds timeout = std::chrono::nanoseconds::zero();
+};
+
+/** How a run of a program ended. */
+enum class RunStatus : int
+{
+    Halted,             // The program ran to completion
+    InvalidProgram,     // The program did not compile and was not run
+    InstructionLimit,   // Stopped after Limits::maxInstructions
+    TimedOut,           // Stopped after Limits::timeout
+    Fault               // Divided by zero, or code that could not be verified went out of bounds
+};
+
+/** Outcome of a single run of a program. */
+struct Result
+{
+    RunStatus status = RunStatus::Halted;
+    /** Values written by the program, in order. */
+    std::vector<int> output;
+    /** Set if the program wrote more values than Limits::maxOutputValues allowed. */
+    bool outputTruncated = false;
+    /** Number of instructions the program executed. */
+    std::uint64_t instructionsExecuted = 0;
+};
+
+/** How compile() translates a program. */
+struct CompileOptions
+{
+    /** Run optimizeCode() over the generated code and list the result in the diagnostics. */
+    bool optimize = false;
+
+    /**
+     * Profile of runs of the unoptimized code for optimizeCode() to lay out
+     * the code by and to choose superinstructions with. Must stay valid while
+     * compile() runs. Ignored if it was recorded for other code.
+     */
+    const ExecutionProfile* profile = nullptr;
+};
+
+class Program;
+
+/**
+ * A run of a program that can be suspended and resumed, started with
+ * Program::start(). Lets a caller interleave many programs on one thread
+ * by giving each an instruction budget at a time.
+ */
+class Execution
+{
+public:
+    Execution(Execution&&) noexcept;
+    Execution& operator=(Execution&&) noexcept;
+    ~Execution();
+
+    /**
+     * Continue running the program where it stopped.
+     * @param budget Number of instructions to execute before suspending again.
+     *     Zero runs until the program halts or the deadline passes.
+     * @return Why the program stopped. Halted once it ran to completion.
+     */
+    ExecutionStatus resume(std::uint64_t budget = 0);
+
+    /** Suspend the program once the deadline has passed. */
+    void setDeadline(std::chrono::steady_clock::time_point deadline);
+
+    /** Returns if the program ran to completion. */
+    bool finished() const;
+
+    /** Values written by the program so far, in order. */
+    const std::vector<int>& output() const;
+
+    /** Number of instructions executed so far. */
+    std::uint64_t instructionsExecuted() const;
+
+    /** Checkpoint the run: machine state, output so far and input not read yet. */
+    Snapshot snapshot() const;
+
+    /**
+     * Continue from a checkpoint taken from a run of the same program,
+     * possibly in another process.
+     * @return false if the snapshot is empty, belongs to other code or is damaged
+     */
+    bool restore(const Snapshot& snapshot);
+
+    /**
+     * Continue from a checkpoint but feed the read statements inputs instead
+     * of the input left in the snapshot. Forks runs from a common prefix.
+     * @return false if the snapshot is empty, belongs to other code or is damaged
+     */
+    bool restore(const Snapshot& snapshot, std::vector<int> inputs);
+
+private:
+    friend class Program;
+
+    /** Machine, input and output of the run. Kept on the heap so the machine does not move. */
+    struct State;
+
+    explicit Execution(std::unique_ptr<State> state);
+
+    std::unique_ptr<State> mState;
+};
+
+/**
+ * A compiled PL/0 program.
+ *
+ * The generated code is immutable and shared between copies of the program,
+ * so one program can be run any number of times, from any number of threads
+ * at once. Every run gets its own stack and registers.
+ */
+class Program
+{
+public:
+    /** Returns if the program compiled without errors and can be run. */
+    bool valid() const;
+
+    /** Source listing, lexeme table, generated code and errors printed while compiling. */
+    const std::string& diagnostics() const;
+
+    /** The generated code. */
+    const std::vector<Instruction>& code() const;
+
+    /** Source line each instruction was generated for, starting at 1. */
+    const std::vector<int>& codeLines() const;
+
+    /** What the verifier proved about the code. Verified code runs without runtime checks. */
+    const Verification& verification() const;
+
+    /**
+     * Run the program feeding it inputs for its read statements.
+     * Reads past the end of inputs read 0.
+     */
+    Result run(const std::vector<int>& inputs, const Limits& limits = Limits()) const;
+
+    /**
+     * Run the program like run() and add how often each instruction executed
+     * and each branch jumped to profile, for CompileOptions::profile. A profile
+     * of other code is replaced. Counts are only taken when the library is
+     * built with PMACHINE_PROFILING.
+     */
+    Result run(const std::vector<int>& inputs, ExecutionProfile& profile, const Limits& limits = Limits()) const;
+
+    /**
+     * Run the program against caller provided input and output.
+     * Limits::maxOutputValues is up to output to enforce.
+     */
+    RunStatus run(OutputSink& output, InputSource& input, const Limits& limits = Limits()) const;
+
+    /**
+     * Run the program once for each set of inputs, with the same results as
+     * run() for each of them. Verified code runs LANE_COUNT sets at a time on
+     * a LaneMachine, which decodes every instruction once for all of the sets
+     * that take the same path. Limits apply to each run on its own.
+     */
+    std::vector<Result> runAll(const std::vector<std::vector<int>>& inputSets, const Limits& limits = Limits()) const;
+
+    /**
+     * Start a run that executes nothing until Execution::resume() is called.
+     * Reads past the end of inputs read 0. The program must be valid.
+     */
+    Execution start(const std::vector<int>& inputs) const;
+
+private:
+    friend Program compile(const std::string& source, const CompileOptions& options);
+
+    /** Everything produced by the compiler. Never changes once compiled. */
+    struct Compiled
+    {
+        bool valid = false;
+        std::string diagnostics;
+        std::vector<Instruction> code;
+        std::vector<int> codeLines;
+        Verification verification;
+    };
+
+    explicit Program(std::shared_ptr<const Compiled> compiled);
+
+    /** Run the program counting executed instructions in profiler, unless it is nullptr. */
+    Result run(const std::vector<int>& inputs, const Limits& limits, Profiler* profiler) const;
+
+    /** Run vm from the start within limits. */
+    static RunStatus runLimited(VirtualMachine& vm, const Limits& limits);
+
+    std::shared_ptr<const Compiled> mCompiled;
+};
+
+/**
+ * Compile PL/0 source code into a program.
+ * Check Program::valid() and Program::diagnostics() for errors.
+ */
+Program compile(const std::string& source, const CompileOptions& options = CompileOptions());
+
+#endif // PROGRAM_H
@@ -0,0 +1,331 @@
+#include "Scheduler.h"
+
+#include "VirtualMachine.h"
+
+#include <algorithm>
+#include <chrono>
+#include <utility>
+
+/**
+ * One run of a program. Also the input source of its own machine, so that
+ * reads past the values provided so far can park the instance.
+ */
+struct Scheduler::Instance : public InputSource
+{
+    Instance(const Program& program, std::vector<int> inputs, const Limits& limits, bool moreInput)
+        : program(program)
+        , pending(inputs.begin(), inputs.end())
+        , inputClosed(!moreInput)
+        , limits(limits)
+        , output(result.output, limits.maxOutputValues)
+        , vm(program.code().data(), static_cast<int>(program.code().size()), output, *this,
+            program.verification())
+    {
+    }
+
+    bool read(int& value) override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        if (pending.empty())
+        {
+            return false;
+        }
+        value = pending.front();
+        pending.pop_front();
+        return true;
+    }
+
+    bool ready() override
+    {
+        std::lock_guard<std::mutex> lock(mutex);
+        return !pending.empty() || inputClosed;
+    }
+
+    /** Keeps the code alive for as long as the machine runs it. */
+    Program program;
+
+    /** Guards pending, inputClosed and parked. */
+    std::mutex mutex;
+    std::deque<int> pending;
+    bool inputClosed;
+    /** Set while waiting for input and in no worker queue. */
+    bool parked = false;
+
+    Limits limits;
+    Result result;
+    LimitedVectorSink output;
+    VirtualMachine vm;
+    std::atomic<bool> done{false};
+};
+
+Scheduler::Scheduler(int workerCount, std::uint64_t quantum)
+    : mQuantum(quantum)
+{
+    if (workerCount <= 0)
+    {
+        workerCount = std::max(1, static_cast<int>(std::thread::hardware_concurrency()));
+    }
+
+    // Every queue has to exist before any worker starts stealing
+    for (int i = 0; i < workerCount; ++i)
+    {
+        mWorkers.push_back(std::make_unique<Worker>());
+    }
+    for (std::size_t i = 0; i < mWorkers.size(); ++i)
+    {
+        mWorkers[i]->thread = std::thread(&Scheduler::workerLoop, this, i);
+    }
+}
+
+Scheduler::~Scheduler()
+{
+    {
+        std::lock_guard<std::mutex> lock(mSleepMutex);
+        mStopping = true;
+    }
+    mWorkAvailable.notify_all();
+
+    for (auto& worker : mWorkers)
+    {
+        worker->thread.join();
+    }
+}
+
+Scheduler::InstanceId Scheduler::submit(const Program& program, std::vector<int> inputs, const Limits& limits,
+    bool moreInput)
+{
+    auto owned = std::make_unique<Instance>(program, std::move(inputs), limits, moreInput);
+    Instance* instance = owned.get();
+    InstanceId id;
+    {
+        std::lock_guard<std::mutex> lock(mInstancesMutex);
+        id = mInstances.size();
+        mInstances.push_back(std::move(owned));
+    }
+
+    if (!program.valid())
+    {
+        instance->result.status = RunStatus::InvalidProgram;
+        instance->done.store(true, std::memory_order_release);
+        return id;
+    }
+
+    if (limits.timeout != std::chrono::nanoseconds::zero())
+    {
+        instance->vm.setDeadline(std::chrono::steady_clock::now() + limits.timeout);
+    }
+    instance->vm.reset();
+
+    {
+        std::lock_guard<std::mutex> lock(mDoneMutex);
+        ++mUnfinished;
+    }
+    schedule(instance, mNextWorker++ % mWorkers.size());
+    return id;
+}
+
+void Scheduler::provideInput(InstanceId id, int value)
+{
+    Instance* waiting = instance(id);
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(waiting->mutex);
+        waiting->pending.push_back(value);
+        wake = waiting->parked;
+        waiting->parked = false;
+    }
+
+    if (wake)
+    {
+        schedule(waiting, mNextWorker++ % mWorkers.size());
+    }
+}
+
+void Scheduler::closeInput(InstanceId id)
+{
+    Instance* waiting = instance(id);
+    bool wake;
+    {
+        std::lock_guard<std::mutex> lock(waiting->mutex);
+        waiting->inputClosed = true;
+        wake = waiting->parked;
+        waiting->parked = false;
+    }
+
+    if (wake)
+    {
+        schedule(waiting, mNextWorker++ % mWorkers.size());
+    }
+}
+
+void Scheduler::wait()
+{
+    std::unique_lock<std::mutex> lock(mDoneMutex);
+    mDone.wait(lock, [this]()
+        {
+            return mUnfinished == 0;
+        });
+}
+
+bool Scheduler::finished(InstanceId id) const
+{
+    return instance(id)->done.load(std::memory_order_acquire);
+}
+
+const Result& Scheduler::result(InstanceId id) const
+{
+    return instance(id)->result;
+}
+
+void Scheduler::release(InstanceId id)
+{
+    std::lock_guard<std::mutex> lock(mInstancesMutex);
+    mInstances[id].reset();
+}
+
+void Scheduler::schedule(Instance* instance, std::size_t worker)
+{
+    // Count before the instance is queued so a thief taking it never counts
+    // below 0, and queue it before waking anyone so a woken worker finds it.
+    ++mQueued;
+    {
+        std::lock_guard<std::mutex> lock(mWorkers[worker]->mutex);
+        mWorkers[worker]->queue.push_back(instance);
+    }
+
+    // A worker going to sleep counts itself in mSleeping before it looks at
+    // mQueued, and the count above comes before this look at mSleeping. Both
+    // are sequentially consistent, so either the worker sees the instance or
+    // it is seen here. Taking the sleep mutex then waits until it really
+    // waits, so the notification cannot get lost.
+    if (mSleeping > 0)
+    {
+        {
+            std::lock_guard<std::mutex> sleepLock(mSleepMutex);
+        }
+        mWorkAvailable.notify_one();
+    }
+}
+
+Scheduler::Instance* Scheduler::take(std::size_t worker)
+{
+    std::size_t workerCount = mWorkers.size();
+    for (std::size_t i = 0; i < workerCount; ++i)
+    {
+        Worker& victim = *mWorkers[(worker + i) % workerCount];
+        std::lock_guard<std::mutex> lock(victim.mutex);
+        if (victim.queue.empty())
+        {
+            continue;
+        }
+
+        // Run our own queue in order and steal from the far end of others
+        Instance* instance;
+        if (i == 0)
+        {
+            instance = victim.queue.front();
+            victim.queue.pop_front();
+        }
+        else
+        {
+            instance = victim.queue.back();
+            victim.queue.pop_back();
+        }
+        --mQueued;
+        return instance;
+    }
+    return nullptr;
+}
+
+void Scheduler::runSlice(Instance* instance, std::size_t worker)
+{
+    std::uint64_t budget = mQuantum;
+    std::uint64_t maxInstructions = instance->limits.maxInstructions;
+    if (maxInstructions != 0)
+    {
+        std::uint64_t executed = instance->vm.instructionsExecuted();
+        if (executed >= maxInstructions)
+        {
+            finish(instance, RunStatus::InstructionLimit);
+            return;
+        }
+        budget = std::min(budget, maxInstructions - executed);
+    }
+
+    switch (instance->vm.resume(budget))
+    {
+        case ExecutionStatus::BudgetExhausted:
+            // Back of the line
+            schedule(instance, worker);
+            break;
+        case ExecutionStatus::WaitingForInput:
+        {
+            // Input may have arrived since the machine looked
+            bool ready;
+            {
+                std::lock_guard<std::mutex> lock(instance->mutex);
+                ready = !instance->pending.empty() || instance->inputClosed;
+                instance->parked = !ready;
+            }
+            if (ready)
+            {
+                schedule(instance, worker);
+            }
+            break;
+        }
+        case ExecutionStatus::DeadlineExpired:
+            finish(instance, RunStatus::TimedOut);
+            break;
+        case ExecutionStatus::Fault:
+            finish(instance, RunStatus::Fault);
+            break;
+        default:
+            finish(instance, RunStatus::Halted);
+            break;
+    }
+}
+
+void Scheduler::finish(Instance* instance, RunStatus status)
+{
+    instance->result.status = status;
+    instance->result.outputTruncated = instance->output.truncated();
+    instance->result.instructionsExecuted = instance->vm.instructionsExecuted();
+    instance->done.store(true, std::memory_order_release);
+
+    {
+        std::lock_guard<std::mutex> lock(mDoneMutex);
+        --mUnfinished;
+    }
+    mDone.notify_all();
+}
+
+void Scheduler::workerLoop(std::size_t worker)
+{
+    while (true)
+    {
+        Instance* instance = take(worker);
+        if (instance != nullptr)
+        {
+            runSlice(instance, worker);
+            continue;
+        }
+
+        std::unique_lock<std::mutex> lock(mSleepMutex);
+        ++mSleeping;
+        mWorkAvailable.wait(lock, [this]()
+            {
+                return mStopping || mQueued > 0;
+            });
+        --mSleeping;
+        if (mStopping)
+        {
+            return;
+        }
+    }
+}
+
+Scheduler::Instance* Scheduler::instance(InstanceId id) const
+{
+    std::lock_guard<std::mutex> lock(mInstancesMutex);
+    return mInstances[id].get();
+}
@@ -0,0 +1,132 @@
+#ifndef SCHEDULER_H
+#define SCHEDULER_H
+
+#include "Program.h"
+
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+/** Instructions an instance may execute before it has to give up its worker. */
+const std::uint64_t SCHEDULER_QUANTUM = 10000;
+
+/**
+ * Runs large numbers of program instances on a fixed pool of worker threads.
+ *
+ * Every instance is a virtual machine of its own, around 8 KiB plus its captured
+ * output, so thousands of them fit in little memory. Workers run an instance
+ * for one quantum of instructions and then move on to the next one in their
+ * queue. A worker with an empty queue steals instances from the other workers.
+ *
+ * An instance that reads input nobody provided yet is parked instead of
+ * blocking its worker, and is queued again by provideInput() or closeInput().
+ */
+class Scheduler
+{
+public:
+    /** Handle of a submitted instance. */
+    using InstanceId = std::size_t;
+
+    /**
+     * @param workerCount Number of worker threads. 0 uses one per hardware thread.
+     * @param quantum Instructions an instance runs before the worker moves on
+     */
+    explicit Scheduler(int workerCount = 0, std::uint64_t quantum = SCHEDULER_QUANTUM);
+
+    /**
+     * Stops the workers once their current slice is done. Instances that did
+     * not finish are abandoned, so call wait() first to let them complete.
+     */
+    ~Scheduler();
+
+    Scheduler(const Scheduler&) = delete;
+    Scheduler& operator=(const Scheduler&) = delete;
+
+    /**
+     * Queue a run of program.
+     * @param inputs Values for the read statements
+     * @param limits Output, instruction and time limits for the run
+     * @param moreInput When set, reads past the end of inputs wait for
+     *     provideInput() or closeInput() instead of reading 0.
+     */
+    InstanceId submit(const Program& program, std::vector<int> inputs = {}, const Limits& limits = Limits(),
+        bool moreInput = false);
+
+    /** Hand a value to the next read statement of instance id. */
+    void provideInput(InstanceId id, int value);
+
+    /** No more input for instance id. Reads past the end of its input read 0. */
+    void closeInput(InstanceId id);
+
+    /**
+     * Wait until every submitted instance finished. Instances waiting for
+     * input that never comes keep this from returning.
+     */
+    void wait();
+
+    /** Returns if instance id finished. */
+    bool finished(InstanceId id) const;
+
+    /** Outcome of instance id. Only valid once it finished. */
+    const Result& result(InstanceId id) const;
+
+    /** Free the memory of finished instance id. The id must not be used afterwards. */
+    void release(InstanceId id);
+
+private:
+    struct Instance;
+
+    /** Queue of runnable instances owned by one worker. */
+    struct Worker
+    {
+        std::mutex mutex;
+        std::deque<Instance*> queue;
+        std::thread thread;
+    };
+
+    /** Queue instance on worker. */
+    void schedule(Instance* instance, std::size_t worker);
+
+    /** Take the next instance from worker, or steal one from another worker. */
+    Instance* take(std::size_t worker);
+
+    /** Run one quantum of instance on worker. */
+    void runSlice(Instance* instance, std::size_t worker);
+
+    void finish(Instance* instance, RunStatus status);
+
+    void workerLoop(std::size_t worker);
+
+    Instance* instance(InstanceId id) const;
+
+    std::uint64_t mQuantum;
+    std::vector<std::unique_ptr<Worker>> mWorkers;
+
+    /** Every submitted instance, indexed by id. */
+    mutable std::mutex mInstancesMutex;
+    std::deque<std::unique_ptr<Instance>> mInstances;
+
+    /** Instances sitting in a worker queue. Workers sleep while it is 0. */
+    std::atomic<std::size_t> mQueued{0};
+    /** Workers waiting for work. schedule() only wakes workers while it is not 0. */
+    std::atomic<std::size_t> mSleeping{0};
+    std::mutex mSleepMutex;
+    std::condition_variable mWorkAvailable;
+    bool mStopping = false;
+
+    /** Instances that did not finish yet. */
+    std::size_t mUnfinished = 0;
+    std::mutex mDoneMutex;
+    std::condition_variable mDone;
+
+    /** Worker new instances are queued on, rotating to spread them out. */
+    std::atomic<std::size_t> mNextWorker{0};
+};
+
+#endif // SCHEDULER_H
@@ -0,0 +1,147 @@
+#include "Snapshot.h"
+
+#include <algorithm>
+#include <cstring> // memcmp()
+#include <utility>
+
+/** Values read at a time, so a corrupt count fails at the end of the input instead of allocating it all. */
+const std::size_t SNAPSHOT_READ_BLOCK = 4096;
+
+std::uint64_t codeFingerprint(const Instruction* code, int codeLength)
+{
+    std::uint64_t hash = 14695981039346656037ULL;
+    auto mix = [&hash](int value)
+    {
+        for (int i = 0; i < 4; ++i)
+        {
+            hash ^= static_cast<unsigned char>(value >> (8 * i));
+            hash *= 1099511628211ULL;
+        }
+    };
+
+    for (int i = 0; i < codeLength; ++i)
+    {
+        mix(code[i].mOpCode);
+        mix(code[i].mRegister);
+        mix(code[i].mLexLevelOrReg);
+        mix(code[i].mMOperand);
+    }
+    return hash;
+}
+
+template <typename T>
+static void writeSnapshotValue(std::ostream& output, T value)
+{
+    output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+}
+
+template <typename T>
+static bool readSnapshotValue(std::istream& input, T& value)
+{
+    return static_cast<bool>(input.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+static void writeSnapshotValues(std::ostream& output, const std::vector<int>& values)
+{
+    writeSnapshotValue(output, static_cast<std::uint32_t>(values.size()));
+    output.write(reinterpret_cast<const char*>(values.data()), values.size() * sizeof(int));
+}
+
+static bool readSnapshotValues(std::istream& input, std::vector<int>& values)
+{
+    std::uint32_t count;
+    if (!readSnapshotValue(input, count))
+    {
+        return false;
+    }
+
+    values.clear();
+    while (values.size() < count)
+    {
+        std::size_t start = values.size();
+        values.resize(start + std::min<std::size_t>(count - start, SNAPSHOT_READ_BLOCK));
+        std::size_t bytes = (values.size() - start) * sizeof(int);
+        if (!input.read(reinterpret_cast<char*>(values.data() + start), bytes))
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+Snapshot::Snapshot(const Instruction* code, int codeLength, MachineState machine,
+    std::vector<int> output, std::vector<int> input)
+{
+    auto data = std::make_shared<Data>();
+    data->codeLength = static_cast<std::uint32_t>(codeLength);
+    data->codeFingerprint = codeFingerprint(code, codeLength);
+    data->machine = std::move(machine);
+    data->output = std::move(output);
+    data->input = std::move(input);
+    mData = std::move(data);
+}
+
+bool Snapshot::matches(const Instruction* code, int codeLength) const
+{
+    return mData != nullptr
+        && mData->codeLength == static_cast<std::uint32_t>(codeLength)
+        && mData->codeFingerprint == codeFingerprint(code, codeLength);
+}
+
+void Snapshot::save(std::ostream& output) const
+{
+    if (empty())
+    {
+        output.setstate(std::ios::failbit);
+        return;
+    }
+
+    output.write(SNAPSHOT_MAGIC, sizeof(SNAPSHOT_MAGIC));
+    writeSnapshotValue(output, mData->codeLength);
+    writeSnapshotValue(output, mData->codeFingerprint);
+
+    const MachineState& machine = mData->machine;
+    writeSnapshotValue(output, machine.pc);
+    writeSnapshotValue(output, machine.bp);
+    writeSnapshotValue(output, machine.sp);
+    writeSnapshotValue(output, static_cast<std::uint8_t>(machine.halted));
+    writeSnapshotValue(output, machine.instructionsExecuted);
+    output.write(reinterpret_cast<const char*>(machine.registers), sizeof(machine.registers));
+    writeSnapshotValues(output, machine.stack);
+
+    writeSnapshotValues(output, mData->output);
+    writeSnapshotValues(output, mData->input);
+}
+
+bool Snapshot::load(std::istream& input, Snapshot& snapshot)
+{
+    char magic[sizeof(SNAPSHOT_MAGIC)];
+    if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, SNAPSHOT_MAGIC, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    auto data = std::make_shared<Data>();
+    MachineState& machine = data->machine;
+    std::uint8_t halted = 0;
+    bool valid = readSnapshotValue(input, data->codeLength)
+        && readSnapshotValue(input, data->codeFingerprint)
+        && readSnapshotValue(input, machine.pc)
+        && readSnapshotValue(input, machine.bp)
+        && readSnapshotValue(input, machine.sp)
+        && readSnapshotValue(input, halted)
+        && readSnapshotValue(input, machine.instructionsExecuted)
+        && input.read(reinterpret_cast<char*>(machine.registers), sizeof(machine.registers))
+        && readSnapshotValues(input, machine.stack)
+        && machine.stack.size() <= static_cast<std::size_t>(MAX_STACK_HEIGHT)
+        && readSnapshotValues(input, data->output)
+        && readSnapshotValues(input, data->input);
+    if (!valid)
+    {
+        return false;
+    }
+    machine.halted = halted != 0;
+
+    snapshot.mData = std::move(data);
+    return true;
+}
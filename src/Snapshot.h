@@ -0,0 +1,85 @@
+#ifndef SNAPSHOT_H
+#define SNAPSHOT_H
+
+#include "Instruction.h"
+#include "VirtualMachine.h"
+
+#include <cstdint>
+#include <istream>
+#include <memory>
+#include <ostream>
+#include <vector>
+
+/** FNV-1a hash of every field of every instruction, telling apart code that differs. */
+std::uint64_t codeFingerprint(const Instruction* code, int codeLength);
+
+/** First bytes of every saved snapshot. */
+const char SNAPSHOT_MAGIC[4] = {'P', 'M', 'S', '1'};
+
+/**
+ * A checkpoint of a running program: the machine state, the output it wrote
+ * and the input it did not read yet.
+ *
+ * Snapshots never change once taken. Copies share the same data, so one
+ * snapshot can seed any number of runs without being copied itself. A
+ * snapshot remembers a fingerprint of the code it was taken from and can
+ * only be restored into a machine running the same code.
+ */
+class Snapshot
+{
+public:
+    /** An empty snapshot that cannot be restored. */
+    Snapshot() = default;
+
+    Snapshot(const Instruction* code, int codeLength, MachineState machine,
+        std::vector<int> output = {}, std::vector<int> input = {});
+
+    /** Returns if the snapshot holds no state. machine(), output() and input() must not be called then. */
+    bool empty() const
+    {
+        return mData == nullptr;
+    }
+
+    /** Returns if the snapshot was taken from a machine running code. */
+    bool matches(const Instruction* code, int codeLength) const;
+
+    const MachineState& machine() const
+    {
+        return mData->machine;
+    }
+
+    /** Values the program wrote before the snapshot was taken. */
+    const std::vector<int>& output() const
+    {
+        return mData->output;
+    }
+
+    /** Values left for the read statements of the program. */
+    const std::vector<int>& input() const
+    {
+        return mData->input;
+    }
+
+    /** Write the snapshot in its binary form. An empty snapshot writes nothing and fails output. */
+    void save(std::ostream& output) const;
+
+    /**
+     * Read a snapshot written by save().
+     * @return false if the input is not a valid snapshot
+     */
+    static bool load(std::istream& input, Snapshot& snapshot);
+
+private:
+    struct Data
+    {
+        std::uint32_t codeLength = 0;
+        std::uint64_t codeFingerprint = 0;
+        MachineState machine;
+        std::vector<int> output;
+        std::vector<int> input;
+    };
+
+    std::shared_ptr<const Data> mData;
+};
+
+#endif // SNAPSHOT_H
@@ -0,0 +1,133 @@
+#include "TokenStream.h"
+
+#include <utility>
+
+LexemeTableStream::LexemeTableStream(const std::vector<Lexeme>& lexemes)
+    : mLexemes(lexemes)
+    , mEnd{"", nulSym, 1}
+{
+    if (!lexemes.empty())
+    {
+        const Lexeme& last = lexemes.back();
+        mEnd.line = last.line;
+        mEnd.offset = last.offset + last.lexeme.size();
+        mEnd.column = last.column + static_cast<int>(last.lexeme.size());
+    }
+}
+
+const Lexeme* BufferedTokenStream::peek()
+{
+    if (mPosition < mProduced)
+    {
+        return &mRing[mPosition % TOKEN_RING_SIZE];
+    }
+
+    if (!mEnded)
+    {
+        Lexeme& lexeme = mRing[mProduced % TOKEN_RING_SIZE];
+        if (produce(lexeme))
+        {
+            ++mProduced;
+            mEnd.line = lexeme.line;
+            mEnd.offset = lexeme.offset + lexeme.lexeme.size();
+            mEnd.column = lexeme.column + static_cast<int>(lexeme.lexeme.size());
+            return &lexeme;
+        }
+        mEnded = true;
+    }
+    return &mEnd;
+}
+
+LexerTokenStream::LexerTokenStream(const std::string& source, std::ostream& errorStream)
+    : mLexer(source, errorStream)
+{
+}
+
+bool LexerTokenStream::finish()
+{
+    Lexeme lexeme;
+    while (mLexer.next(lexeme))
+    {
+    }
+    return !mLexer.errorFound();
+}
+
+bool LexerTokenStream::produce(Lexeme& lexeme)
+{
+    return mLexer.next(lexeme);
+}
+
+ThreadedLexerTokenStream::ThreadedLexerTokenStream(const std::string& source, std::ostream& errorStream)
+    : mSource(source)
+    , mErrorStream(errorStream)
+    , mQueue(TOKEN_QUEUE_SIZE)
+{
+    mThread = std::thread(&ThreadedLexerTokenStream::lex, this);
+}
+
+ThreadedLexerTokenStream::~ThreadedLexerTokenStream()
+{
+    if (mThread.joinable())
+    {
+        mCancelled.store(true, std::memory_order_relaxed);
+        mThread.join();
+    }
+}
+
+bool ThreadedLexerTokenStream::finish()
+{
+    if (mThread.joinable())
+    {
+        // Drain the queue so the lexer thread never waits for room
+        Lexeme lexeme;
+        while (produce(lexeme))
+        {
+        }
+        mThread.join();
+        mErrorStream << mErrors.str();
+    }
+    return !mErrorFound;
+}
+
+bool ThreadedLexerTokenStream::produce(Lexeme& lexeme)
+{
+    std::size_t head = mHead.load(std::memory_order_relaxed);
+    while (head == mTail.load(std::memory_order_acquire))
+    {
+        // The tail is loaded again after seeing the flag, since the last
+        // lexeme may have been queued in between
+        if (mLexed.load(std::memory_order_acquire) && head == mTail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        std::this_thread::yield();
+    }
+
+    lexeme = std::move(mQueue[head & (TOKEN_QUEUE_SIZE - 1)]);
+    mHead.store(head + 1, std::memory_order_release);
+    return true;
+}
+
+void ThreadedLexerTokenStream::lex()
+{
+    Lexer lexer(mSource, mErrors);
+    Lexeme lexeme;
+    while (!mCancelled.load(std::memory_order_relaxed) && lexer.next(lexeme))
+    {
+        std::size_t tail = mTail.load(std::memory_order_relaxed);
+        while (tail - mHead.load(std::memory_order_acquire) == TOKEN_QUEUE_SIZE)
+        {
+            if (mCancelled.load(std::memory_order_relaxed))
+            {
+                mLexed.store(true, std::memory_order_release);
+                return;
+            }
+            std::this_thread::yield();
+        }
+
+        mQueue[tail & (TOKEN_QUEUE_SIZE - 1)] = std::move(lexeme);
+        mTail.store(tail + 1, std::memory_order_release);
+    }
+    mErrorFound = lexer.errorFound();
+    mLexed.store(true, std::memory_order_release);
+}
@@ -0,0 +1,190 @@
+#ifndef TOKENSTREAM_H
+#define TOKENSTREAM_H
+
+#include "LexicalAnalyzer.h"
+#include "Tokens.h"
+
+#include <atomic>
+#include <cstddef>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+/** Number of lexemes a lexing stream keeps. Bounds how long a consumed lexeme stays valid. */
+const std::size_t TOKEN_RING_SIZE = 8;
+
+/** Lexemes a lexer thread can get ahead of the parser. Must be a power of two. */
+const std::size_t TOKEN_QUEUE_SIZE = 1024;
+
+/**
+ * Lexemes handed to the parser one at a time.
+ * Once the lexemes run out, a stream keeps returning an end of input lexeme
+ * of type nulSym with an empty lexeme, placed right after the last lexeme.
+ */
+class TokenStream
+{
+public:
+    virtual ~TokenStream() = default;
+
+    /** Consume the next lexeme. */
+    virtual const Lexeme* next() = 0;
+
+    /** Look at the next lexeme without consuming it. */
+    virtual const Lexeme* peek() = 0;
+
+    /** Index of the next lexeme. */
+    std::size_t position() const
+    {
+        return mPosition;
+    }
+
+protected:
+    std::size_t mPosition = 0;
+};
+
+/** Returns if lexeme is the end of input lexeme of a TokenStream. */
+inline bool isEndOfInput(const Lexeme& lexeme)
+{
+    return lexeme.lexeme.empty();
+}
+
+/** Stream over a lexeme table that was built up front. */
+class LexemeTableStream : public TokenStream
+{
+public:
+    /** @param lexemes Must outlive the stream */
+    explicit LexemeTableStream(const std::vector<Lexeme>& lexemes);
+
+    const Lexeme* next() override
+    {
+        const Lexeme* lexeme = peek();
+        ++mPosition;
+        return lexeme;
+    }
+
+    const Lexeme* peek() override
+    {
+        return mPosition < mLexemes.size() ? &mLexemes[mPosition] : &mEnd;
+    }
+
+    /** Continue at lexeme index position. */
+    void seek(std::size_t position)
+    {
+        mPosition = position;
+    }
+
+private:
+    const std::vector<Lexeme>& mLexemes;
+    Lexeme mEnd;
+};
+
+/**
+ * Stream that produces lexemes on demand into a small ring, so memory does not
+ * grow with the source. A lexeme stays valid until TOKEN_RING_SIZE - 1 more
+ * lexemes have been consumed.
+ */
+class BufferedTokenStream : public TokenStream
+{
+public:
+    const Lexeme* next() override
+    {
+        const Lexeme* lexeme = peek();
+        ++mPosition;
+        return lexeme;
+    }
+
+    const Lexeme* peek() override;
+
+protected:
+    /**
+     * Produce the next lexeme into lexeme.
+     * @return false at the end of input
+     */
+    virtual bool produce(Lexeme& lexeme) = 0;
+
+private:
+    Lexeme mRing[TOKEN_RING_SIZE];
+    /** Number of lexemes produced so far. */
+    std::size_t mProduced = 0;
+    bool mEnded = false;
+    Lexeme mEnd{"", nulSym, 1};
+};
+
+/** Stream that lexes the source as the parser asks for lexemes. */
+class LexerTokenStream : public BufferedTokenStream
+{
+public:
+    /**
+     * @param source Must outlive the stream
+     * @param errorStream Stream lexical errors are printed to as they are found
+     */
+    LexerTokenStream(const std::string& source, std::ostream& errorStream);
+
+    /**
+     * Lex the rest of the source so every lexical error gets printed.
+     * @return If no lexical errors were found
+     */
+    bool finish();
+
+protected:
+    bool produce(Lexeme& lexeme) override;
+
+private:
+    Lexer mLexer;
+};
+
+/**
+ * Stream fed by a lexer running on a thread of its own, so lexing overlaps with
+ * parsing. Lexemes are passed through a lock free single producer, single
+ * consumer queue of TOKEN_QUEUE_SIZE lexemes.
+ */
+class ThreadedLexerTokenStream : public BufferedTokenStream
+{
+public:
+    /**
+     * @param source Must outlive the stream
+     * @param errorStream Stream lexical errors are printed to by finish()
+     */
+    ThreadedLexerTokenStream(const std::string& source, std::ostream& errorStream);
+
+    /** Stops the lexer thread if finish() was not called. */
+    ~ThreadedLexerTokenStream() override;
+
+    ThreadedLexerTokenStream(const ThreadedLexerTokenStream&) = delete;
+    ThreadedLexerTokenStream& operator=(const ThreadedLexerTokenStream&) = delete;
+
+    /**
+     * Wait for the lexer thread to lex the rest of the source and print the
+     * lexical errors it found.
+     * @return If no lexical errors were found
+     */
+    bool finish();
+
+protected:
+    bool produce(Lexeme& lexeme) override;
+
+private:
+    /** Body of the lexer thread. */
+    void lex();
+
+    const std::string& mSource;
+    std::ostream& mErrorStream;
+    std::vector<Lexeme> mQueue;
+
+    /** Queue positions, each written by one side only. Kept on their own cache lines. */
+    alignas(64) std::atomic<std::size_t> mHead{0};
+    alignas(64) std::atomic<std::size_t> mTail{0};
+
+    /** Set by the lexer thread after its last lexeme. */
+    alignas(64) std::atomic<bool> mLexed{false};
+    std::atomic<bool> mCancelled{false};
+
+    /** Written by the lexer thread only, read once it is joined. */
+    std::stringstream mErrors;
+    bool mErrorFound = false;
+
+    std::thread mThread;
+};
+
+#endif // TOKENSTREAM_H
@@ -1,6 +1,9 @@
 #ifndef TOKENS_H
 #define TOKENS_H
 
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
 #include <string>
 #include <unordered_set>
 #include <unordered_map>
@@ -80,4 +83,42 @@ const std::unordered_set<token_type> relationOperator =
     geqSym
 };
 
+/** Set of token types held in a bit mask. Used for the FIRST and FOLLOW sets of the parser. */
+class TokenSet
+{
+public:
+    constexpr TokenSet(std::initializer_list<token_type> types)
+    {
+        for (token_type type : types)
+        {
+            mBits |= std::uint64_t(1) << type;
+        }
+    }
+
+    constexpr bool contains(token_type type) const
+    {
+        return (mBits >> type) & 1;
+    }
+
+    constexpr TokenSet operator|(TokenSet other) const
+    {
+        TokenSet result{};
+        result.mBits = mBits | other.mBits;
+        return result;
+    }
+
+private:
+    std::uint64_t mBits = 0;
+};
+
+/** A lexeme found in the source program along with its token type. */
+struct Lexeme
+{
+    std::string lexeme; /** Text of the lexeme as it appears in the source. */
+    token_type type;    /** Token type of the lexeme. */
+    int line;           /** Source line the lexeme was found on, starting at 1. */
+    std::size_t offset = 0; /** Byte offset of the first character of the lexeme in the source. */
+    int column = 1;         /** Byte column of the first character on its line, starting at 1. */
+};
+
 #endif // TOKENS_H
\ No newline at end of file
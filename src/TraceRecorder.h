@@ -0,0 +1,310 @@
+#ifndef TRACERECORDER_H
+#define TRACERECORDER_H
+
+#include "Instruction.h"
+
+#include <cstdint>
+#include <cstring> // memcpy()
+#include <fstream>
+#include <list>
+#include <ostream>
+#include <string>
+#include <vector>
+
+/****************************************************************************************
+    Binary execution trace format
+
+    Header:
+        char    magic[4]                "PMT1"
+        uint32  code length
+        int32   op, r, l, m             for every instruction in the code
+        int32   pc, bp, sp              machine state before the first recorded step
+        int32   registers[16]
+        uint32  stack height
+        int32   stack[stack height]
+
+    Followed by one record per executed instruction:
+        uint16  index of the executed instruction
+        uint8   op code
+        uint8   number of deltas
+        delta   { uint16 slot, int32 value } for every register, control register
+                or stack cell the instruction changed
+
+    The program counter is assumed to advance by one unless a TRACE_SLOT_PC delta
+    says otherwise. All values are stored in native byte order.
+*****************************************************************************************/
+
+/** Magic number at the start of every trace. */
+const char TRACE_MAGIC[4] = {'P', 'M', 'T', '1'};
+
+/** Number of registers captured in the trace. */
+const int TRACE_REGISTER_COUNT = 16;
+
+/** Delta slots 0 - 15 are the register file. */
+const std::uint16_t TRACE_SLOT_BP = 16;
+const std::uint16_t TRACE_SLOT_SP = 17;
+const std::uint16_t TRACE_SLOT_PC = 18;
+/** Stack cell i is stored in delta slot TRACE_SLOT_STACK + i. */
+const std::uint16_t TRACE_SLOT_STACK = 32;
+
+/** Size of the fixed part of a step record. */
+const std::size_t TRACE_RECORD_HEADER_SIZE = 4;
+/** Size of one delta in a step record. */
+const std::size_t TRACE_DELTA_SIZE = 6;
+/** Largest number of deltas a single instruction produces (CAL). */
+const std::size_t TRACE_MAX_DELTAS = 8;
+
+/** Recorded steps are collected in chunks of this many bytes. */
+const std::size_t TRACE_CHUNK_SIZE = 64 * 1024;
+
+/** Machine state that a trace is replayed against. */
+struct TraceState
+{
+    int pc = 0;
+    int bp = 1;
+    int sp = 0;
+    int registers[TRACE_REGISTER_COUNT] = {};
+    std::vector<int> stack;
+
+    /** Apply one delta to the state. */
+    void apply(std::uint16_t slot, int value)
+    {
+        if (slot < TRACE_REGISTER_COUNT)
+        {
+            registers[slot] = value;
+        }
+        else if (slot == TRACE_SLOT_BP)
+        {
+            bp = value;
+        }
+        else if (slot == TRACE_SLOT_SP)
+        {
+            sp = value;
+        }
+        else if (slot == TRACE_SLOT_PC)
+        {
+            pc = value;
+        }
+        else if (slot >= TRACE_SLOT_STACK && slot - TRACE_SLOT_STACK < static_cast<int>(stack.size()))
+        {
+            stack[slot - TRACE_SLOT_STACK] = value;
+        }
+    }
+
+    /**
+     * Apply the step record starting at record.
+     * @return The first byte after the record
+     */
+    const unsigned char* applyRecord(const unsigned char* record)
+    {
+        std::uint16_t executed;
+        std::memcpy(&executed, record, sizeof(executed));
+        std::uint8_t deltaCount = record[3];
+        record += TRACE_RECORD_HEADER_SIZE;
+
+        pc = executed + 1;
+        for (std::uint8_t i = 0; i < deltaCount; ++i)
+        {
+            std::uint16_t slot;
+            int value;
+            std::memcpy(&slot, record, sizeof(slot));
+            std::memcpy(&value, record + sizeof(slot), sizeof(value));
+            apply(slot, value);
+            record += TRACE_DELTA_SIZE;
+        }
+        return record;
+    }
+};
+
+/**
+ * Records the execution of the virtual machine as compact binary step records.
+ *
+ * Steps are either kept in memory, optionally as a ring holding only the most
+ * recent steps, or streamed to a file. The text trace the compiler used to print
+ * is rendered from a recording with renderTrace().
+ */
+class TraceRecorder
+{
+public:
+    /**
+     * Create an in memory recorder.
+     * @param maxBytes Keep at most roughly this many bytes of the most recent
+     *     steps. Zero keeps every step.
+     */
+    explicit TraceRecorder(std::size_t maxBytes = 0)
+        : mMaxChunks(maxBytes == 0 ? 0 : maxBytes / TRACE_CHUNK_SIZE + 1)
+    {
+    }
+
+    ~TraceRecorder()
+    {
+        finish();
+    }
+
+    TraceRecorder(const TraceRecorder&) = delete;
+    TraceRecorder& operator=(const TraceRecorder&) = delete;
+
+    /**
+     * Stream steps to a file instead of keeping them in memory.
+     * Must be called before begin().
+     * @return If the file could be opened
+     */
+    bool openFile(const std::string& fileName)
+    {
+        mFile.open(fileName, std::ios::binary);
+        return mFile.is_open();
+    }
+
+    /**
+     * Capture the code and machine state execution starts from.
+     */
+    void begin(const Instruction* code, int codeLength, int pc, int bp, int sp,
+        const int* registers, const int* stack, int stackHeight)
+    {
+        mCode.assign(code, code + codeLength);
+        mBase.pc = pc;
+        mBase.bp = bp;
+        mBase.sp = sp;
+        std::memcpy(mBase.registers, registers, sizeof(mBase.registers));
+        mBase.stack.assign(stack, stack + stackHeight);
+        mChunks.clear();
+        newChunk();
+
+        if (mFile.is_open())
+        {
+            writeHeader(mFile);
+        }
+    }
+
+    /** Start the record for the instruction at index executed. */
+    void beginStep(int executed, InstructionType opCode)
+    {
+        std::vector<unsigned char>& chunk = mChunks.back();
+        if (chunk.size() + TRACE_RECORD_HEADER_SIZE + TRACE_MAX_DELTAS * TRACE_DELTA_SIZE > TRACE_CHUNK_SIZE)
+        {
+            chunkFull();
+        }
+
+        std::vector<unsigned char>& current = mChunks.back();
+        mRecordStart = current.size();
+        std::uint16_t index = static_cast<std::uint16_t>(executed);
+        unsigned char header[TRACE_RECORD_HEADER_SIZE];
+        std::memcpy(header, &index, sizeof(index));
+        header[2] = static_cast<unsigned char>(opCode);
+        header[3] = 0;
+        current.insert(current.end(), header, header + TRACE_RECORD_HEADER_SIZE);
+    }
+
+    /** Add a changed register, control register or stack cell to the current step. */
+    void delta(std::uint16_t slot, int value)
+    {
+        std::vector<unsigned char>& current = mChunks.back();
+        unsigned char bytes[TRACE_DELTA_SIZE];
+        std::memcpy(bytes, &slot, sizeof(slot));
+        std::memcpy(bytes + sizeof(slot), &value, sizeof(value));
+        current.insert(current.end(), bytes, bytes + TRACE_DELTA_SIZE);
+        ++current[mRecordStart + 3];
+    }
+
+    /** Write any steps still buffered to the trace file. */
+    void finish()
+    {
+        if (mFile.is_open() && !mChunks.empty())
+        {
+            writeChunk(mFile, mChunks.back());
+            mChunks.back().clear();
+            mFile.close();
+        }
+    }
+
+    /** Write the recorded trace, header included, to output. */
+    void save(std::ostream& output) const
+    {
+        writeHeader(output);
+        for (const auto& chunk : mChunks)
+        {
+            writeChunk(output, chunk);
+        }
+    }
+
+private:
+    void newChunk()
+    {
+        mChunks.emplace_back();
+        mChunks.back().reserve(TRACE_CHUNK_SIZE);
+    }
+
+    /** Make room for the next step once the current chunk is full. */
+    void chunkFull()
+    {
+        if (mFile.is_open())
+        {
+            writeChunk(mFile, mChunks.back());
+            mChunks.back().clear();
+            return;
+        }
+
+        if (mMaxChunks != 0 && mChunks.size() >= mMaxChunks)
+        {
+            // Fold the oldest steps into the base state so the steps
+            // still held can be replayed on their own.
+            std::vector<unsigned char> oldest = std::move(mChunks.front());
+            mChunks.pop_front();
+            const unsigned char* record = oldest.data();
+            const unsigned char* end = record + oldest.size();
+            while (record != end)
+            {
+                record = mBase.applyRecord(record);
+            }
+            oldest.clear();
+            mChunks.push_back(std::move(oldest));
+            return;
+        }
+
+        newChunk();
+    }
+
+    void writeHeader(std::ostream& output) const
+    {
+        output.write(TRACE_MAGIC, sizeof(TRACE_MAGIC));
+        writeValue(output, static_cast<std::uint32_t>(mCode.size()));
+        for (const Instruction& instruction : mCode)
+        {
+            writeValue(output, static_cast<int>(instruction.mOpCode));
+            writeValue(output, instruction.mRegister);
+            writeValue(output, instruction.mLexLevelOrReg);
+            writeValue(output, instruction.mMOperand);
+        }
+        writeValue(output, mBase.pc);
+        writeValue(output, mBase.bp);
+        writeValue(output, mBase.sp);
+        output.write(reinterpret_cast<const char*>(mBase.registers), sizeof(mBase.registers));
+        writeValue(output, static_cast<std::uint32_t>(mBase.stack.size()));
+        output.write(reinterpret_cast<const char*>(mBase.stack.data()), mBase.stack.size() * sizeof(int));
+    }
+
+    static void writeChunk(std::ostream& output, const std::vector<unsigned char>& chunk)
+    {
+        output.write(reinterpret_cast<const char*>(chunk.data()), chunk.size());
+    }
+
+    template <typename T>
+    static void writeValue(std::ostream& output, T value)
+    {
+        output.write(reinterpret_cast<const char*>(&value), sizeof(value));
+    }
+
+    /** Code the trace was recorded for. */
+    std::vector<Instruction> mCode;
+    /** State before the oldest step still held. */
+    TraceState mBase;
+    /** Recorded steps. The last chunk is the one being filled. */
+    std::list<std::vector<unsigned char>> mChunks;
+    /** Chunks kept in memory before the oldest is dropped. Zero means unbounded. */
+    std::size_t mMaxChunks;
+    /** Offset of the step being recorded in the last chunk. */
+    std::size_t mRecordStart = 0;
+    std::ofstream mFile;
+};
+
+#endif // TRACERECORDER_H
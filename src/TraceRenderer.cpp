@@ -0,0 +1,210 @@
+#include "TraceRenderer.h"
+
+#include "Instruction.h"
+#include "TraceRecorder.h"
+#include "VirtualMachine.h" // MAX_CODE_LENGTH, MAX_STACK_HEIGHT
+
+#include <cstdint>
+#include <cstring>
+#include <iomanip>
+#include <sstream>
+#include <vector>
+
+/** Returns if the link of the activation record at basePointer lies inside the replayed stack. */
+static bool validBase(const TraceState& state, int basePointer)
+{
+    return basePointer >= 0 && basePointer + 1 < static_cast<int>(state.stack.size());
+}
+
+/**
+ * Find the base pointer lex levels down from basePointer in a replayed stack.
+ * @return false if a link leaves the stack. A chain longer than the stack
+ *     revisits a record, so such lex levels are rejected as well.
+ */
+static bool traceBase(const TraceState& state, int lexLevelsDown, int basePointer, int& newBasePointer)
+{
+    if (lexLevelsDown > static_cast<int>(state.stack.size()))
+    {
+        return false;
+    }
+    newBasePointer = basePointer;
+    while (lexLevelsDown > 0)
+    {
+        if (!validBase(state, newBasePointer))
+        {
+            return false;
+        }
+        newBasePointer = state.stack[newBasePointer + 1];
+        lexLevelsDown--;
+    }
+    return true;
+}
+
+template <typename T>
+static bool readTraceValue(std::istream& input, T& value)
+{
+    return static_cast<bool>(input.read(reinterpret_cast<char*>(&value), sizeof(value)));
+}
+
+bool renderTrace(std::istream& input, std::ostream& outputStream)
+{
+    char magic[sizeof(TRACE_MAGIC)];
+    if (!input.read(magic, sizeof(magic)) || std::memcmp(magic, TRACE_MAGIC, sizeof(magic)) != 0)
+    {
+        return false;
+    }
+
+    std::uint32_t codeLength;
+    if (!readTraceValue(input, codeLength))
+    {
+        return false;
+    }
+    if (codeLength > static_cast<std::uint32_t>(MAX_CODE_LENGTH))
+    {
+        return false;
+    }
+    std::vector<Instruction> code(codeLength);
+    for (Instruction& instruction : code)
+    {
+        int opCode;
+        if (!readTraceValue(input, opCode) || opCode < 0 || opCode > LAST_OP_CODE
+            || !readTraceValue(input, instruction.mRegister)
+            || !readTraceValue(input, instruction.mLexLevelOrReg)
+            || !readTraceValue(input, instruction.mMOperand))
+        {
+            return false;
+        }
+        instruction.mOpCode = static_cast<InstructionType>(opCode);
+    }
+
+    TraceState state;
+    std::uint32_t stackHeight;
+    if (!readTraceValue(input, state.pc) || !readTraceValue(input, state.bp) || !readTraceValue(input, state.sp)
+        || !input.read(reinterpret_cast<char*>(state.registers), sizeof(state.registers))
+        || !readTraceValue(input, stackHeight) || stackHeight > static_cast<std::uint32_t>(MAX_STACK_HEIGHT))
+    {
+        return false;
+    }
+    state.stack.resize(stackHeight);
+    if (!input.read(reinterpret_cast<char*>(state.stack.data()), stackHeight * sizeof(int)))
+    {
+        return false;
+    }
+
+    // Printing out initial values
+    std::stringstream out;
+    out << "Input ASM code:\n";
+    out << "Line       OP        R    L    M\n";
+    for (std::uint32_t i = 0; i < codeLength; ++i)
+    {
+        out << std::setw(11) << std::left << i
+            << std::setw(10) << std::left << InstructionTypeLookupTable[code[i].mOpCode]
+            << code[i].mRegister << "    "
+            << code[i].mLexLevelOrReg << "    "
+            << code[i].mMOperand << "\n";
+    }
+
+    out << "\n\nVirtual Machine Execution:\n"
+        << "Line #     OP        R    L    M"
+        << "        PC    BP    SP        "
+        << std::setw(50) << std::left << "Stack "
+        << "Registers\n";
+
+    outputStream << out.str();
+    out.str("");
+    out.clear();
+
+    unsigned char record[TRACE_RECORD_HEADER_SIZE + TRACE_MAX_DELTAS * TRACE_DELTA_SIZE];
+    while (input.read(reinterpret_cast<char*>(record), TRACE_RECORD_HEADER_SIZE))
+    {
+        std::uint16_t executed;
+        std::memcpy(&executed, record, sizeof(executed));
+        std::uint8_t deltaCount = record[3];
+        if (executed >= codeLength || deltaCount > TRACE_MAX_DELTAS
+            || !input.read(reinterpret_cast<char*>(record + TRACE_RECORD_HEADER_SIZE), deltaCount * TRACE_DELTA_SIZE))
+        {
+            return false;
+        }
+        state.applyRecord(record);
+
+        const Instruction& instruction = code[executed];
+
+        // Print Initial Values of Instruction
+        out << std::setw(11) << std::left << executed
+            << std::setw(10) << std::left << InstructionTypeLookupTable[instruction.mOpCode]
+            << std::setw(5) << std::left << instruction.mRegister
+            << std::setw(5) << std::left << instruction.mLexLevelOrReg
+            << std::setw(9) << std::left << instruction.mMOperand;
+
+        // Print out state of Registers after execution
+        out << std::setw(6) << std::left << state.pc
+            << std::setw(6) << std::left << state.bp
+            << std::setw(10) << std::left << state.sp;
+        // A checked run can record any bp and sp, so both are checked
+        // against the replayed stack before it is read.
+        if (!validBase(state, state.bp) || state.sp >= static_cast<int>(state.stack.size()))
+        {
+            return false;
+        }
+        // Getting Dynamic Link to determine how many Lex Levels
+        // into the stack the current Activation Record is.
+        int nextLexLvl = state.stack[state.bp + 1];
+        // Calculating next base pointer from retrieved number
+        // of Lex Levels Down
+        int nextBP;
+        if (!traceBase(state, nextLexLvl, state.bp, nextBP))
+        {
+            return false;
+        }
+        for (int i = 1; i <= state.sp; ++i)
+        {
+            if (i == nextBP)
+            {
+                // Calculate next lexicographical level based on current
+                // level and next base pointer based on the current on
+                // the next lexicographical level. We are going up the
+                // stack instead of down.
+                if (!traceBase(state, --nextLexLvl, state.bp, nextBP))
+                {
+                    return false;
+                }
+                if (i > 1)
+                {
+                    out << "| ";
+                }
+            }
+            int val = state.stack[i];
+            out << val << " ";
+            if (val < 10)
+            {
+                // Adding an extra space for values over 10 to allow for
+                // space for both digits to be printed.
+                out << " ";
+            }
+        }
+
+        std::stringstream streamFormatter;
+        streamFormatter << std::left << std::setw(112) << out.str();
+        out.str("");
+        out.clear();
+        out << streamFormatter.str();
+
+        streamFormatter.str("");
+        streamFormatter.clear();
+
+        for (int i = 0; i < 8; ++i)
+        {
+            streamFormatter << std::setw(3) << std::left << state.registers[i];
+        }
+
+        streamFormatter << "\n";
+
+        out << std::right << streamFormatter.str();
+
+        outputStream << out.str();
+        out.str("");
+        out.clear();
+    }
+
+    return true;
+}
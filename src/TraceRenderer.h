@@ -0,0 +1,15 @@
+#ifndef TRACERENDERER_H
+#define TRACERENDERER_H
+
+#include <istream>
+#include <ostream>
+
+/**
+ * Render a binary trace recorded by TraceRecorder as the text table
+ * showing the code and the machine state after every executed instruction.
+ * @return false if the input is not a valid trace, is truncated or describes
+ *     a state outside the limits of the virtual machine
+ */
+bool renderTrace(std::istream& input, std::ostream& outputStream);
+
+#endif // TRACERENDERER_H
@@ -0,0 +1,348 @@
+#include "Verifier.h"
+
+#include "VirtualMachine.h" // MAX_STACK_HEIGHT, MAX_LEXI_LEVELS, REGISTER_COUNT
+
+#include <algorithm> // max(), min()
+#include <utility>
+
+/** A procedure reached by following calls from the main program, which is procedure 0. */
+struct VerifiedProcedure
+{
+    /** Code index the procedure starts at. */
+    int entry = 0;
+    /** Static nesting depth. The main program is at depth 0. */
+    int depth = 0;
+    /** Procedure the static link of its frames points to, -1 for the main program. */
+    int parent = -1;
+    /** Most stack cells a frame of the procedure holds at once. */
+    int cells = 0;
+    /** Lowest frame top at a call. Bounds the frame while a callee runs. */
+    int callFrameTop = INT_MAX;
+    /** Frame top at each call and the procedure called. */
+    std::vector<std::pair<int, int>> calls;
+};
+
+static Verification rejected(int index, const std::string& error)
+{
+    Verification verification;
+    verification.error = error;
+    verification.errorIndex = index;
+    return verification;
+}
+
+static bool isRegister(int index)
+{
+    return index >= 0 && index < REGISTER_COUNT;
+}
+
+/** Returns if every register instruction refers to is in the register file. */
+static bool registersValid(const Instruction& instruction)
+{
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+        case LOD:
+        case STO:
+        case JPC:
+        case SIO1:
+        case SIO2:
+        case ODD:
+            return isRegister(instruction.mRegister);
+        case NEG:
+            return isRegister(instruction.mRegister) && isRegister(instruction.mLexLevelOrReg);
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case MOD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+            return isRegister(instruction.mRegister) && isRegister(instruction.mLexLevelOrReg)
+                && isRegister(instruction.mMOperand);
+        case JEQL:
+        case JNEQ:
+        case JLSS:
+        case JLEQ:
+        case JGTR:
+        case JGEQ:
+        case ADDM:
+            return isRegister(instruction.mRegister) && isRegister(instruction.mLexLevelOrReg);
+        default:
+            return true;
+    }
+}
+
+/** Procedure whose frame the static links lead to, levels up from procedure. */
+static int ancestor(const std::vector<VerifiedProcedure>& procedures, int procedure, int levels)
+{
+    while (levels-- > 0)
+    {
+        procedure = procedures[procedure].parent;
+    }
+    return procedure;
+}
+
+Verification verifyCode(const Instruction* code, int codeLength)
+{
+    if (codeLength <= 0)
+    {
+        return rejected(-1, "There is no code to run.");
+    }
+
+    std::vector<int> frameTops(codeLength, UNREACHABLE_FRAME_TOP);
+    std::vector<int> owners(codeLength, -1);
+    std::vector<int> procedureAt(codeLength, -1);
+    std::vector<VerifiedProcedure> procedures(1);
+    procedureAt[0] = 0;
+
+    // Accesses to frames of static ancestors, with the procedure owning the frame.
+    // They are checked once every call to that procedure is known.
+    std::vector<std::pair<int, int>> outerAccesses;
+
+    // Follow every path through each procedure. Calls found on the way add procedures.
+    std::vector<int> pending;
+    for (int procedure = 0; procedure < static_cast<int>(procedures.size()); ++procedure)
+    {
+        int entry = procedures[procedure].entry;
+        if (owners[entry] != -1)
+        {
+            return rejected(entry, "Procedure starts inside other code.");
+        }
+        owners[entry] = procedure;
+        frameTops[entry] = -1;
+        pending.push_back(entry);
+
+        while (!pending.empty())
+        {
+            int pc = pending.back();
+            pending.pop_back();
+            const Instruction& instruction = code[pc];
+            int top = frameTops[pc];
+            int levels = instruction.mLexLevelOrReg;
+            int depth = procedures[procedure].depth;
+
+            if (instruction.mOpCode < LIT || instruction.mOpCode > LAST_OP_CODE)
+            {
+                return rejected(pc, "Unknown op code.");
+            }
+            if (!registersValid(instruction))
+            {
+                return rejected(pc, "Register index out of range.");
+            }
+
+            int successors[2];
+            int successorCount = 0;
+            int nextTop = top;
+            bool fallsThrough = true;
+
+            switch (instruction.mOpCode)
+            {
+                case LOD:
+                case STO:
+                    if (levels < 0 || levels > depth || levels >= MAX_LEXI_LEVELS)
+                    {
+                        return rejected(pc, "Lex level out of range.");
+                    }
+                    if (instruction.mOpCode == STO && instruction.mMOperand >= 1 && instruction.mMOperand <= 3)
+                    {
+                        return rejected(pc, "Store into the links of an activation record.");
+                    }
+                    if (instruction.mMOperand < 0 || (levels == 0 && instruction.mMOperand > top))
+                    {
+                        return rejected(pc, "Stack access outside of the frame.");
+                    }
+                    if (levels > 0)
+                    {
+                        outerAccesses.emplace_back(pc, ancestor(procedures, procedure, levels));
+                    }
+                    break;
+                case ADDM:
+                    // Loads and stores the current frame
+                    if (instruction.mMOperand >= 1 && instruction.mMOperand <= 3)
+                    {
+                        return rejected(pc, "Store into the links of an activation record.");
+                    }
+                    if (instruction.mMOperand < 0 || instruction.mMOperand > top)
+                    {
+                        return rejected(pc, "Stack access outside of the frame.");
+                    }
+                    break;
+                case CAL:
+                {
+                    if (levels < 0 || levels > depth || levels >= MAX_LEXI_LEVELS)
+                    {
+                        return rejected(pc, "Lex level out of range.");
+                    }
+                    if (instruction.mMOperand < 0 || instruction.mMOperand >= codeLength)
+                    {
+                        return rejected(pc, "Call target out of range.");
+                    }
+                    // The callee frame starts right above the stack pointer
+                    if (procedure != 0 && top < 3)
+                    {
+                        return rejected(pc, "Call before the activation record is allocated.");
+                    }
+
+                    int parent = ancestor(procedures, procedure, levels);
+                    int callee = procedureAt[instruction.mMOperand];
+                    if (callee == 0)
+                    {
+                        return rejected(pc, "Call into the main program.");
+                    }
+                    if (callee == -1)
+                    {
+                        callee = static_cast<int>(procedures.size());
+                        procedureAt[instruction.mMOperand] = callee;
+                        VerifiedProcedure called;
+                        called.entry = instruction.mMOperand;
+                        called.depth = procedures[parent].depth + 1;
+                        called.parent = parent;
+                        procedures.push_back(called);
+                    }
+                    else if (procedures[callee].parent != parent)
+                    {
+                        return rejected(pc, "Procedure called from another static level.");
+                    }
+
+                    procedures[procedure].callFrameTop = std::min(procedures[procedure].callFrameTop, top);
+                    procedures[procedure].calls.emplace_back(top, callee);
+                    break;
+                }
+                case INC:
+                {
+                    long long grown = static_cast<long long>(top) + instruction.mMOperand;
+                    if (grown < -1)
+                    {
+                        return rejected(pc, "Stack pointer below the frame.");
+                    }
+                    if (grown >= MAX_STACK_HEIGHT)
+                    {
+                        return rejected(pc, "Stack overflow.");
+                    }
+                    nextTop = static_cast<int>(grown);
+                    break;
+                }
+                case JMP:
+                case JPC:
+                case JEQL:
+                case JNEQ:
+                case JLSS:
+                case JLEQ:
+                case JGTR:
+                case JGEQ:
+                    if (instruction.mMOperand < 0 || instruction.mMOperand >= codeLength)
+                    {
+                        return rejected(pc, "Jump target out of range.");
+                    }
+                    successors[successorCount++] = instruction.mMOperand;
+                    fallsThrough = instruction.mOpCode != JMP;
+                    break;
+                case RTN:
+                    if (procedure == 0)
+                    {
+                        return rejected(pc, "Return from the main program.");
+                    }
+                    fallsThrough = false;
+                    break;
+                case SIO3:
+                    fallsThrough = false;
+                    break;
+                default:
+                    break;
+            }
+
+            if (fallsThrough)
+            {
+                if (pc + 1 >= codeLength)
+                {
+                    return rejected(pc, "Execution runs past the end of the code.");
+                }
+                successors[successorCount++] = pc + 1;
+            }
+            procedures[procedure].cells = std::max(procedures[procedure].cells, std::max(top, nextTop) + 1);
+
+            for (int i = 0; i < successorCount; ++i)
+            {
+                int successor = successors[i];
+                if (owners[successor] == -1)
+                {
+                    owners[successor] = procedure;
+                    frameTops[successor] = nextTop;
+                    pending.push_back(successor);
+                }
+                else if (owners[successor] != procedure)
+                {
+                    return rejected(pc, "Jump into another procedure.");
+                }
+                else if (frameTops[successor] != nextTop)
+                {
+                    return rejected(pc, "Frame height differs between paths.");
+                }
+            }
+        }
+    }
+
+    for (const std::pair<int, int>& access : outerAccesses)
+    {
+        if (code[access.first].mMOperand > procedures[access.second].callFrameTop)
+        {
+            return rejected(access.first, "Stack access outside of the frame.");
+        }
+    }
+
+    // Stack cells needed by each procedure and everything it calls, callees first.
+    // Without recursion the calls form no cycles.
+    const int procedureCount = static_cast<int>(procedures.size());
+    std::vector<char> visited(procedureCount, 0);
+    std::vector<char> finished(procedureCount, 0);
+    std::vector<long long> cellsNeeded(procedureCount, 0);
+    std::vector<std::pair<int, std::size_t>> path{{0, 0}};
+    visited[0] = 1;
+    while (!path.empty())
+    {
+        int procedure = path.back().first;
+        std::size_t call = path.back().second;
+        const VerifiedProcedure& current = procedures[procedure];
+        if (call < current.calls.size())
+        {
+            ++path.back().second;
+            int callee = current.calls[call].second;
+            if (!finished[callee])
+            {
+                if (visited[callee])
+                {
+                    return rejected(procedures[callee].entry, "Recursive calls can overflow the stack.");
+                }
+                visited[callee] = 1;
+                path.emplace_back(callee, 0);
+            }
+            continue;
+        }
+
+        // A call writes the four cells of the activation record right above the frame
+        long long cells = current.cells;
+        for (const std::pair<int, int>& called : current.calls)
+        {
+            cells = std::max(cells, called.first + 1 + std::max(4LL, cellsNeeded[called.second]));
+        }
+        cellsNeeded[procedure] = cells;
+        finished[procedure] = 1;
+        path.pop_back();
+    }
+
+    // The main frame starts at index 1
+    if (cellsNeeded[0] >= MAX_STACK_HEIGHT)
+    {
+        return rejected(-1, "Stack overflow.");
+    }
+
+    Verification verification;
+    verification.verified = true;
+    verification.frameTops = std::move(frameTops);
+    verification.callsProcedures = procedureCount > 1;
+    return verification;
+}
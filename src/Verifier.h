@@ -0,0 +1,54 @@
+#ifndef VERIFIER_H
+#define VERIFIER_H
+
+#include "Instruction.h"
+
+#include <climits>
+#include <string>
+#include <vector>
+
+/** Frame top of instructions that can never be executed. */
+const int UNREACHABLE_FRAME_TOP = INT_MIN;
+
+/**
+ * What verifyCode() proved about a code array.
+ *
+ * Verified code can be run without any runtime checks: every instruction that
+ * can be executed uses registers inside the register file, jumps and calls
+ * inside the code, lex levels that exist and stack cells inside the frame they
+ * address, and the stack never grows past MAX_STACK_HEIGHT.
+ */
+struct Verification
+{
+    /** Set if the code was proven safe to run unchecked. */
+    bool verified = false;
+
+    /** Why the code could not be verified. Empty when verified. */
+    std::string error;
+
+    /** Index of the instruction error was found at, -1 for none. */
+    int errorIndex = -1;
+
+    /**
+     * For each instruction, sp - bp whenever it is about to execute, or
+     * UNREACHABLE_FRAME_TOP if it never is. Only filled in for verified code.
+     */
+    std::vector<int> frameTops;
+
+    /** Set if the code calls procedures. */
+    bool callsProcedures = false;
+};
+
+/**
+ * Prove that code can be run by the virtual machine without runtime checks.
+ *
+ * Instructions are followed from the start of the code and from every called
+ * procedure, keeping track of the height of the current frame. It has to be
+ * the same on every path to an instruction. Every instruction belongs to a
+ * single procedure, a procedure is always called from the same static level
+ * and only procedures return. Stores into the links of an activation record and
+ * recursive calls are not verified, since neither bounds the stack statically.
+ */
+Verification verifyCode(const Instruction* code, int codeLength);
+
+#endif // VERIFIER_H
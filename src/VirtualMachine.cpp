@@ -0,0 +1,767 @@
+#include "VirtualMachine.h"
+
+#include <algorithm> // copy(), fill()
+#include <climits>
+#include <cstdint>
+
+/**
+ * Stop on the instruction being executed unless condition holds. The
+ * instruction is not counted as executed.
+ */
+#define STOP_UNLESS(condition, reason) \
+    if (!(condition)) \
+    { \
+        pc = executed; \
+        --executedCount; \
+        mFault = reason; \
+        status = ExecutionStatus::Fault; \
+        break; \
+    }
+
+/** STOP_UNLESS() for checked runs only. Compiles to nothing unchecked. */
+#define CHECK(condition, reason) STOP_UNLESS(!CHECKED || (condition), reason)
+
+#ifdef PMACHINE_PROFILING
+#define PROFILE_BRANCH_TAKEN() \
+    if (mProfiler != nullptr) \
+    { \
+        mProfiler->branchTaken(executed); \
+    }
+#else
+#define PROFILE_BRANCH_TAKEN()
+#endif
+
+/**
+ * Compare R[i] with R[j] into R[i] and jump like JPC on the result. Every
+ * comparison gets a case of its own, so the dispatch branch predicts it.
+ */
+#define COMPARE_AND_BRANCH(comparison) \
+    CHECK(isRegister(ir->mRegister) && isRegister(ir->mLexLevelOrReg), "Register index out of range."); \
+    registers[ir->mRegister] = static_cast<int>(registers[ir->mRegister] comparison registers[ir->mLexLevelOrReg]); \
+    if (registers[ir->mRegister] == 0) \
+    { \
+        PROFILE_BRANCH_TAKEN() \
+        pc = ir->mMOperand; \
+        if (pc <= executed) \
+        { \
+            status = checkLimits(executedCount, limit); \
+        } \
+    }
+
+static bool isRegister(int index)
+{
+    return index >= 0 && index < REGISTER_COUNT;
+}
+
+/** Returns if the three registers of an arithmetic or logic instruction are in the register file. */
+static bool registersValid(const Instruction* instruction)
+{
+    return isRegister(instruction->mRegister) && isRegister(instruction->mLexLevelOrReg)
+        && isRegister(instruction->mMOperand);
+}
+
+/**
+ * Decode the loads and stores of verified code that go at most one static link
+ * up. Verified code never stores into the links of a frame, so the static link
+ * of a frame stays what the call set it to.
+ */
+static std::vector<Instruction> decodeCode(const Instruction* code, int codeLength)
+{
+    std::vector<Instruction> decoded(code, code + codeLength);
+    for (Instruction& instruction : decoded)
+    {
+        if (instruction.mOpCode == LOD && instruction.mLexLevelOrReg == 0)
+        {
+            instruction.mOpCode = LOD0;
+        }
+        else if (instruction.mOpCode == STO && instruction.mLexLevelOrReg == 0)
+        {
+            instruction.mOpCode = STO0;
+        }
+        else if (instruction.mOpCode == LOD && instruction.mLexLevelOrReg == 1)
+        {
+            instruction.mOpCode = LODL1;
+        }
+        else if (instruction.mOpCode == STO && instruction.mLexLevelOrReg == 1)
+        {
+            instruction.mOpCode = STOL1;
+        }
+    }
+    return decoded;
+}
+
+VirtualMachine::VirtualMachine(const Instruction* code, int codeLength, OutputSink& output, InputSource& input)
+    : mCode(code)
+    , mCodeLength(codeLength)
+    , mOwnVerification(std::make_unique<Verification>(verifyCode(code, codeLength)))
+    , mOutputSink(&output)
+    , mInputSource(&input)
+{
+    mVerification = mOwnVerification.get();
+    mChecked = !mVerification->verified;
+    if (mVerification->verified)
+    {
+        mDecodedCode = decodeCode(code, codeLength);
+    }
+}
+
+VirtualMachine::VirtualMachine(const Instruction* code, int codeLength, OutputSink& output, InputSource& input,
+    const Verification& verification)
+    : mCode(code)
+    , mCodeLength(codeLength)
+    , mVerification(&verification)
+    , mChecked(!verification.verified)
+    , mOutputSink(&output)
+    , mInputSource(&input)
+{
+    if (verification.verified)
+    {
+        mDecodedCode = decodeCode(code, codeLength);
+    }
+}
+
+int VirtualMachine::run()
+{
+    reset();
+    resume();
+    return 0;
+}
+
+void VirtualMachine::reset()
+{
+    // Every run starts from a clean machine
+    std::fill(mContext.stack, mContext.stack + MAX_STACK_HEIGHT, 0);
+    std::fill(mContext.registers, mContext.registers + REGISTER_COUNT, 0);
+    mContext.bp = 1;
+    mContext.sp = 0;
+    mContext.pc = 0;
+    mContext.haltFlag = 0;
+    mInstructionsExecuted = 0;
+    mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+    mChecked = mAlwaysChecked || !mVerification->verified;
+    mFault = nullptr;
+
+    if (mTraceRecorder != nullptr)
+    {
+        mTraceRecorder->begin(mCode, mCodeLength, mContext.pc, mContext.bp, mContext.sp, mContext.registers, mContext.stack, MAX_STACK_HEIGHT);
+    }
+}
+
+MachineState VirtualMachine::saveState()
+{
+    mOutputSink->flush();
+
+    MachineState state;
+    state.pc = mContext.pc;
+    state.bp = mContext.bp;
+    state.sp = mContext.sp;
+    state.halted = mContext.haltFlag == 1;
+    state.instructionsExecuted = mInstructionsExecuted;
+    std::copy(mContext.registers, mContext.registers + REGISTER_COUNT, state.registers);
+
+    // Leave out the untouched top of the stack
+    int height = MAX_STACK_HEIGHT;
+    while (height > 0 && mContext.stack[height - 1] == 0)
+    {
+        --height;
+    }
+    state.stack.assign(mContext.stack, mContext.stack + height);
+    return state;
+}
+
+bool VirtualMachine::loadState(const MachineState& state)
+{
+    // A halted machine may have run off the end of the code
+    if (state.pc < 0 || state.pc > mCodeLength || (state.pc == mCodeLength && !state.halted)
+        || state.bp < 0 || state.bp >= MAX_STACK_HEIGHT
+        || state.sp < 0 || state.sp >= MAX_STACK_HEIGHT
+        || state.stack.size() > static_cast<std::size_t>(MAX_STACK_HEIGHT))
+    {
+        return false;
+    }
+
+    mContext.pc = state.pc;
+    mContext.bp = state.bp;
+    mContext.sp = state.sp;
+    mContext.haltFlag = state.halted ? 1 : 0;
+    mInstructionsExecuted = state.instructionsExecuted;
+    mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+    std::copy(state.registers, state.registers + REGISTER_COUNT, mContext.registers);
+    std::copy(state.stack.begin(), state.stack.end(), mContext.stack);
+    std::fill(mContext.stack + state.stack.size(), mContext.stack + MAX_STACK_HEIGHT, 0);
+    mFault = nullptr;
+
+    // Verified code without calls only ever runs in the main frame at the frame
+    // top the verifier found. Other states have to be checked.
+    const Verification& verification = *mVerification;
+    mChecked = mAlwaysChecked || !verification.verified;
+    if (!mChecked && !state.halted)
+    {
+        mChecked = verification.callsProcedures || mContext.bp != 1
+            || verification.frameTops[mContext.pc] == UNREACHABLE_FRAME_TOP || mContext.sp - mContext.bp != verification.frameTops[mContext.pc];
+    }
+
+    if (mTraceRecorder != nullptr)
+    {
+        mTraceRecorder->begin(mCode, mCodeLength, mContext.pc, mContext.bp, mContext.sp, mContext.registers, mContext.stack, MAX_STACK_HEIGHT);
+    }
+    return true;
+}
+
+ExecutionStatus VirtualMachine::resume(std::uint64_t budget)
+{
+    if (mContext.haltFlag == 1)
+    {
+        return ExecutionStatus::Halted;
+    }
+    if (mFault != nullptr)
+    {
+        return ExecutionStatus::Fault;
+    }
+
+    return mChecked ? execute<true>(budget) : execute<false>(budget);
+}
+
+template <bool CHECKED>
+ExecutionStatus VirtualMachine::execute(std::uint64_t budget)
+{
+    // Budget and deadline are only checked on loop back edges and calls. Code
+    // between two checks is straight line code, so a budget is overrun by at
+    // most the length of the code.
+    std::uint64_t executedCount = mInstructionsExecuted;
+    std::uint64_t limit = budget == 0 ? UINT64_MAX : executedCount + budget;
+    ExecutionStatus status = ExecutionStatus::Running;
+    const Instruction* code = CHECKED ? mCode : mDecodedCode.data();
+
+    // The control registers are kept in locals while the loop runs, where the
+    // compiler can hold them in machine registers. Stores to the stack could
+    // change them if they were read from the context every time.
+    int pc = mContext.pc;
+    int bp = mContext.bp;
+    int sp = mContext.sp;
+    int* const registers = mContext.registers;
+    int* const stack = mContext.stack;
+    // Stack cell the last store wrote, for the trace. Taken from the store
+    // itself, since the links it followed may have been overwritten since.
+    int storeAddress = 0;
+
+    // Continue until the program halts or runs out of budget or time
+    while (status == ExecutionStatus::Running)
+    {
+        // Fetch Cycle
+        // In the Fetch Cycle, an instruction is fetched from the “code” store
+        // and placed in the IR register (IR <- code[PC]). Afterwards, the
+        // program counter is incremented by 1 to point to the next instruction
+        // to be executed (PC <- PC + 1).
+
+        // Fetch instruction.
+        // Since the code is held in one contiguous block, we will have
+        // IR hold the address to the instruction in the code array
+        if (CHECKED && (pc < 0 || pc >= mCodeLength))
+        {
+            mFault = "Program counter outside of the code.";
+            status = ExecutionStatus::Fault;
+            break;
+        }
+        const Instruction* ir = &(code[pc]);
+        int executed = pc;
+        ++executedCount;
+
+#ifdef PMACHINE_PROFILING
+        bool sampled = mProfiler != nullptr && mProfiler->beginStep(executed, mCode[executed].mOpCode);
+#endif
+
+        // Grab next instruction
+        pc += 1;
+
+        // Execute Cycle
+        // In the Execute Cycle, the instruction that was fetched is executed
+        // by the VM. The OP component that is stored in the IR register (IR.OP)
+        // indicates the operation to be executed. For example, if IR.OP is the
+        // ISA instruction ADD (IR.OP = 12), then the R, L, M component of the
+        // instruction in the IR register (IR.R, IR.L, IR.M) are used as a
+        // register and execute the appropriate arithmetic or logical instruction.
+
+        // Switch based on the Operation Code type
+        switch (ir->mOpCode)
+        {
+            // 01 – LIT    R, 0, M
+            //     R[i] <- M;
+            case LIT:
+                // Load literal value (MOperand) from Instruction into Register File i, where i
+                // is R in the instruction
+                CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                registers[ir->mRegister] = ir->mMOperand;
+                break;
+            // 02 – RTN  0, 0, 0
+            // sp <- bp - 1;
+            // bp <- stack[sp + 3];
+            // pc <- stack[sp + 4];
+            case RTN:
+                CHECK(bp >= -2 && bp < MAX_STACK_HEIGHT - 3, "Return without an activation record.");
+                sp = bp - 1;
+                bp = stack[sp + 3];
+                pc = stack[sp + 4];
+                if (CHECKED && pc <= executed)
+                {
+                    // Verified code only returns behind a call, which checked the limits.
+                    // Unchecked code can loop through returns.
+                    status = checkLimits(executedCount, limit);
+                }
+                break;
+            // 03 – LOD R, L, M
+            // R[i] <- stack[base(L, bp) + M];
+            // Copy from stack to a register
+            case LOD:
+                if (CHECKED)
+                {
+                    CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                    int address = checkedAddress(ir->mLexLevelOrReg, bp, ir->mMOperand);
+                    CHECK(address >= 0, "Stack access out of range.");
+                    registers[ir->mRegister] = stack[address];
+                    break;
+                }
+                registers[ir->mRegister] = stack[(base(ir->mLexLevelOrReg, bp) + ir->mMOperand)];
+                break;
+            // 04 – STO R, L, M
+            // stack[base(L, bp) + M] <- R[i];
+            // Copy from register to the stack
+            case STO:
+                if (CHECKED)
+                {
+                    CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                    int address = checkedAddress(ir->mLexLevelOrReg, bp, ir->mMOperand);
+                    CHECK(address >= 0, "Stack access out of range.");
+                    stack[address] = registers[ir->mRegister];
+                    storeAddress = address;
+                    break;
+                }
+                storeAddress = base(ir->mLexLevelOrReg, bp) + ir->mMOperand;
+                stack[storeAddress] = registers[ir->mRegister];
+                break;
+            // 05 - CAL   0, L, M
+            // stack[sp + 1]  <- 0;                 // space to return value
+            // stack[sp + 2]  <- base(L, bp);       // static link (SL)
+            // stack[sp + 3]  <- bp;                // dynamic link (DL)
+            // stack[sp + 4]  <- pc;                // return address (RA)
+            // bp <- sp + 1;
+            // pc <- M;
+            case CAL:
+            {
+                int staticLink = bp;
+                if (CHECKED)
+                {
+                    CHECK(sp >= -1 && sp < MAX_STACK_HEIGHT - 4, "Stack overflow.");
+                    CHECK(checkedBase(ir->mLexLevelOrReg, staticLink), "Stack access out of range.");
+                }
+                else
+                {
+                    staticLink = base(ir->mLexLevelOrReg, bp);
+                }
+                stack[sp + 1] = 0;                                // Return value
+                stack[sp + 2] = staticLink;                       // Static Link (SL)
+                stack[sp + 3] = bp;                              // Dynamic Link (DL)
+                stack[sp + 4] = pc;                              // Return Address (RA)
+                bp = sp + 1;
+                pc = ir->mMOperand;
+                // Calls can recurse without bound
+                status = checkLimits(executedCount, limit);
+                break;
+            }
+            // 06 – INC   0, 0, M
+            // sp <- sp + M;
+            case INC:
+                CHECK(static_cast<long long>(sp) + ir->mMOperand >= -1
+                    && static_cast<long long>(sp) + ir->mMOperand < MAX_STACK_HEIGHT, "Stack pointer out of range.");
+                sp = sp + ir->mMOperand;
+                break;
+            // 07 – JMP   0, 0, M
+            // pc <- M;
+            case JMP:
+                pc = ir->mMOperand;
+                if (pc <= executed)
+                {
+                    // Loop back edge
+                    status = checkLimits(executedCount, limit);
+                }
+                break;
+            // 08 – JPC   R, 0, M
+            // if (R[i] == 0)
+            // then
+            // {
+            //     pc <- M;
+            // }
+            case JPC:
+                CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                if (registers[ir->mRegister] == 0)
+                {
+                    PROFILE_BRANCH_TAKEN()
+                    pc = ir->mMOperand;
+                    if (pc <= executed)
+                    {
+                        // Loop back edge
+                        status = checkLimits(executedCount, limit);
+                    }
+                }
+                break;
+            // 09 – SIO   R, 0, 1
+            // print(R[i]);
+            case SIO1:
+                CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                mOutputSink->write(registers[ir->mRegister]);
+                break;
+            // 10 - SIO   R, 0, 2
+            // read(R[i]);
+            case SIO2:
+                CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                // Make sure everything written so far is visible before asking for input
+                mOutputSink->flush();
+                if (!mInputSource->ready())
+                {
+                    // Park on this instruction rather than block. It is executed
+                    // again once resumed.
+                    pc = executed;
+                    --executedCount;
+                    status = ExecutionStatus::WaitingForInput;
+                    break;
+                }
+                if (!mInputSource->read(registers[ir->mRegister]))
+                {
+                    registers[ir->mRegister] = 0;
+                }
+                break;
+            // 11 – SIO   R, 0, 3
+            // Set Halt flag to one
+            case SIO3:
+                mContext.haltFlag = 1;
+                status = ExecutionStatus::Halted;
+                mOutputSink->flush();
+                break;
+            // 12 - NEG
+            // R[i] <- -R[j]
+            case NEG:
+                CHECK(isRegister(ir->mRegister) && isRegister(ir->mLexLevelOrReg), "Register index out of range.");
+                registers[ir->mRegister] = -registers[ir->mLexLevelOrReg];
+                break;
+            // 13 - ADD
+            // R[i] <- R[j] + R[k]
+            case ADD:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] + registers[ir->mMOperand];
+                break;
+            // 14 - SUB
+            // R[i] <- R[j] - R[k]
+            case SUB:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] - registers[ir->mMOperand];
+                break;
+            // 15 - MUL
+            // R[i] <- R[j] * R[k]
+            case MUL:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] * registers[ir->mMOperand];
+                break;
+            // 16 - DIV
+            // R[i] <- R[j] / R[k]
+            case DIV:
+                CHECK(registersValid(ir), "Register index out of range.");
+                // Divisors are values the verifier cannot know, so they are always checked
+                STOP_UNLESS(registers[ir->mMOperand] != 0, "Division by zero.");
+                STOP_UNLESS(registers[ir->mLexLevelOrReg] != INT_MIN || registers[ir->mMOperand] != -1, "Division overflow.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] / registers[ir->mMOperand];
+                break;
+            // 17 - ODD
+            // R[i] <- R[i] mod 2
+            // or ord(odd(R[i]))
+            case ODD:
+                CHECK(isRegister(ir->mRegister), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mRegister] % 2;
+                break;
+            // 18 - MOD
+            // R[i] <- R[j] mod  R[k]
+            case MOD:
+                CHECK(registersValid(ir), "Register index out of range.");
+                STOP_UNLESS(registers[ir->mMOperand] != 0, "Division by zero.");
+                STOP_UNLESS(registers[ir->mLexLevelOrReg] != INT_MIN || registers[ir->mMOperand] != -1, "Division overflow.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] % registers[ir->mMOperand];
+                break;
+            // 19 - EQL
+            // R[i] <- R[j] = = R[k]
+            case EQL:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] == registers[ir->mMOperand];
+                break;
+            // 20 - NEQ
+            // R[i] <- R[j] != R[k]
+            case NEQ:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = registers[ir->mLexLevelOrReg] != registers[ir->mMOperand];
+                break;
+            // 21 - LSS
+            // R[i] <- R[j] < R[k]
+            case LSS:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = static_cast<int>(registers[ir->mLexLevelOrReg] < registers[ir->mMOperand]);
+                break;
+            // 22 - LEQ
+            // R[i] <- R[j] <= R[k]
+            case LEQ:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = static_cast<int>(registers[ir->mLexLevelOrReg] <= registers[ir->mMOperand]);
+                break;
+            // 23 - GTR
+            // R[i] <- R[j] > R[k]
+            case GTR:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = static_cast<int>(registers[ir->mLexLevelOrReg] > registers[ir->mMOperand]);
+                break;
+            // 24 - GEQ
+            // R[i] <- R[j] >= R[k]
+            case GEQ:
+                CHECK(registersValid(ir), "Register index out of range.");
+                registers[ir->mRegister] = static_cast<int>(registers[ir->mLexLevelOrReg] >= registers[ir->mMOperand]);
+                break;
+            // 25 - JEQL  R, L, M
+            // R[i] <- R[i] = = R[j];
+            // if (R[i] == 0)
+            // then
+            // {
+            //     pc <- M;
+            // }
+            case JEQL:
+                COMPARE_AND_BRANCH(==)
+                break;
+            // 26 - JNEQ  R, L, M
+            case JNEQ:
+                COMPARE_AND_BRANCH(!=)
+                break;
+            // 27 - JLSS  R, L, M
+            case JLSS:
+                COMPARE_AND_BRANCH(<)
+                break;
+            // 28 - JLEQ  R, L, M
+            case JLEQ:
+                COMPARE_AND_BRANCH(<=)
+                break;
+            // 29 - JGTR  R, L, M
+            case JGTR:
+                COMPARE_AND_BRANCH(>)
+                break;
+            // 30 - JGEQ  R, L, M
+            case JGEQ:
+                COMPARE_AND_BRANCH(>=)
+                break;
+            // 31 - ADDM  R, L, M
+            // R[i] <- stack[bp + M] + R[j];
+            // stack[bp + M] <- R[i];
+            case ADDM:
+                if (CHECKED)
+                {
+                    CHECK(isRegister(ir->mRegister) && isRegister(ir->mLexLevelOrReg), "Register index out of range.");
+                    int address = checkedAddress(0, bp, ir->mMOperand);
+                    CHECK(address >= 0, "Stack access out of range.");
+                    registers[ir->mRegister] = stack[address] + registers[ir->mLexLevelOrReg];
+                    stack[address] = registers[ir->mRegister];
+                    storeAddress = address;
+                    break;
+                }
+                storeAddress = bp + ir->mMOperand;
+                registers[ir->mRegister] = stack[storeAddress] + registers[ir->mLexLevelOrReg];
+                stack[storeAddress] = registers[ir->mRegister];
+                break;
+            // Decoded forms of LOD and STO. Only decoded code has them, which
+            // runs unchecked. Checked runs execute the code as given.
+            // 32 - LOD0  R, 0, M
+            // R[i] <- stack[bp + M];
+            case LOD0:
+                CHECK(false, "Unknown op code.");
+                registers[ir->mRegister] = stack[bp + ir->mMOperand];
+                break;
+            // 33 - STO0  R, 0, M
+            // stack[bp + M] <- R[i];
+            case STO0:
+                CHECK(false, "Unknown op code.");
+                storeAddress = bp + ir->mMOperand;
+                stack[storeAddress] = registers[ir->mRegister];
+                break;
+            // 34 - LODL1 R, 1, M
+            // R[i] <- stack[stack[bp + 1] + M];
+            case LODL1:
+                CHECK(false, "Unknown op code.");
+                registers[ir->mRegister] = stack[stack[bp + 1] + ir->mMOperand];
+                break;
+            // 35 - STOL1 R, 1, M
+            // stack[stack[bp + 1] + M] <- R[i];
+            case STOL1:
+                CHECK(false, "Unknown op code.");
+                storeAddress = stack[bp + 1] + ir->mMOperand;
+                stack[storeAddress] = registers[ir->mRegister];
+                break;
+            default:
+                CHECK(false, "Unknown op code.");
+                break;
+        }
+
+#ifdef PMACHINE_PROFILING
+        if (sampled)
+        {
+            mProfiler->endSample(executed);
+        }
+#endif
+
+        if (mTraceRecorder != nullptr && status != ExecutionStatus::WaitingForInput
+            && status != ExecutionStatus::Fault)
+        {
+            mContext.pc = pc;
+            mContext.bp = bp;
+            mContext.sp = sp;
+            recordStep(executed, storeAddress);
+        }
+    }
+
+    mContext.pc = pc;
+    mContext.bp = bp;
+    mContext.sp = sp;
+    mInstructionsExecuted = executedCount;
+
+    if ((status == ExecutionStatus::Halted || status == ExecutionStatus::Fault) && mTraceRecorder != nullptr)
+    {
+        mTraceRecorder->finish();
+    }
+
+    return status;
+}
+
+#undef COMPARE_AND_BRANCH
+#undef PROFILE_BRANCH_TAKEN
+#undef CHECK
+#undef STOP_UNLESS
+
+ExecutionStatus VirtualMachine::checkLimits(std::uint64_t executedCount, std::uint64_t limit)
+{
+    if (executedCount >= limit)
+    {
+        return ExecutionStatus::BudgetExhausted;
+    }
+
+    // Reading the clock costs more than a few instructions, so only look at it
+    // every DEADLINE_CHECK_INTERVAL checks.
+    if (mHasDeadline && --mDeadlineCountdown == 0)
+    {
+        mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+        if (std::chrono::steady_clock::now() >= mDeadline)
+        {
+            return ExecutionStatus::DeadlineExpired;
+        }
+    }
+
+    return ExecutionStatus::Running;
+}
+
+void VirtualMachine::recordStep(int executed, int storeAddress)
+{
+    // Traces show the code as given rather than its decoded forms
+    const Instruction& instruction = mCode[executed];
+    mTraceRecorder->beginStep(executed, instruction.mOpCode);
+
+    switch (instruction.mOpCode)
+    {
+        case LIT:
+        case LOD:
+        case SIO2:
+        case NEG:
+        case ADD:
+        case SUB:
+        case MUL:
+        case DIV:
+        case ODD:
+        case MOD:
+        case EQL:
+        case NEQ:
+        case LSS:
+        case LEQ:
+        case GTR:
+        case GEQ:
+        case JEQL:
+        case JNEQ:
+        case JLSS:
+        case JLEQ:
+        case JGTR:
+        case JGEQ:
+            mTraceRecorder->delta(instruction.mRegister, mContext.registers[instruction.mRegister]);
+            break;
+        case ADDM:
+            mTraceRecorder->delta(instruction.mRegister, mContext.registers[instruction.mRegister]);
+            mTraceRecorder->delta(TRACE_SLOT_STACK + storeAddress, mContext.stack[storeAddress]);
+            break;
+        case STO:
+            mTraceRecorder->delta(TRACE_SLOT_STACK + storeAddress, mContext.stack[storeAddress]);
+            break;
+        case CAL:
+            // The new activation record starts at the new base pointer
+            for (int i = 0; i < 4; ++i)
+            {
+                mTraceRecorder->delta(TRACE_SLOT_STACK + mContext.bp + i, mContext.stack[mContext.bp + i]);
+            }
+            mTraceRecorder->delta(TRACE_SLOT_BP, mContext.bp);
+            break;
+        case RTN:
+            mTraceRecorder->delta(TRACE_SLOT_BP, mContext.bp);
+            mTraceRecorder->delta(TRACE_SLOT_SP, mContext.sp);
+            break;
+        case INC:
+            mTraceRecorder->delta(TRACE_SLOT_SP, mContext.sp);
+            break;
+        default:
+            break;
+    }
+
+    if (mContext.pc != executed + 1)
+    {
+        mTraceRecorder->delta(TRACE_SLOT_PC, mContext.pc);
+    }
+}
+
+int VirtualMachine::base(int lexLevelsDown, int basePointer) const
+{
+    int newBasePointer = basePointer; // Find L levels down
+    while (lexLevelsDown > 0)
+    {
+        newBasePointer = mContext.stack[newBasePointer + 1];
+        lexLevelsDown--;
+    }
+    return newBasePointer;
+}
+
+bool VirtualMachine::checkedBase(int lexLevelsDown, int& basePointer) const
+{
+    // Legitimate static link chains are never longer than the stack is high
+    if (lexLevelsDown >= MAX_STACK_HEIGHT)
+    {
+        return false;
+    }
+
+    int newBasePointer = basePointer;
+    while (lexLevelsDown > 0)
+    {
+        if (newBasePointer < -1 || newBasePointer >= MAX_STACK_HEIGHT - 1)
+        {
+            return false;
+        }
+        newBasePointer = mContext.stack[newBasePointer + 1];
+        lexLevelsDown--;
+    }
+    basePointer = newBasePointer;
+    return true;
+}
+
+int VirtualMachine::checkedAddress(int lexLevel, int basePointer, int offset) const
+{
+    if (!checkedBase(lexLevel, basePointer))
+    {
+        return -1;
+    }
+
+    long long address = static_cast<long long>(basePointer) + offset;
+    return address >= 0 && address < MAX_STACK_HEIGHT ? static_cast<int>(address) : -1;
+}
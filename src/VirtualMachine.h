@@ -1,28 +1,17 @@
 #ifndef VIRTUALMACHINE_H
 #define VIRTUALMACHINE_H
 
+#include "InputSource.h"
 #include "Instruction.h"
+#include "OutputSink.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "Verifier.h"
 
-#include <fstream>
-#include <iomanip>
-#include <iostream>
-#include <sstream>
-#include <string>
-
-struct Instruction;
-
-/**
- * Runs the program give the input array
- */
-int runProgram(const std::vector<const Instruction>& code, std::stringstream& outputStream);
-
-/**
- * Find new base pointer lex levels down from inputted base pointer.
- * @param lexLevel How many lex levels to go down from base pointer
- * @param basePointer The starting base pointer
- * @return The new base pointer
- */
-int base(int lexLevel, int basePointer);
+#include <chrono>
+#include <cstdint>
+#include <memory>
+#include <vector>
 
 /** Max stack hight for VM. */
 const int MAX_STACK_HEIGHT = 2000;
@@ -30,344 +19,362 @@ const int MAX_STACK_HEIGHT = 2000;
 const int MAX_CODE_LENGTH = 500;
 /** Max lexicographical levels that can be referenced in instructions. */
 const int MAX_LEXI_LEVELS = 3;
+/** Number of registers in the register file. */
+const int REGISTER_COUNT = 16;
+/** Number of loop back edges and calls between two looks at the clock when a deadline is set. */
+const int DEADLINE_CHECK_INTERVAL = 256;
+
+/** Why the virtual machine stopped executing. */
+enum class ExecutionStatus : int
+{
+    Running,            // Still executing. Only seen while resume() is running
+    Halted,             // The program ran to completion
+    BudgetExhausted,    // The instruction budget given to resume() ran out
+    DeadlineExpired,    // The deadline passed
+    WaitingForInput,    // SIO2 found the input source not ready. Resuming retries the read
+    Fault               // An instruction would have gone out of bounds or divided by zero
+};
+
+/** Everything needed to continue a program later, possibly in another machine. */
+struct MachineState
+{
+    int pc = 0;
+    int bp = 1;
+    int sp = 0;
+    bool halted = false;
+    std::uint64_t instructionsExecuted = 0;
+    int registers[REGISTER_COUNT] = {};
+    /** Stack cells up to the last nonzero one. The cells after it are 0. */
+    std::vector<int> stack;
+};
+
+/** Size of a cache line on the machines the virtual machine is laid out for. */
+const int CACHE_LINE_SIZE = 64;
 
 /**
- * Code Store. This array will hold the code to be
- * excuted by the Virtual machine.
+ * What the interpreter loop reads and writes on nearly every instruction, in
+ * one block from the start of a cache line. The register file fills the first
+ * line. The control registers share the second with the bottom of the stack,
+ * which holds the activation record and first variables of the main program.
  */
-Instruction CODE[MAX_CODE_LENGTH];
+struct alignas(CACHE_LINE_SIZE) MachineContext
+{
+    /** Register File. Initialized to all 0s. */
+    int registers[REGISTER_COUNT] = {};
+
+    // Virtual Machine Registers
+    /**
+     * Base Pointer
+     * Register that points to the base of the current
+     * activation record (AR) in the stack.
+     */
+    int bp = 1;
+
+    /**
+     * Stack Pointer
+     * Points to the top of the stack.
+     */
+    int sp = 0;
+
+    /**
+     * Program Counter
+     * Also sometimes refered to as the Instruction Pointer.
+     */
+    int pc = 0;
+
+    /** Flag to tell program to halt execution */
+    int haltFlag = 0;
+
+    /**
+     * Working Execution Stack
+     * Holds Activation Records/Stack Frames.
+     * Initialized to all 0s.
+     *
+     * @note An activation record or stack frame is the name given to a data
+     * structure which is inserted in the stack, each time a procedure or
+     * function is called.
+     *
+     * The data structure contains information to control sub-routines
+     * program execution
+     *
+     * An Activation Record is defined as follows:
+     * - Return Value
+     * - Static Link (SL)
+     * - Dynamic Link (DL)
+     * - Return Address (RA)
+     */
+    int stack[MAX_STACK_HEIGHT] = {};
+};
 
 /**
- * Working Execution Stack
- * Holds Activation Records/Stack Frames.
- * Initialized to all 0s.
+ * The P-Machine. Executes code produced by the parser and code generator.
  *
- * @note An activation record or stack frame is the name given to a data
- * structure which is inserted in the stack, each time a procedure or
- * function is called.
+ * All machine state lives in the object so that any number of machines
+ * can run side by side.
  *
- * The data structure contains information to control sub-routines
- * program execution
+ * Code proven safe by verifyCode() runs without runtime checks, from a copy
+ * decoded when the machine is created: loads and stores of the current frame
+ * and of the frame its static link points to find their stack cell without
+ * following links. Traces and profiles still show the code as given.
  *
- * An Activation Record is defined as follows:
- * - Return Value
- * - Static Link (SL)
- * - Dynamic Link (DL)
- * - Return Address (RA)
+ * Any other code runs checked: every register index, jump target and stack
+ * access is checked before use. Divisors are checked either way. A failed check stops the machine
+ * with ExecutionStatus::Fault on the offending instruction.
  */
-int STACK[MAX_STACK_HEIGHT] = {};
+class VirtualMachine
+{
+public:
+    /**
+     * @param code Code to execute. Must stay valid while the machine exists.
+     * @param codeLength Number of instructions in code
+     * @param output Destination for values written by SIO1
+     * @param input Source of values read by SIO2
+     */
+    VirtualMachine(const Instruction* code, int codeLength, OutputSink& output, InputSource& input);
 
-// Virtual Machine Registers
-/**
- * Base Pointer
- * Register that points to the base of the current
- * activation record (AR) in the stack.
- */
-int BP = 1;
+    /**
+     * Run code that was verified up front, so that machines running the same
+     * code do not verify it again.
+     * @param verification Result of verifyCode() for code. Must stay valid while the machine exists.
+     */
+    VirtualMachine(const Instruction* code, int codeLength, OutputSink& output, InputSource& input,
+        const Verification& verification);
 
-/**
- * Stack Pointer
- * Points to the top of the stack.
- */
-int SP = 0;
+    /**
+     * Runs the program from the start until it halts or the deadline passes.
+     */
+    int run();
 
-/**
- * Program Counter
- * Also sometimes refered to as the Instruction Pointer.
- */
-int PC = 0;
+    /**
+     * Put the machine back into its initial state, ready to execute
+     * the program from the start.
+     */
+    void reset();
 
-/** Instruction Register */
-Instruction* IR = 0;
+    /**
+     * Continue executing the program where it stopped.
+     *
+     * Limits are checked at loop back edges and calls only, so execution may
+     * continue for up to the length of the code past the budget. A machine
+     * stopped by a limit or waiting for input can be resumed again later. A
+     * faulted machine keeps returning ExecutionStatus::Fault until it is reset.
+     *
+     * @param budget Number of instructions to execute before stopping.
+     *     Zero keeps executing until the program halts or the deadline passes.
+     * @return Why execution stopped
+     */
+    ExecutionStatus resume(std::uint64_t budget = 0);
 
-/** Register File. Initialized to all 0s. */
-int RF[16] = {};
+    /** Stop executing once the deadline has passed. */
+    void setDeadline(std::chrono::steady_clock::time_point deadline)
+    {
+        mDeadline = deadline;
+        mHasDeadline = true;
+    }
 
-/** Flag to tell program to halt execution */
-int HALT_FLAG = 0;
+    /** Remove the deadline set with setDeadline(). */
+    void clearDeadline()
+    {
+        mHasDeadline = false;
+    }
 
-inline int runProgram(std::stringstream& outputStream)
-{
-    // Printing out initial values
-    int i = 0;  
-    std::stringstream out;
-    out << "Input ASM code:\n";
-    out << "Line       OP        R    L    M\n";
-    while (CODE[i].mOpCode != 0)
+    /** Returns if the program ran to completion. */
+    bool halted() const
     {
-        out << std::setw(11) << std::left << i
-            << std::setw(10) << std::left << InstructionTypeLookupTable[CODE[i].mOpCode]
-            << CODE[i].mRegister << "    "
-            << CODE[i].mLexLevelOrReg << "    "
-            << CODE[i].mMOperand << "\n";
-        ++i;
+        return mContext.haltFlag == 1;
     }
-    
-    out << "\n\nVirtual Machine Execution:\n"
-        << "Line #     OP        R    L    M"
-        << "        PC    BP    SP        "
-        << std::setw(50) << std::left << "Stack "
-        << "Registers\n";
-    
-    outputStream << out.str();
-    out.str("");
-    out.clear();
-    
-    // Continue until halt flag is set
-    while (HALT_FLAG != 1)
+
+    /** Number of instructions executed since the machine was reset. */
+    std::uint64_t instructionsExecuted() const
     {
-        // Fetch Cycle
-        // In the Fetch Cycle, an instruction is fetched from the “code” store
-        // and placed in the IR register (IR <- code[PC]). Afterwards, the
-        // program counter is incremented by 1 to point to the next instruction
-        // to be executed (PC <- PC + 1).
-        
-        // Fetch instruction.
-        // Since the CODE block is statically allocated, we will have
-        // IR hold the address to the instruction in the code array
-        IR = &(CODE[PC]);
-        
-        // Print Initial Values of Instruction
-        out << std::setw(11) << std::left << PC
-        << std::setw(10) << std::left << InstructionTypeLookupTable[IR->mOpCode]
-        << std::setw(5) << std::left << IR->mRegister
-        << std::setw(5) << std::left << IR->mLexLevelOrReg
-        << std::setw(9) << std::left << IR->mMOperand;
-        
-        // Grab next instruction
-        PC += 1;
-        
-        // Execute Cycle
-        // In the Execute Cycle, the instruction that was fetched is executed
-        // by the VM. The OP component that is stored in the IR register (IR.OP)
-        // indicates the operation to be executed. For example, if IR.OP is the
-        // ISA instruction ADD (IR.OP = 12), then the R, L, M component of the
-        // instruction in the IR register (IR.R, IR.L, IR.M) are used as a
-        // register and execute the appropriate arithmetic or logical instruction.
-        
-        // Switch based on the Operation Code type
-        switch (IR->mOpCode)
-        {
-            // 01 – LIT    R, 0, M
-            //     R[i] <- M;
-            case LIT:
-                // Load literal value (MOperand) from Instruction into Register File i, where i
-                // is R in the instruction
-                RF[IR->mRegister] = IR->mMOperand;
-                break;
-            // 02 – RTN  0, 0, 0
-            // sp <- bp - 1;
-            // bp <- stack[sp + 3];
-            // pc <- stack[sp + 4];
-            case RTN:
-                SP = BP - 1;
-                BP = STACK[SP + 3];
-                PC = STACK[SP + 4];
-                break;
-            // 03 – LOD R, L, M
-            // R[i] <- stack[base(L, bp) + M];
-            // Copy from stack to a register
-            case LOD:
-                RF[IR->mRegister] = STACK[(base(IR->mLexLevelOrReg, BP) + IR->mMOperand)];
-                break;
-            // 04 – STO R, L, M
-            // stack[base(L, bp) + M] <- R[i];
-            // Copy from register to the stack
-            case STO:
-                STACK[(base(IR->mLexLevelOrReg, BP) + IR->mMOperand)] = RF[IR->mRegister];
-                break;
-            // 05 - CAL   0, L, M
-            // stack[sp + 1]  <- 0;                 // space to return value
-            // stack[sp + 2]  <- base(L, bp);       // static link (SL)
-            // stack[sp + 3]  <- bp;                // dynamic link (DL)
-            // stack[sp + 4]  <- pc;                // return address (RA)
-            // bp <- sp + 1;
-            // pc <- M;
-            case CAL:
-                STACK[SP + 1] = 0;                              // Return value
-                STACK[SP + 2] = base(IR->mLexLevelOrReg, BP);   // Static Link (SL)
-                STACK[SP + 3] = BP;                             // Dynamic Link (DL)
-                STACK[SP + 4] = PC;                             // Return Address (RA)
-                BP = SP + 1;
-                PC = IR->mMOperand;
-                break;
-            // 06 – INC   0, 0, M
-            // sp <- sp + M;
-            case INC:
-                SP = SP + IR->mMOperand;
-                break;
-            // 07 – JMP   0, 0, M
-            // pc <- M;
-            case JMP:
-                PC = IR->mMOperand;
-                break;
-            // 08 – JPC   R, 0, M
-            // if (R[i] == 0)
-            // then
-            // {
-            //     pc <- M;
-            // }
-            case JPC:
-                if (RF[IR->mRegister] == 0)
-                {
-                    PC = IR->mMOperand;
-                }
-                break;
-            // 09 – SIO   R, 0, 1
-            // print(R[i]);
-            case SIO1:
-                std::cout << RF[IR->mRegister] << std::endl;
-                break;
-            // 10 - SIO   R, 0, 2
-            // read(R[i]);
-            case SIO2:
-                std::cout << "Input a value followed by enter: ";
-                std::cin >> RF[IR->mRegister];
-                break;
-            // 11 – SIO   R, 0, 3
-            // Set Halt flag to one
-            case SIO3:
-                HALT_FLAG = 1;
-                break;
-            // 12 - NEG
-            // R[i] <- -R[j]
-            case NEG:
-                RF[IR->mRegister] = -RF[IR->mLexLevelOrReg];
-                break;
-            // 13 - ADD
-            // R[i] <- R[j] + R[k]
-            case ADD:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] + RF[IR->mMOperand];
-                break;
-            // 14 - SUB
-            // R[i] <- R[j] - R[k]
-            case SUB:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] - RF[IR->mMOperand];
-                break;
-            // 15 - MUL
-            // R[i] <- R[j] * R[k]
-            case MUL:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] * RF[IR->mMOperand];
-                break;
-            // 16 - DIV
-            // R[i] <- R[j] / R[k]
-            case DIV:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] / RF[IR->mMOperand];
-                break;
-            // 17 - ODD
-            // R[i] <- R[i] mod 2
-            // or ord(odd(R[i]))
-            case ODD:
-                RF[IR->mRegister] = RF[IR->mRegister] % 2;
-                break;
-            // 18 - MOD
-            // R[i] <- R[j] mod  R[k]
-            case MOD:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] % RF[IR->mMOperand];
-                break;
-            // 19 - EQL
-            // R[i] <- R[j] = = R[k]
-            case EQL:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] == RF[IR->mMOperand];
-                break;
-            // 20 - NEQ
-            // R[i] <- R[j] != R[k]
-            case NEQ:
-                RF[IR->mRegister] = RF[IR->mLexLevelOrReg] != RF[IR->mMOperand];
-                break;
-            // 21 - LSS
-            // R[i] <- R[j] < R[k]
-            case LSS:
-                RF[IR->mRegister] = static_cast<int>(RF[IR->mLexLevelOrReg] < RF[IR->mMOperand]);
-                break;
-            // 22 - LEQ
-            // R[i] <- R[j] <= R[k]
-            case LEQ:
-                RF[IR->mRegister] = static_cast<int>(RF[IR->mLexLevelOrReg] <= RF[IR->mMOperand]);
-                break;
-            // 23 - GTR
-            // R[i] <- R[j] > R[k]
-            case GTR:
-                RF[IR->mRegister] = static_cast<int>(RF[IR->mLexLevelOrReg] > RF[IR->mMOperand]);
-                break;
-            // 24 - GEQ
-            // R[i] <- R[j] >= R[k]
-            case GEQ:
-                RF[IR->mRegister] = static_cast<int>(RF[IR->mLexLevelOrReg] >= RF[IR->mMOperand]);
-                break;
-            default:
-                break;
-        }
-        
-        // Print out state of Registers after execution
-        out << std::setw(6) << std::left << PC
-            << std::setw(6) << std::left << BP
-            << std::setw(10) << std::left << SP;
-        // Getting Dynamic Link to determine how many Lex Levels
-        // into the stack the current Activation Record is.
-        int nextLexLvl = STACK[BP + 1];
-        // Calculating next base pointer from retrieved number
-        // of Lex Levels Down
-        int nextBP = base(nextLexLvl, BP);
-        for (int i = 1; i <= SP; ++i)
-        {
-            if (i == nextBP)
-            {
-                // Calculate next lexicographical level based on current
-                // level and next base pointer based on the current on
-                // the next lexicographical level. We are going up the
-                // stack instead of down.
-                nextBP = base(--nextLexLvl, BP);
-                if (i > 1)
-                {
-                    out << "| ";
-                }
-            }
-            int val = STACK[i];
-            out << val << " ";
-            if (val < 10)
-            {
-                // Adding an extra space for values over 10 to allow for
-                // space for both digits to be printed.
-                out << " ";
-            }
-        }
-        
-        std::stringstream streamFormatter;
-        streamFormatter << std::left << std::setw(112) << out.str();
-        out.str("");
-        out.clear();
-        out << streamFormatter.str();
-        
-        streamFormatter.str("");
-        streamFormatter.clear();
-        
-        for (int i = 0; i < 8; ++i)
-        {
-            streamFormatter << std::setw(3) << std::left << RF[i];
-        }
-        
-        streamFormatter << "\n";
-        
-        out << std::right << streamFormatter.str();
-        
-        outputStream << out.str();
-        out.str("");
-        out.clear();
+        return mInstructionsExecuted;
     }
-    
-    return 0;
-}
 
-inline int base(int lexLevelsDown, int basePointer)
-{
-    int newBasePointer = basePointer; // Find L levels down
-    while (lexLevelsDown > 0)
+    /** What the verifier proved about the code. */
+    const Verification& verification() const
     {
-        newBasePointer = STACK[newBasePointer + 1];
-        lexLevelsDown--;
+        return *mVerification;
     }
-    return newBasePointer;
-}
 
-#endif // VIRTUALMACHINE_H
\ No newline at end of file
+    /** Returns if instructions are checked before they are executed. */
+    bool checked() const
+    {
+        return mChecked;
+    }
+
+    /**
+     * Check instructions even when the code was verified. Unverified code is
+     * always checked. Takes effect at the next reset() or loadState().
+     */
+    void setAlwaysChecked(bool alwaysChecked)
+    {
+        mAlwaysChecked = alwaysChecked;
+    }
+
+    /** Why the machine stopped with ExecutionStatus::Fault, nullptr if it did not. */
+    const char* fault() const
+    {
+        return mFault;
+    }
+
+    /**
+     * Capture the machine state. Output is flushed first, so that nothing
+     * written so far is left in the buffer of the output sink.
+     */
+    MachineState saveState();
+
+    /**
+     * Continue from a state captured by saveState(), possibly of another machine
+     * running the same code. States verified code cannot reach, and any state
+     * of code that calls procedures, are continued checked.
+     * @return false if the state does not fit the code of this machine
+     */
+    bool loadState(const MachineState& state);
+
+    /** Record every executed step into recorder. Pass nullptr to stop tracing. */
+    void setTraceRecorder(TraceRecorder* recorder)
+    {
+        mTraceRecorder = recorder;
+    }
+
+    /**
+     * Count executed instructions in profiler. Pass nullptr to stop profiling.
+     * Only has an effect when the library is built with PMACHINE_PROFILING.
+     */
+    void setProfiler(Profiler* profiler)
+    {
+        mProfiler = profiler;
+    }
+
+    /** Working stack. */
+    const int* stack() const
+    {
+        return mContext.stack;
+    }
+
+    /** Register file. */
+    const int* registers() const
+    {
+        return mContext.registers;
+    }
+
+    int basePointer() const
+    {
+        return mContext.bp;
+    }
+
+    int stackPointer() const
+    {
+        return mContext.sp;
+    }
+
+    int programCounter() const
+    {
+        return mContext.pc;
+    }
+
+private:
+    /**
+     * Hands lanes over mid-run and resumes them unchecked, since they reached
+     * their state running verified code.
+     */
+    friend class LaneMachine;
+
+    /**
+     * The interpreter loop behind resume(). The checked loop checks every
+     * instruction before executing it. The unchecked one trusts the verifier.
+     */
+    template <bool CHECKED>
+    ExecutionStatus execute(std::uint64_t budget);
+
+    /**
+     * Find new base pointer lex levels down from inputted base pointer.
+     * @param lexLevel How many lex levels to go down from base pointer
+     * @param basePointer The starting base pointer
+     * @return The new base pointer
+     */
+    int base(int lexLevel, int basePointer) const;
+
+    /**
+     * Find the stack index offset cells into the frame lexLevel levels down
+     * from the frame at basePointer, following static links inside the stack only.
+     * @return The stack index, -1 if a link or the index is outside of the stack
+     */
+    int checkedAddress(int lexLevel, int basePointer, int offset) const;
+
+    /**
+     * Find new base pointer like base(), following static links inside the stack only.
+     * @return false if a static link is outside of the stack
+     */
+    bool checkedBase(int lexLevel, int& basePointer) const;
+
+    /**
+     * Add the registers, control registers and stack cells changed by the
+     * instruction at index executed to the trace.
+     * @param storeAddress Stack cell the instruction wrote, if it is a store
+     */
+    void recordStep(int executed, int storeAddress);
+
+    /**
+     * Check the budget and deadline at a loop back edge or call.
+     * @return Running if execution may continue, otherwise the reason to stop
+     */
+    ExecutionStatus checkLimits(std::uint64_t executedCount, std::uint64_t limit);
+
+    /**
+     * Code Store. Holds the code to be
+     * excuted by the Virtual machine.
+     */
+    const Instruction* mCode;
+    int mCodeLength;
+
+    /**
+     * Verified code with its loads and stores of the current frame and of the
+     * frame its static link points to decoded into LOD0, STO0, LODL1 and STOL1,
+     * which find their stack cell without following links in a loop. Runs
+     * without checks execute it. Empty unless the code was verified.
+     */
+    std::vector<Instruction> mDecodedCode;
+
+    /** Verification of the code. Points to mOwnVerification unless given to the constructor. */
+    const Verification* mVerification;
+    std::unique_ptr<Verification> mOwnVerification;
+
+    /** Set while instructions are checked before they are executed. */
+    bool mChecked;
+    bool mAlwaysChecked = false;
+
+    /** Why the last checked instruction failed, nullptr if none did. */
+    const char* mFault = nullptr;
+
+    /** Registers, control registers and stack. */
+    MachineContext mContext;
+
+    /** Instructions executed since the machine was reset. */
+    std::uint64_t mInstructionsExecuted = 0;
+
+    std::chrono::steady_clock::time_point mDeadline;
+    bool mHasDeadline = false;
+    /** Limit checks left until the clock is looked at again. */
+    int mDeadlineCountdown = DEADLINE_CHECK_INTERVAL;
+
+    /**
+     * Destination for values written by SIO1. Output is buffered by the sink and
+     * flushed when the program halts, before input is read or when the buffer fills.
+     */
+    OutputSink* mOutputSink;
+
+    /**
+     * Source of values read by SIO2. A register reads 0 once the source has
+     * no more values.
+     */
+    InputSource* mInputSource;
+
+    /** Records every executed step when set. Execution is not traced by default. */
+    TraceRecorder* mTraceRecorder = nullptr;
+
+    /** Counts executed instructions when set and built with PMACHINE_PROFILING. */
+    Profiler* mProfiler = nullptr;
+};
+
+#endif // VIRTUALMACHINE_H
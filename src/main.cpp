@@ -1,15 +1,39 @@
+#include "CompilationArena.h"
+#include "ExecutionProfile.h"
 #include "Instruction.h"
 #include "LexicalAnalyzer.h"
+#include "Optimizer.h"
 #include "ParserAndCodeGenerator.h"
+#include "PhaseStats.h"
+#include "Profiler.h"
+#include "TraceRecorder.h"
+#include "TraceRenderer.h"
 #include "VirtualMachine.h"
 
+#include <cstdlib>
 #include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
 
 int main(int argc, char *argv[])
 {
     bool printLex = false;
     bool printAsm = false;
     bool printVm = false;
+    bool promptForInput = true;
+    const char* programOutputFileName = nullptr;
+    const char* programInputFileName = nullptr;
+    const char* traceFileName = nullptr;
+    bool profile = false;
+    int profileSampleInterval = 0;
+    bool optimize = false;
+    const char* profileOutputFileName = nullptr;
+    const char* profileInputFileName = nullptr;
+    const char* statsFileName = nullptr;
+    bool statsReport = false;
+    std::uint64_t statsSliceLength = DEFAULT_SLICE_INSTRUCTIONS;
 
     for (int i = 1; i < argc; ++i)
     {
@@ -25,8 +49,72 @@ int main(int argc, char *argv[])
         {
             printVm = true;
         }
+        if (strcmp(argv[i], "-o") == 0 && i + 1 < argc)
+        {
+            programOutputFileName = argv[++i];
+        }
+        if (strcmp(argv[i], "-i") == 0 && i + 1 < argc)
+        {
+            programInputFileName = argv[++i];
+        }
+        if (strcmp(argv[i], "-t") == 0 && i + 1 < argc)
+        {
+            traceFileName = argv[++i];
+        }
+        if (strcmp(argv[i], "-p") == 0)
+        {
+            profile = true;
+        }
+        if (strcmp(argv[i], "-pc") == 0)
+        {
+            // Also estimate the cycles spent per instruction by timing every 64th one
+            profile = true;
+            profileSampleInterval = 64;
+        }
+        if (strcmp(argv[i], "-q") == 0)
+        {
+            promptForInput = false;
+        }
+        if (strcmp(argv[i], "-O") == 0)
+        {
+            optimize = true;
+        }
+        if (strcmp(argv[i], "-pgen") == 0 && i + 1 < argc)
+        {
+            // Add the counts of this run to a profile for -puse
+            profileOutputFileName = argv[++i];
+        }
+        if (strcmp(argv[i], "-puse") == 0 && i + 1 < argc)
+        {
+            // Optimize with a profile written by -pgen
+            profileInputFileName = argv[++i];
+            optimize = true;
+        }
+        if (strcmp(argv[i], "-s") == 0)
+        {
+            // Print time, memory, allocations and work done per phase
+            statsReport = true;
+        }
+        if (strcmp(argv[i], "--stats") == 0 && i + 1 < argc)
+        {
+            // Write time and hardware events per phase and per slice of the run as JSON, - for the screen
+            statsFileName = argv[++i];
+        }
+        if (strcmp(argv[i], "--stats-interval") == 0 && i + 1 < argc)
+        {
+            // Instructions per slice of the run measured by --stats. 0 measures the run as one slice
+            statsSliceLength = std::strtoull(argv[++i], nullptr, 10);
+        }
     }
 
+    // Profiles describe the code as generated, which is what -puse optimizes
+    if (profileOutputFileName != nullptr)
+    {
+        optimize = false;
+    }
+
+    PhaseStats stats(statsReport || statsFileName != nullptr);
+
     std::ofstream outputFile("outputFile.txt");
     std::ifstream inputFile("inputFile.txt");
 
@@ -35,10 +123,12 @@ int main(int argc, char *argv[])
     buffer << inputFile.rdbuf();
     inputFile.close();
 
-    std::vector<std::pair<std::string, token_type>> lexemeTable;
+    std::vector<Lexeme> lexemeTable;
 
     std::stringstream outputStream;
+    stats.beginPhase("lexer", "tokens");
     analyzeCode(buffer, outputStream, lexemeTable);
+    stats.endPhase(lexemeTable.size());
     outputStream << "\n\n\n";
     outputFile << outputStream.str() << std::flush;
     if (printLex)
@@ -48,8 +138,40 @@ int main(int argc, char *argv[])
     outputStream.str("");
     outputStream.clear();
 
-    bool runnableCode = parseAndGenerage(lexemeTable, outputStream);
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+    // Parser scratch data, released in one go once the code is generated
+    CompilationArena arena;
+    stats.beginPhase("parser", "tokens");
+    bool runnableCode = parseAndGenerage(lexemeTable, outputStream, code, codeLines, arena.resource());
+    arena.release();
+    stats.endPhase(lexemeTable.size());
     outputStream << "\n\n";
+
+    if (runnableCode && optimize)
+    {
+        ExecutionProfile executionProfile;
+        if (profileInputFileName != nullptr)
+        {
+            std::ifstream profileFile(profileInputFileName);
+            if (!ExecutionProfile::load(profileFile, executionProfile))
+            {
+                std::cerr << "Could not read profile " << profileInputFileName << ".\n";
+            }
+            else if (!executionProfile.matches(code.data(), static_cast<int>(code.size())))
+            {
+                std::cerr << "Profile " << profileInputFileName << " was recorded for other code and is ignored.\n";
+            }
+        }
+
+        stats.beginPhase("optimizer", "instructions");
+        OptimizationStats optimization = optimizeCode(code, codeLines, &executionProfile);
+        stats.endPhase(optimization.instructionsBefore);
+        outputStream << "Optimized Code (" << optimization.instructionsBefore << " -> "
+            << optimization.instructionsAfter << " instructions):\n";
+        printCode(outputStream, code);
+        outputStream << "\n\n";
+    }
     outputFile << outputStream.str() << std::flush;
     
     if (printAsm)
@@ -60,19 +182,147 @@ int main(int argc, char *argv[])
     outputStream.str("");
     outputStream.clear();
 
+    // Send values written by the program to a file instead of the screen if requested
+    StdoutSink stdoutSink;
+    OutputSink* programOutput = &stdoutSink;
+    std::unique_ptr<FileSink> programOutputSink;
+    if (programOutputFileName != nullptr)
+    {
+        programOutputSink = std::make_unique<FileSink>(programOutputFileName);
+        if (!programOutputSink->isOpen())
+        {
+            std::cerr << "Could not open output file " << programOutputFileName << ".\n";
+            return 1;
+        }
+        programOutput = programOutputSink.get();
+    }
+
+    // Read values for the program from a file instead of the keyboard if requested
+    StreamInput stdinInput(std::cin, promptForInput);
+    InputSource* programInput = &stdinInput;
+    std::unique_ptr<MappedFileInput> programInputSource;
+    if (programInputFileName != nullptr)
+    {
+        programInputSource = std::make_unique<MappedFileInput>(programInputFileName);
+        if (!programInputSource->isOpen())
+        {
+            std::cerr << "Could not open input file " << programInputFileName << ".\n";
+            return 1;
+        }
+        programInput = programInputSource.get();
+    }
+
     if (runnableCode)
     {
-        runProgram(outputStream);
-        outputFile << outputStream.str();
-        if (printVm)
+        VirtualMachine vm(code.data(), static_cast<int>(code.size()), *programOutput, *programInput);
+
+        // Record a binary trace of the execution. When it is written to a trace file
+        // the text trace is left to pmtrace, otherwise it is rendered here.
+        TraceRecorder trace;
+        if (traceFileName != nullptr && !trace.openFile(traceFileName))
+        {
+            std::cerr << "Could not open trace file " << traceFileName << ".\n";
+            traceFileName = nullptr;
+        }
+        vm.setTraceRecorder(&trace);
+
+#ifdef PMACHINE_PROFILING
+        std::unique_ptr<Profiler> profiler;
+        if (profile || profileOutputFileName != nullptr)
+        {
+            profiler = std::make_unique<Profiler>(static_cast<int>(code.size()), profileSampleInterval);
+            vm.setProfiler(profiler.get());
+        }
+#else
+        if (profile || profileOutputFileName != nullptr)
+        {
+            std::cerr << "Profiling is not available. Build with PMACHINE_ENABLE_PROFILING=ON.\n";
+        }
+#endif
+
+        // Code the verifier could not prove safe runs checked and stops at the first fault.
+        // With --stats the run is measured in slices of about statsSliceLength instructions.
+        std::uint64_t sliceLength = stats.enabled() ? statsSliceLength : 0;
+        vm.reset();
+        stats.beginPhase("vm", "instructions");
+        while (vm.resume(sliceLength) == ExecutionStatus::BudgetExhausted)
+        {
+            stats.endSlice(vm.instructionsExecuted());
+        }
+        stats.endSlice(vm.instructionsExecuted());
+        stats.endPhase(vm.instructionsExecuted());
+        vm.setTraceRecorder(nullptr);
+        std::string fault;
+        if (vm.fault() != nullptr)
         {
-            std::cout << "\n\n" << outputStream.str();
+            fault = "Error: - Run time fault at instruction " + std::to_string(vm.programCounter()) + ": "
+                + vm.fault() + "\n\n";
+            std::cerr << fault;
         }
+
+#ifdef PMACHINE_PROFILING
+        if (profiler && profileOutputFileName != nullptr)
+        {
+            // Runs of the same code add up
+            ExecutionProfile recorded(code.data(), static_cast<int>(code.size()), *profiler);
+            ExecutionProfile executionProfile;
+            std::ifstream existingFile(profileOutputFileName);
+            if (!ExecutionProfile::load(existingFile, executionProfile) || !executionProfile.merge(recorded))
+            {
+                executionProfile = recorded;
+            }
+            existingFile.close();
+            std::ofstream profileFile(profileOutputFileName);
+            executionProfile.save(profileFile);
+        }
+        if (profiler && profile)
+        {
+            vm.setProfiler(nullptr);
+            std::stringstream report;
+            profiler->report(report, code.data(), codeLines.data(), buffer.str());
+            outputFile << "\n\n" << report.str();
+            std::cout << "\n\n" << report.str();
+        }
+#endif
+
+        if (traceFileName == nullptr)
+        {
+            std::stringstream recording;
+            trace.save(recording);
+            renderTrace(recording, outputStream);
+            outputFile << outputStream.str();
+            if (printVm)
+            {
+                std::cout << "\n\n" << outputStream.str();
+            }
+        }
+        outputFile << fault;
     }
     else
     {
         outputStream << "Code not run since generated code is invalid and could cause system instability.\n\n";
     }
 
+    if (statsReport)
+    {
+        std::stringstream report;
+        stats.writeReport(report);
+        outputFile << "\n\n" << report.str();
+        std::cout << "\n\n" << report.str();
+    }
+
     outputFile.close();
+
+    if (statsFileName != nullptr)
+    {
+        if (strcmp(statsFileName, "-") == 0)
+        {
+            stats.writeJson(std::cout);
+        }
+        else
+        {
+            std::ofstream statsFile(statsFileName);
+            stats.writeJson(statsFile);
+        }
+    }
 }
\ No newline at end of file
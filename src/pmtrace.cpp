@@ -0,0 +1,46 @@
+#include "TraceRenderer.h"
+
+#include <fstream>
+#include <iostream>
+
+/**
+ * Renders a binary execution trace written by compile -t as the
+ * text table of the machine state after every executed instruction.
+ *
+ * Usage: pmtrace <trace file> [output file]
+ */
+int main(int argc, char *argv[])
+{
+    if (argc < 2)
+    {
+        std::cerr << "Usage: " << argv[0] << " <trace file> [output file]\n";
+        return 1;
+    }
+
+    std::ifstream traceFile(argv[1], std::ios::binary);
+    if (!traceFile.is_open())
+    {
+        std::cerr << "Could not open trace file " << argv[1] << ".\n";
+        return 1;
+    }
+
+    std::ofstream outputFile;
+    if (argc > 2)
+    {
+        outputFile.open(argv[2]);
+        if (!outputFile.is_open())
+        {
+            std::cerr << "Could not open output file " << argv[2] << ".\n";
+            return 1;
+        }
+    }
+    std::ostream& output = argc > 2 ? outputFile : std::cout;
+
+    if (!renderTrace(traceFile, output))
+    {
+        std::cerr << "Trace file " << argv[1] << " is not a valid trace or is truncated.\n";
+        return 1;
+    }
+
+    return 0;
+}
@@ -0,0 +1,505 @@
+// Differential tests. Every corpus program is taken down the different paths
+// the library has for the same job, such as optimized and unoptimized code or
+// lexing up front and streaming, and the results have to agree.
+//
+// Usage: pmachine_differential_test <check>
+// Runs one of the checks listed in CHECKS and exits with 1 if it found a
+// difference, printing each one.
+
+#include "ExecutionProfile.h"
+#include "IncrementalCompiler.h"
+#include "InputSource.h"
+#include "Instruction.h"
+#include "LexicalAnalyzer.h"
+#include "OutputSink.h"
+#include "ParserAndCodeGenerator.h"
+#include "Program.h"
+#include "Scheduler.h"
+#include "Tokens.h"
+#include "VirtualMachine.h"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <vector>
+
+/** Corpus programs, in tests/corpus. */
+const char* CORPUS[] =
+{
+    "arithmetic.pl0",
+    "branches.pl0",
+    "collatz.pl0",
+    "gcd.pl0",
+    "invariants.pl0",
+    "primes.pl0"
+};
+
+/**
+ * Inputs every corpus program is run with. More sets than LANE_COUNT, so
+ * Program::runAll() fills one batch of lanes and part of another.
+ */
+const std::vector<std::vector<int>> INPUT_SETS =
+{
+    {},
+    {0},
+    {1},
+    {5, 3, 0},
+    {-12, 8, 2},
+    {0, 0},
+    {48, -18, 0},
+    {27, 0},
+    {7, 7},
+    {100, 9, 0},
+    {-3, -5, 0},
+    {2, 3, 4, 5, 0},
+    {13, 1, 19, 0},
+    {40, 2}
+};
+
+/** Instructions a corpus run may execute. Some programs never halt for some inputs. */
+const std::uint64_t INSTRUCTION_LIMIT = 100000;
+
+/** Limits to run corpus programs with: one that lets them finish, and one that cuts them short. */
+std::vector<Limits> runLimits()
+{
+    Limits finish;
+    finish.maxInstructions = INSTRUCTION_LIMIT;
+
+    Limits cut;
+    cut.maxInstructions = 150;
+    cut.maxOutputValues = 2;
+    return {finish, cut};
+}
+
+std::string readCorpusFile(const char* name)
+{
+    std::ifstream file(std::string(PMACHINE_TEST_CORPUS_DIR) + "/" + name);
+    std::stringstream buffer;
+    buffer << file.rdbuf();
+    return buffer.str();
+}
+
+/**
+ * A corpus program padded with empty statements to past PARALLEL_LEX_MIN_SIZE,
+ * so lexSource() splits it into chunks.
+ */
+std::string paddedProgram(std::string program)
+{
+    std::size_t body = program.find("begin") + 5;
+    std::string padding;
+    while (padding.size() < 2 * PARALLEL_LEX_MIN_SIZE)
+    {
+        padding += "\n  ; ; ; /* padding */ ;";
+    }
+    return program.insert(body, padding);
+}
+
+std::string describeInputs(const std::vector<int>& inputs)
+{
+    std::stringstream description;
+    description << "{";
+    for (std::size_t i = 0; i < inputs.size(); ++i)
+    {
+        description << (i == 0 ? "" : ", ") << inputs[i];
+    }
+    description << "}";
+    return description.str();
+}
+
+/** Print a difference found in the corpus program name. Always returns false. */
+bool report(const char* name, const std::string& difference)
+{
+    std::cerr << name << ": " << difference << "\n";
+    return false;
+}
+
+bool sameCode(const std::vector<Instruction>& a, const std::vector<Instruction>& b)
+{
+    if (a.size() != b.size())
+    {
+        return false;
+    }
+    for (std::size_t i = 0; i < a.size(); ++i)
+    {
+        if (a[i].mOpCode != b[i].mOpCode || a[i].mRegister != b[i].mRegister
+            || a[i].mLexLevelOrReg != b[i].mLexLevelOrReg || a[i].mMOperand != b[i].mMOperand)
+        {
+            return false;
+        }
+    }
+    return true;
+}
+
+bool sameResult(const Result& a, const Result& b)
+{
+    return a.status == b.status && a.output == b.output && a.outputTruncated == b.outputTruncated
+        && a.instructionsExecuted == b.instructionsExecuted;
+}
+
+/** Generated code, and what produced it. */
+struct Generated
+{
+    bool valid = false;
+    std::vector<Instruction> code;
+    std::vector<int> codeLines;
+};
+
+/** Parse a lexeme table, the way compile() does. */
+Generated generateFromTable(const std::vector<Lexeme>& lexemes, bool lexicallyCorrect)
+{
+    Generated generated;
+    std::stringstream output;
+    generated.valid = parseAndGenerage(lexemes, output, generated.code, generated.codeLines)
+        && lexicallyCorrect;
+    return generated;
+}
+
+Generated generateFromSource(const std::string& source)
+{
+    std::stringstream input(source);
+    std::stringstream output;
+    std::vector<Lexeme> lexemes;
+    bool lexicallyCorrect = analyzeCode(input, output, lexemes);
+    return generateFromTable(lexemes, lexicallyCorrect);
+}
+
+/**
+ * Compare generated code with the code generated from the lexeme table of
+ * analyzeCode().
+ */
+bool checkGenerated(const char* name, const std::string& path, const Generated& expected, const Generated& generated)
+{
+    if (generated.valid != expected.valid)
+    {
+        return report(name, path + " disagrees on whether the program compiles");
+    }
+    if (!sameCode(generated.code, expected.code))
+    {
+        return report(name, path + " generated different code");
+    }
+    if (generated.codeLines != expected.codeLines)
+    {
+        return report(name, path + " assigned different source lines");
+    }
+    return true;
+}
+
+/**
+ * Run optimized code, and code optimized with a profile of the unoptimized
+ * runs, against the unoptimized code. Counts of executed instructions differ,
+ * so only how runs end and what they write are compared, and runs stopped by
+ * the instruction limit are skipped.
+ */
+bool checkOptimizer(const char* name, const std::string& source)
+{
+    Program program = compile(source);
+    if (!program.valid())
+    {
+        return report(name, "does not compile");
+    }
+
+    Limits limits;
+    limits.maxInstructions = INSTRUCTION_LIMIT;
+    std::vector<Result> expected;
+    ExecutionProfile profile;
+    for (const std::vector<int>& inputs : INPUT_SETS)
+    {
+        expected.push_back(program.run(inputs, profile, limits));
+    }
+
+    CompileOptions optimize;
+    optimize.optimize = true;
+    CompileOptions profileGuided = optimize;
+    profileGuided.profile = &profile;
+
+    bool agrees = true;
+    for (const CompileOptions& options : {optimize, profileGuided})
+    {
+        const char* path = options.profile == nullptr ? "-O" : "profile guided -O";
+        Program optimized = compile(source, options);
+        if (!optimized.valid())
+        {
+            agrees = report(name, std::string(path) + " does not compile");
+            continue;
+        }
+        if (program.verification().verified && !optimized.verification().verified)
+        {
+            agrees = report(name, std::string(path) + " code no longer verifies");
+        }
+        for (std::size_t i = 0; i < INPUT_SETS.size(); ++i)
+        {
+            if (expected[i].status == RunStatus::InstructionLimit)
+            {
+                continue;
+            }
+            Result result = optimized.run(INPUT_SETS[i], limits);
+            if (result.status != expected[i].status || result.output != expected[i].output)
+            {
+                agrees = report(name, std::string(path) + " differs for inputs " + describeInputs(INPUT_SETS[i]));
+            }
+        }
+    }
+    return agrees;
+}
+
+/** Run the input sets through Program::runAll() and compare with run() one set at a time. */
+bool checkLanes(const char* name, const std::string& source)
+{
+    bool agrees = true;
+    for (bool optimize : {false, true})
+    {
+        CompileOptions options;
+        options.optimize = optimize;
+        Program program = compile(source, options);
+        for (const Limits& limits : runLimits())
+        {
+            std::vector<Result> results = program.runAll(INPUT_SETS, limits);
+            for (std::size_t i = 0; i < INPUT_SETS.size(); ++i)
+            {
+                if (!sameResult(results[i], program.run(INPUT_SETS[i], limits)))
+                {
+                    agrees = report(name, std::string("runAll()") + (optimize ? " of -O code" : "")
+                        + " differs for inputs " + describeInputs(INPUT_SETS[i]));
+                }
+            }
+        }
+    }
+    return agrees;
+}
+
+/** Run the input sets as Scheduler instances and compare with run() one set at a time. */
+bool checkScheduler(const char* name, const std::string& source)
+{
+    Program program = compile(source);
+    bool agrees = true;
+    for (const Limits& limits : runLimits())
+    {
+        Scheduler scheduler(2, 64);
+        std::vector<Scheduler::InstanceId> ids;
+        for (const std::vector<int>& inputs : INPUT_SETS)
+        {
+            ids.push_back(scheduler.submit(program, inputs, limits));
+        }
+        scheduler.wait();
+
+        for (std::size_t i = 0; i < INPUT_SETS.size(); ++i)
+        {
+            if (!sameResult(scheduler.result(ids[i]), program.run(INPUT_SETS[i], limits)))
+            {
+                agrees = report(name, "scheduled run differs for inputs " + describeInputs(INPUT_SETS[i]));
+            }
+        }
+    }
+    return agrees;
+}
+
+/**
+ * Edit every number and every + and - of the program body in turn, then undo
+ * the edit. After each, the code of the IncrementalCompiler has to be the code
+ * parseAndGenerage() produces for the source as it is.
+ */
+bool checkIncremental(const char* name, const std::string& source)
+{
+    IncrementalCompiler compiler(source);
+    if (!checkGenerated(name, "IncrementalCompiler", generateFromSource(source),
+        Generated{compiler.valid(), compiler.code(), compiler.codeLines()}))
+    {
+        return false;
+    }
+
+    bool agrees = true;
+    std::size_t body = source.find("begin");
+    for (std::size_t offset = body; offset < source.size(); ++offset)
+    {
+        char c = source[offset];
+        std::size_t length = 1;
+        std::string text;
+        if (c >= '0' && c <= '9')
+        {
+            while (source[offset + length] >= '0' && source[offset + length] <= '9')
+            {
+                ++length;
+            }
+            text = std::to_string(std::stoi(source.substr(offset, length)) + 3);
+        }
+        else if (c == '+' || c == '-')
+        {
+            text = c == '+' ? "-" : "+";
+        }
+        else
+        {
+            continue;
+        }
+
+        std::string original = source.substr(offset, length);
+        compiler.edit(offset, length, text);
+        std::string edited = source.substr(0, offset) + text + source.substr(offset + length);
+        agrees = checkGenerated(name, "IncrementalCompiler after replacing '" + original + "' with '" + text
+            + "' at offset " + std::to_string(offset), generateFromSource(edited),
+            Generated{compiler.valid(), compiler.code(), compiler.codeLines()}) && agrees;
+
+        compiler.edit(offset, text.size(), original);
+        agrees = checkGenerated(name, "IncrementalCompiler after undoing the edit at offset " + std::to_string(offset),
+            generateFromSource(source), Generated{compiler.valid(), compiler.code(), compiler.codeLines()}) && agrees;
+        offset += length - 1;
+    }
+    return agrees;
+}
+
+/**
+ * Generate code from the lexeme table of analyzeCode(), from lexSource() on
+ * several threads, and from lexemes streamed by the lexer on the parser thread
+ * and on a thread of its own. The program is also padded until lexSource()
+ * splits it into chunks.
+ */
+bool checkLexing(const char* name, const std::string& source)
+{
+    bool agrees = true;
+    for (const std::string& program : {source, paddedProgram(source)})
+    {
+        std::stringstream input(program);
+        std::stringstream output;
+        std::vector<Lexeme> table;
+        bool lexicallyCorrect = analyzeCode(input, output, table);
+        Generated expected = generateFromTable(table, lexicallyCorrect);
+        std::string size = program.size() == source.size() ? "" : " of the padded program";
+
+        std::stringstream errors;
+        std::vector<Lexeme> chunked;
+        bool chunksCorrect = lexSource(program, errors, chunked, 4);
+        bool sameLexemes = chunked.size() == table.size();
+        for (std::size_t i = 0; sameLexemes && i < table.size(); ++i)
+        {
+            sameLexemes = chunked[i].lexeme == table[i].lexeme && chunked[i].type == table[i].type
+                && chunked[i].line == table[i].line && chunked[i].offset == table[i].offset
+                && chunked[i].column == table[i].column;
+        }
+        if (!sameLexemes)
+        {
+            agrees = report(name, "lexSource()" + size + " found different lexemes");
+        }
+        agrees = checkGenerated(name, "lexSource()" + size, expected,
+            generateFromTable(chunked, chunksCorrect)) && agrees;
+
+        for (bool lexOnThread : {false, true})
+        {
+            Generated streamed;
+            std::stringstream streamOutput;
+            streamed.valid = parseAndGenerateStreaming(program, streamOutput, streamed.code, streamed.codeLines,
+                lexOnThread);
+            agrees = checkGenerated(name, std::string(lexOnThread ? "threaded " : "") + "streaming" + size,
+                expected, streamed) && agrees;
+        }
+    }
+    return agrees;
+}
+
+/** Run machine until it stops, within the instruction limit of the corpus. */
+Result runMachine(VirtualMachine& machine, const VectorSink& sink)
+{
+    Result result;
+    ExecutionStatus status = machine.resume(INSTRUCTION_LIMIT);
+    result.status = status == ExecutionStatus::Halted ? RunStatus::Halted
+        : status == ExecutionStatus::Fault ? RunStatus::Fault : RunStatus::InstructionLimit;
+    result.output = sink.values();
+    result.instructionsExecuted = machine.instructionsExecuted();
+    return result;
+}
+
+/**
+ * Run verified code without runtime checks and with every check in place.
+ * Both have to end the same way after the same number of instructions.
+ */
+bool checkVerifier(const char* name, const std::string& source)
+{
+    bool agrees = true;
+    for (bool optimize : {false, true})
+    {
+        CompileOptions options;
+        options.optimize = optimize;
+        Program program = compile(source, options);
+        if (!program.verification().verified)
+        {
+            agrees = report(name, std::string(optimize ? "-O code" : "code") + " does not verify");
+            continue;
+        }
+
+        const std::vector<Instruction>& code = program.code();
+        for (const std::vector<int>& inputs : INPUT_SETS)
+        {
+            VectorSink uncheckedSink;
+            VectorInput uncheckedInput(inputs);
+            VirtualMachine unchecked(code.data(), static_cast<int>(code.size()), uncheckedSink, uncheckedInput,
+                program.verification());
+
+            VectorSink checkedSink;
+            VectorInput checkedInput(inputs);
+            VirtualMachine checked(code.data(), static_cast<int>(code.size()), checkedSink, checkedInput,
+                program.verification());
+            checked.setAlwaysChecked(true);
+            checked.reset();
+
+            if (unchecked.checked() || !checked.checked())
+            {
+                return report(name, "setAlwaysChecked() did not choose the checked interpreter");
+            }
+            if (!sameResult(runMachine(unchecked, uncheckedSink), runMachine(checked, checkedSink)))
+            {
+                agrees = report(name, std::string("checked run") + (optimize ? " of -O code" : "")
+                    + " differs for inputs " + describeInputs(inputs));
+            }
+        }
+    }
+    return agrees;
+}
+
+/** A differential check, run over every corpus program. */
+struct Check
+{
+    const char* name;
+    bool (*run)(const char* name, const std::string& source);
+};
+
+const Check CHECKS[] =
+{
+    {"optimizer", checkOptimizer},
+    {"lanes", checkLanes},
+    {"scheduler", checkScheduler},
+    {"incremental", checkIncremental},
+    {"lexing", checkLexing},
+    {"verifier", checkVerifier}
+};
+
+int main(int argc, char* argv[])
+{
+    for (const Check& check : CHECKS)
+    {
+        if (argc == 2 && std::strcmp(argv[1], check.name) == 0)
+        {
+            bool agrees = true;
+            for (const char* name : CORPUS)
+            {
+                std::string source = readCorpusFile(name);
+                if (source.empty())
+                {
+                    agrees = report(name, "could not be read from " PMACHINE_TEST_CORPUS_DIR);
+                    continue;
+                }
+                agrees = check.run(name, source) && agrees;
+            }
+            return agrees ? 0 : 1;
+        }
+    }
+
+    std::cerr << "Usage: " << argv[0] << " <check>\nChecks:";
+    for (const Check& check : CHECKS)
+    {
+        std::cerr << " " << check.name;
+    }
+    std::cerr << "\n";
+    return 1;
+}